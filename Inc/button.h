@@ -22,12 +22,15 @@ typedef enum
 // Button event flag
 extern volatile uint8_t g_button2_short;
 extern volatile uint8_t g_button2_long;
+extern volatile uint8_t g_button3_short;
 extern volatile uint8_t g_button3_long;
+extern volatile uint8_t g_mode_changed;  // Button 1 switched the display mode
 
 // Function Prototypes
 void Button_Init(void);
 DisplayMode_t Button_GetMode(void);
 void Button_NextMode(void);
+void Button_ReportMode(void);  // Mode on the UART, from the main loop
 void EXTI0_IRQHandler(void);
 void EXTI1_IRQHandler(void);
 void EXTI2_IRQHandler(void);
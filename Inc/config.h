@@ -0,0 +1,71 @@
+/*
+ * config.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdint.h>
+
+// Settings kept in flash, so a unit can be tuned without reflashing.
+// Every save appends a copy with the next generation number, the newest
+// one with a good CRC wins at boot. Two banks take turns: a full bank is
+// only given up once the first copy is in the other one, so a power loss
+// at any point leaves the previous settings readable.
+//   bank 0  sector 0, reserved ahead of the log
+//   bank 1  sector 2047, behind the rollup tiers
+#define CONFIG_BANK0_SECTOR  0
+#define CONFIG_BANK1_SECTOR  2047
+#define CONFIG_MAGIC         0x47464E43  // "CNFG"
+#define CONFIG_VERSION       1           // Copies of another version are ignored
+
+// Task period in main loop passes, the task runs every (ticks + 1) passes
+#define CONFIG_TICKS_MAX     1000
+#define CONFIG_TICKS_OFF     0xFFFF      // Task never runs
+#define CONFIG_LOOP_MS_MAX   100
+
+// One copy, 32 bytes so a page holds eight
+typedef struct
+{
+  uint32_t magic;           // CONFIG_MAGIC, blank slots read 0xFFFFFFFF
+  uint8_t version;          // CONFIG_VERSION
+  uint8_t log_mode;         // LoggerMode_t
+  uint8_t accel_range;      // MPU6050 AFS_SEL, 0..3 = +-2, 4, 8, 16 g
+  uint8_t gyro_range;       // MPU6050 FS_SEL, 0..3 = +-250, 500, 1000, 2000 deg/s
+  uint32_t generation;      // Counts up with every save
+  uint16_t loop_ms;         // TIM3 control loop period
+  uint16_t ds18b20_ticks;
+  uint16_t mpu_ticks;
+  uint16_t lcd_ticks;
+  uint16_t uart_ticks;
+  uint16_t record_rate;     // Hz, for a recording started without a rate
+  uint8_t reserved[6];      // 0xFF
+  uint16_t crc;             // CRC-16/CCITT-FALSE of the fields before it
+} __attribute__((packed)) Config_t;
+
+// Settings Config_Set takes, in Config_t order
+typedef enum
+{
+  CONFIG_KEY_LOOP_MS = 0,
+  CONFIG_KEY_DS18B20_TICKS,
+  CONFIG_KEY_MPU_TICKS,
+  CONFIG_KEY_LCD_TICKS,
+  CONFIG_KEY_UART_TICKS,
+  CONFIG_KEY_RECORD_RATE,
+  CONFIG_KEY_ACCEL_RANGE,
+  CONFIG_KEY_GYRO_RANGE,
+  CONFIG_KEY_LOG_MODE,
+  CONFIG_KEYS
+} ConfigKey_t;
+
+void Config_Load(void);                               // Newest good copy, or the defaults
+const Config_t* Config_Get(void);
+uint8_t Config_Set(ConfigKey_t key, uint32_t value);  // 0 if the value is out of range, not saved yet
+ConfigKey_t Config_KeyByName(const char *name);       // CONFIG_KEYS if there is no such setting
+uint8_t Config_Save(void);                            // 0 if the copy didn't verify, Logger_Flush first
+void Config_Report(void);                             // Settings on the UART
+
+#endif /* CONFIG_H_ */
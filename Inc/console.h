@@ -0,0 +1,36 @@
+/*
+ * console.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include <stdint.h>
+
+// Longest command line, longer ones are thrown away whole
+#define CONSOLE_LINE_SIZE  64
+#define CONSOLE_MAX_ARGS   4
+
+// Line commands on the UART, ended by CR or LF. Bytes come in by DMA in
+// the background, lines are only parsed and run from the main loop.
+//   help                       commands
+//   stats                      recorder, UART and log queue stats
+//   config                     settings
+//   set <key|name> <value>     set, save and apply one setting, keys as in ConfigKey_t
+//   rate <hz>                  rate of the next recording, not saved
+//   rec [start [hz] | stop]    start or stop recording, no argument toggles
+//   dump                       whole log as CSV
+//   dump seq|time <from> <to>  records by sequence number or ms since boot
+//   bdump [addr]               binary dump for logdump.py, resumes at addr
+//   summary [seq|time ...]     zone map summary, whole log or a range as for dump
+//   peaks <channel> <min>      records with |value| >= min, LoggerChannel_t
+//   rollup <tier>              rollup windows, 0 = 1 s, 1 = 1 min, 2 = 1 h
+//   erase yes                  erase the log and the rollups
+// Failures answer "ERR <reason>", dumps and erase "ERR erasing" while the
+// log is being erased. Lines sent during a dump run once it is done.
+void Console_Task(void);
+
+#endif /* CONSOLE_H_ */
@@ -0,0 +1,20 @@
+/*
+ * crc.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, same as zlib), start with crc = 0 and chain calls
+uint32_t CRC32_Update(uint32_t crc, const uint8_t *data, uint32_t len);
+
+// CRC-16/CCITT-FALSE, start with crc = CRC16_INIT and chain calls
+#define CRC16_INIT  0xFFFF
+uint16_t CRC16_Update(uint16_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* CRC_H_ */
@@ -19,6 +19,7 @@
 
 // Function prototypes
 void I2C1_Init(void);
+void I2C1_SetFastMode(uint8_t fast);
 void I2C1_Start(void);
 void I2C1_Stop(void);
 uint8_t I2C1_SendAddr(uint8_t addr, uint8_t rw);
@@ -0,0 +1,66 @@
+/*
+ * logcodec.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef LOGCODEC_H_
+#define LOGCODEC_H_
+
+#include <stdint.h>
+#include "logger.h"
+
+// Page format, a bit stream of records, most significant bit first:
+//   record   = 0 bit, type, timestamp, payload
+//   type     = 0 IMU, 10 DS18B20, 110 event, 1110 config
+//   samples  = IMU and DS18B20. The first one of its type in a page is raw,
+//              16 bit per channel and a 32 bit timestamp (keyframe). Later
+//              ones store the zig-zag delta of every channel to the previous
+//              sample of the same type, Rice coded. The timestamp stores the
+//              change of the sample interval instead, 0 for a steady rate.
+//   events   = event and config, timestamp as for samples, then 16 bit id
+//              and 32 bit value raw
+//   check    = 0 bit, 11110, then the CRC-16 of the records since the
+//              previous checkpoint, or since the page start. Written at the
+//              end of every part of the page that is programmed, so a
+//              program cut short by a power loss fails its check.
+// Erased flash reads as 1 bits, so a 1 where a record would start ends the page.
+// Only records followed by a good checkpoint count.
+#define LOGCODEC_STREAMS        3   // IMU, DS18B20, events and config share one
+#define LOGCODEC_MAX_CHANNELS   7   // IMU fields
+#define LOGCODEC_ESCAPE         16  // Unary prefix length that means a raw delta follows
+#define LOGCODEC_CHECK_BITS     22  // Presence, type and CRC of a checkpoint
+
+// Prediction state of one record type
+typedef struct
+{
+  int16_t prev[LOGCODEC_MAX_CHANNELS];    // Last sample, deltas are taken against it
+  uint32_t prev_time;                     // Last timestamp
+  uint32_t prev_step;                     // Last interval
+  uint32_t sum[LOGCODEC_MAX_CHANNELS + 1]; // Recent coded deltas, pick the Rice parameter
+  uint8_t count;                          // Records summed up in sum
+  uint8_t seen;                           // Keyframe done in this page
+} LogCodecStream_t;
+
+// Encoder or decoder state for one page
+typedef struct
+{
+  uint8_t *data;                      // Page data, 0xFF where nothing is written yet
+  uint16_t size;                      // Bytes available
+  uint16_t bit;                       // Next bit to write or read
+  uint16_t records;                   // Records in the page so far
+  uint16_t checked;                   // Records covered by a checkpoint
+  uint16_t crc;                       // CRC-16 of the records after them
+  LogCodecStream_t stream[LOGCODEC_STREAMS];
+} LogCodec_t;
+
+void LogCodec_Begin(LogCodec_t *c, uint8_t *data, uint16_t size);
+void LogCodec_Seed(LogCodec_t *c, const uint8_t *data, uint16_t len);  // More bytes for the first checkpoint
+uint8_t LogCodec_Put(LogCodec_t *c, const LogRecord_t *rec);  // 0 if the page has no room
+uint8_t LogCodec_Check(LogCodec_t *c);                        // Checkpoint, 0 if there was nothing to cover
+uint8_t LogCodec_Get(LogCodec_t *c, LogRecord_t *rec);        // 0 at the end of the page or a bad check
+uint16_t LogCodec_Verify(const LogCodec_t *c);                // Records from here a checkpoint covers
+uint16_t LogCodec_Bytes(const LogCodec_t *c);                 // Bytes touched so far
+
+#endif /* LOGCODEC_H_ */
@@ -10,31 +10,188 @@
 
 #include "stdint.h"
 
-// Log entry structure
+// Record types, every source logs at its own rate when it has fresh data
+typedef enum
+{
+  LOG_RECORD_IMU = 0,   // MPU6050 sample
+  LOG_RECORD_DS18B20,   // DS18B20 conversion
+  LOG_RECORD_EVENT,     // Something happened, LOGGER_EVENT_*
+  LOG_RECORD_CONFIG,    // A setting in effect from now on, LOGGER_CONFIG_*
+  LOG_RECORD_TYPES
+} LogRecordType_t;
+
+// Event codes
+#define LOGGER_EVENT_BOOT          1  // value = records found by the boot scan
+#define LOGGER_EVENT_SENSOR_FAULT  2  // value = LogRecordType_t of the sensor
+#define LOGGER_EVENT_RECORD_START  3  // value = sample rate in Hz
+#define LOGGER_EVENT_RECORD_STOP   4  // value = samples recorded
+#define LOGGER_EVENT_SAMPLES_LOST  5  // value = samples lost to a FIFO overflow
+
+// Config keys
+#define LOGGER_CONFIG_MODE         1  // value = LoggerMode_t
+#define LOGGER_CONFIG_ACCEL_RANGE  2  // value = MPU6050 AFS_SEL, raw accel LSBs depend on it
+#define LOGGER_CONFIG_GYRO_RANGE   3  // value = MPU6050 FS_SEL, raw gyro LSBs depend on it
+
+// One log record
 typedef struct
 {
-  int16_t ds18b20_temp;     // DS18B20
-  int16_t mpu_temp;         // MPU6050
+  uint8_t type;             // LogRecordType_t
+
+  // Sequence number. Not stored in flash, the header's first_sequence
+  // counts up through the sector.
+  uint32_t sequence;
+
+  // TIMER2_GetMillis() when the record was made, gaps show dropped samples
+  uint32_t timestamp;
+
+  union
+  {
+    // LOG_RECORD_IMU, raw sensor LSBs
+    struct
+    {
+      int16_t mpu_temp;     // 0.01 deg C
+      int16_t accel_x;
+      int16_t accel_y;
+      int16_t accel_z;
+      int16_t gyro_x;
+      int16_t gyro_y;
+      int16_t gyro_z;
+    } imu;
+
+    // LOG_RECORD_DS18B20, 0.01 deg C
+    int16_t ds18b20_temp;
 
-  // Accelerometer
-  int16_t accel_x;
-  int16_t accel_y;
-  int16_t accel_z;
+    // LOG_RECORD_EVENT and LOG_RECORD_CONFIG
+    struct
+    {
+      uint16_t id;          // Event code or config key
+      uint32_t value;
+    } event;
+  };
+} LogRecord_t;
 
-  // Gyroscope
-  int16_t gyro_x;
-  int16_t gyro_y;
-  int16_t gyro_z;
+// Sector header values
+#define LOGGER_SECTOR_MAGIC      0x474F4C53  // "SLOG"
+#define LOGGER_FORMAT_VERSION    6           // 6 = compressed tagged records with checkpoints and zone maps
+#define LOGGER_SECTOR_COMMITTED  0x00        // Commit marker once the sector is closed
 
-  // Sequence number, add real timestamp in another project
-  uint16_t sequence;
-} __attribute__((packed)) LogEntry_t;
+// Header at the start of every 4KB log sector
+typedef struct
+{
+  uint32_t magic;           // LOGGER_SECTOR_MAGIC, erased sectors read 0xFFFFFFFF
+  uint8_t version;          // LOGGER_FORMAT_VERSION
+  uint8_t commit;           // 0xFF while open, LOGGER_SECTOR_COMMITTED once entry_count is in
+  uint16_t entry_count;     // 0xFFFF while open, programmed when closed, before commit
+  uint32_t first_sequence;  // Sequence number of the first entry in this sector
+  uint32_t first_timestamp; // Timestamp of the first entry in this sector
+} __attribute__((packed)) LogSectorHeader_t;
+
+// Sensor channels the zone maps summarize, IMU values then the DS18B20
+typedef enum
+{
+  LOGGER_CHANNEL_MPU_TEMP = 0,
+  LOGGER_CHANNEL_ACCEL_X,
+  LOGGER_CHANNEL_ACCEL_Y,
+  LOGGER_CHANNEL_ACCEL_Z,
+  LOGGER_CHANNEL_GYRO_X,
+  LOGGER_CHANNEL_GYRO_Y,
+  LOGGER_CHANNEL_GYRO_Z,
+  LOGGER_CHANNEL_DS18B20,
+  LOGGER_CHANNELS
+} LoggerChannel_t;
+
+typedef struct
+{
+  int16_t min;              // INT16_MAX and INT16_MIN while there are no values
+  int16_t max;
+  int32_t sum;
+} __attribute__((packed)) LogZoneChannel_t;
+
+// Zone map, follows the header. Left erased while the sector is open and
+// programmed before the commit marker, so a committed sector has one.
+typedef struct
+{
+  uint16_t imu_count;       // Records with the IMU channels
+  uint16_t ds18b20_count;   // Records with the DS18B20 channel
+  uint32_t last_timestamp;  // Timestamp of the last entry in this sector
+  LogZoneChannel_t channel[LOGGER_CHANNELS];
+  uint16_t crc;             // CRC-16/CCITT-FALSE of the fields before it
+} __attribute__((packed)) LogZoneMap_t;
+
+// Entries of page 0 start after the header and the zone map
+#define LOGGER_SECTOR_META_SIZE  (sizeof(LogSectorHeader_t) + sizeof(LogZoneMap_t))
+
+// Header bytes that never change after the sector is opened. The first
+// checkpoint of page 0 covers them too, so a torn header program shows.
+#define LOGGER_HEADER_SEED_OFFSET  8  // first_sequence, first_timestamp
+#define LOGGER_HEADER_SEED_SIZE    8
+
+// What happens when the log reaches the end of flash
+typedef enum
+{
+  LOGGER_MODE_LINEAR = 0,  // Stop logging, keep the oldest data
+  LOGGER_MODE_RING         // Erase the oldest sector and keep logging
+} LoggerMode_t;
+
+// Key of a ranged dump. Timestamps restart at every boot, so time ranges
+// are in ms since the current boot and only cover the records made since.
+typedef enum
+{
+  LOGGER_RANGE_SEQUENCE = 0,
+  LOGGER_RANGE_TIME
+} LoggerRange_t;
+
+// Binary dump frames, COBS encoded on the wire and terminated by 0x00.
+// Frame before encoding, little endian:
+//   type(1) addr(4) len(2) data(len) crc32(4), CRC over type..data
+#define LOGGER_FRAME_START        0x01  // data = LogDumpInfo_t
+#define LOGGER_FRAME_DATA         0x02  // data = flash contents at addr
+#define LOGGER_FRAME_END          0x03  // data = number of DATA frames sent (uint32_t)
+#define LOGGER_FRAME_HEADER_SIZE  7
+#define LOGGER_FRAME_CRC_SIZE     4
+
+// Payload of the START frame
+typedef struct
+{
+  uint8_t version;          // LOGGER_FORMAT_VERSION
+  uint8_t mode;             // LoggerMode_t
+  uint16_t first_sector;    // Log area, inclusive
+  uint16_t last_sector;
+  uint16_t oldest_sector;   // Sectors are sent from oldest to newest
+  uint16_t newest_sector;
+  uint16_t sector_size;
+  uint32_t entry_count;
+  uint32_t from_addr;       // Address the dump starts at, 0 = whole log
+} __attribute__((packed)) LogDumpInfo_t;
 
 // Public functions
-void Logger_Init(void);
+void Logger_Init(LoggerMode_t mode);
 void Logger_SaveEntry(void);
+void Logger_SaveIMU(void);
+void Logger_SaveTemperature(void);
+void Logger_SaveEvent(uint16_t code, uint32_t value);
+void Logger_SaveConfig(uint16_t key, uint32_t value);
+
+// Dumps only start here, Logger_Task sends them a page at a time as the TX
+// ring has room. One at a time, none while erasing.
 void Logger_DumpAll(void);
+void Logger_DumpRange(LoggerRange_t key, uint32_t from, uint32_t to);  // Inclusive
+void Logger_DumpPeaks(LoggerChannel_t channel, uint16_t threshold);    // Records with |value| >= threshold
+void Logger_Summary(LoggerRange_t key, uint32_t from, uint32_t to);    // Count, min, max, mean per channel
+void Logger_DumpRollup(uint8_t tier);                                   // Windows of a rollup tier, rollup.h
+uint8_t Logger_ChannelValue(const LogRecord_t *rec, LoggerChannel_t channel, int16_t *value);
+const char* Logger_ChannelName(LoggerChannel_t channel);
+void Logger_DumpBinary(uint32_t from_addr);
+uint8_t Logger_IsDumping(void);  // Other UART output waits while it is set
 void Logger_EraseAll(void);
+uint8_t Logger_IsErasing(void);
 uint32_t Logger_GetEntryCount(void);
+uint32_t Logger_GetFlashBytes(void);
+uint32_t Logger_GetDiscarded(void);  // Queued records thrown away, erasing or log full
+uint8_t Logger_IsFull(void);
+void Logger_Flush(void);
+void Logger_Task(void);
+void Logger_SetMode(LoggerMode_t mode);
+LoggerMode_t Logger_GetMode(void);
 
 #endif /* LOGGER_H_ */
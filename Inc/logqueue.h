@@ -0,0 +1,41 @@
+/*
+ * logqueue.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef LOGQUEUE_H_
+#define LOGQUEUE_H_
+
+#include <stdint.h>
+#include "logger.h"
+
+// Records between the sensor tasks and the flash writer, power of two.
+// A sector erase takes up to 400 ms, 8 IMU samples at 20 Hz, so this
+// leaves room for faster sensors and the odd long page program.
+#define LOGQUEUE_SIZE  32
+
+// Queue health, only written by the producer
+typedef struct
+{
+  uint32_t pushed;      // Records accepted
+  uint32_t dropped;     // Records lost because the queue was full
+  uint16_t high_water;  // Most records ever waiting at once
+} LogQueue_Stats_t;
+
+// Single producer, single consumer. Neither side blocks or disables
+// interrupts, so either one may run in an interrupt handler.
+void LogQueue_Init(void);
+
+// Producer side
+uint8_t LogQueue_Push(const LogRecord_t *rec);  // 0 if full, the record is dropped
+
+// Consumer side
+LogRecord_t* LogQueue_Peek(void);  // Oldest record, 0 if empty
+void LogQueue_Pop(void);           // Done with the record from LogQueue_Peek
+uint16_t LogQueue_Count(void);
+
+const LogQueue_Stats_t* LogQueue_GetStats(void);
+
+#endif /* LOGQUEUE_H_ */
@@ -34,6 +34,16 @@
 #define MPU6050_CONFIG          0x1A
 #define MPU6050_GYRO_CONFIG     0x1B
 #define MPU6050_ACCEL_CONFIG    0x1C
+#define MPU6050_SMPLRT_DIV      0x19
+#define MPU6050_FIFO_EN         0x23
+#define MPU6050_USER_CTRL       0x6A
+#define MPU6050_FIFO_COUNTH     0x72
+#define MPU6050_FIFO_R_W        0x74
+
+// FIFO, every sample is the 14 bytes from ACCEL_XOUT_H to GYRO_ZOUT_L
+#define MPU6050_FIFO_SIZE         1024
+#define MPU6050_FIFO_SAMPLE_SIZE  14
+#define MPU6050_FIFO_MAX_BURST    18    // Samples per MPU6050_FIFO_Read, 252 bytes
 
 // Raw data structure
 typedef struct
@@ -65,12 +75,23 @@ extern volatile MPU6050_ScaledData_t mpu6050_scaled;
 // Function prototypes
 uint8_t MPU6050_Init(void);
 
+// Full scale ranges, 0..3 = +-2, 4, 8, 16 g and +-250, 500, 1000, 2000 deg/s.
+// Raw values change meaning with them, the scale functions follow.
+uint8_t MPU6050_SetRange(uint8_t accel_range, uint8_t gyro_range);
+
 // Read functions (read and store raw data)
 uint8_t MPU6050_ReadAll(void);
 uint8_t MPU6050_ReadAccel(void);
 uint8_t MPU6050_ReadGyro(void);
 uint8_t MPU6050_ReadTemp(void);
 
+// FIFO, samples at 1kHz / (1 + div) with the low pass filter set to dlpf (1..6)
+uint8_t MPU6050_FIFO_Start(uint8_t div, uint8_t dlpf);
+uint8_t MPU6050_FIFO_Stop(void);
+uint8_t MPU6050_FIFO_Reset(void);
+uint8_t MPU6050_FIFO_Count(uint16_t *count);  // Bytes waiting
+uint8_t MPU6050_FIFO_Read(MPU6050_RawData_t *samples, uint8_t n);
+
 // Scale functions (convert raw to scaled)
 void MPU6050_ScaleAll(void);
 void MPU6050_ScaleAccel(void);
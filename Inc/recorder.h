@@ -0,0 +1,34 @@
+/*
+ * recorder.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <stdint.h>
+
+// Continuous recording of every MPU6050 sample through its FIFO
+#define RECORDER_MAX_RATE       1000  // Hz, gyro output rate with the low pass filter on
+#define RECORDER_DEFAULT_RATE   1000
+#define RECORDER_QUEUE_RESERVE  4     // Log queue slots left to the other sensors
+
+typedef struct
+{
+  uint16_t rate;          // Actual sample rate in Hz
+  uint32_t samples;       // Samples queued for the log
+  uint32_t dropped;       // Lost to FIFO overflows, a full log queue, an erase or a full linear log
+  uint32_t elapsed_ms;    // Since the start, up to the stop once stopped
+  uint32_t flash_bytes;   // Log bytes programmed in that time
+} Recorder_Stats_t;
+
+uint8_t Recorder_Start(uint16_t rate_hz);  // 0 if the log can't take samples or the MPU6050 didn't respond
+void Recorder_Stop(void);
+uint8_t Recorder_IsRunning(void);
+void Recorder_Task(void);                  // Every main loop pass
+void Recorder_GetStats(Recorder_Stats_t *stats);
+void Recorder_Report(void);                // Stats on the UART
+
+#endif /* RECORDER_H_ */
@@ -0,0 +1,58 @@
+/*
+ * rollup.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdint.h>
+#include "logger.h"
+
+// Downsampled copies of the log, min/max/mean per channel over fixed
+// windows. Every tier is a ring of its own behind the raw log, so trends
+// stay available long after the raw ring has wrapped.
+//   tier 0  1 s windows,  64 sectors, 68 minutes
+//   tier 1  1 min windows, 192 sectors, 8.5 days
+//   tier 2  1 h windows,  32 sectors, 85 days
+#define ROLLUP_TIERS           3
+#define ROLLUP_FIRST_SECTOR    1759  // Raw log ends below
+#define ROLLUP_SECTORS         288
+#define ROLLUP_CLOSE_DELAY_MS  1000  // Records may reach the log this late
+
+typedef struct
+{
+  int16_t min;              // INT16_MAX, INT16_MIN and 0 when the channel had no values
+  int16_t max;
+  int16_t mean;
+} __attribute__((packed)) RollupChannel_t;
+
+// One window, 64 bytes so a page holds four
+typedef struct
+{
+  uint32_t sequence;        // Log sequence number of the first record, never goes backwards
+  uint32_t start_ms;        // Window start in ms since boot, a multiple of the period
+  uint32_t imu_count;       // Records with the IMU channels
+  uint16_t ds18b20_count;   // Records with the DS18B20 channel
+  RollupChannel_t channel[LOGGER_CHANNELS];
+  uint16_t crc;             // CRC-16/CCITT-FALSE of the fields before it
+} __attribute__((packed)) RollupRecord_t;
+
+typedef struct
+{
+  uint32_t written[ROLLUP_TIERS];  // Windows programmed since boot
+  uint32_t dropped;                // Windows lost to a full outbox
+} Rollup_Stats_t;
+
+void Rollup_Init(void);                   // Finds where every tier goes on, flash must be idle
+void Rollup_Reset(void);                  // Tiers were erased
+void Rollup_Add(const LogRecord_t *rec);  // Every record saved to the log
+uint8_t Rollup_Task(void);                // Flash must be idle, 1 if a program or erase was started
+uint8_t Rollup_Urgent(void);              // Outbox nearly full, Rollup_Task goes ahead of the log
+uint8_t Rollup_DumpBegin(uint8_t tier);   // CSV on the UART, 0 for an unknown tier
+uint8_t Rollup_DumpStep(void);            // Flash must be idle, 1 once the dump is done
+void Rollup_GetStats(Rollup_Stats_t *stats);
+
+#endif /* ROLLUP_H_ */
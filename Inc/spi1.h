@@ -8,10 +8,22 @@
 #ifndef SPI1_H_
 #define SPI1_H_
 
+#include <stdint.h>
+
+// Called from the DMA interrupt when a bulk transfer has finished
+typedef void (*SPI1_DMA_Callback_t)(void);
+
 // Function Prototypes
 void SPI1_Init(void);
 void SPI1_CS_Low(void);
 void SPI1_CS_High(void);
 uint8_t SPI1_Transfer(uint8_t data);
 
+// Bulk transfers on DMA1 channel 2 (RX) and 3 (TX)
+// tx = 0 clocks out 0xFF, rx = 0 discards received bytes
+void SPI1_TransferDMA(const uint8_t *tx, uint8_t *rx, uint16_t len, SPI1_DMA_Callback_t callback);
+uint8_t SPI1_DMA_Busy(void);
+void SPI1_DMA_Wait(void);
+void DMA1_Channel2_IRQHandler(void);
+
 #endif /* SPI1_H_ */
@@ -8,6 +8,9 @@
 #ifndef TASKS_H_
 #define TASKS_H_
 
+#include <stdint.h>
+#include "config.h"
+
 // Task function prototypes
 void Feedback_Show(const char *line1, const char *line2, uint16_t duration_ms);
 void Task_Feedback_Update(void);
@@ -17,5 +20,10 @@ void Task_MPU6050_Read(void);
 void Task_LCD_Update(void);
 void Task_UART_Output(void);
 void Task_DS18B20_Read(void);
+void Task_Recorder_Toggle(void);
+void Task_Recorder_SetRate(uint16_t rate_hz);
+void Task_UART_Report(void);
+void Task_Config_Apply(void);
+uint8_t Task_Config_Set(ConfigKey_t key, uint32_t value);  // Saved and applied, 0 if out of range
 
 #endif /* TASKS_H_ */
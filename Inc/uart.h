@@ -11,16 +11,33 @@
 #include "stdint.h"
 #include "stdbool.h"
 
-// Buffer structure
+// Single producer, single consumer ring. Only the producer moves head and
+// only the consumer moves tail, so neither side masks interrupts. Both run
+// freely and are masked on access, head - tail is the fill.
 typedef struct
 {
   uint8_t *buffer;
-  uint16_t size;
+  uint16_t mask;            // Size - 1, the size is a power of two
   volatile uint16_t head;
   volatile uint16_t tail;
-  volatile uint16_t count;
 } USART1_Buffer_t;
 
+// What a send does when the TX ring has no room for the whole message
+typedef enum
+{
+  USART1_TX_BLOCK = 0,  // Wait for DMA to make room, console replies
+  USART1_TX_DROP,       // Drop the message, debug output
+  USART1_TX_LATEST      // Hold it back in place of older held back telemetry
+} USART1_TxPolicy_t;
+
+typedef struct
+{
+  uint32_t dropped;      // Bytes of USART1_TX_DROP messages and of ones too long to hold back
+  uint32_t overwritten;  // Bytes of held back telemetry replaced by newer
+  uint32_t waits;        // Blocking sends that had to wait for room
+  uint32_t rx_lost;      // Received bytes RX DMA wrote over before they were read
+} USART1_Stats_t;
+
 /* External declarations */
 extern volatile USART1_Buffer_t usart1_rx_buf;
 extern volatile USART1_Buffer_t usart1_tx_buf;
@@ -30,6 +47,7 @@ void USART1_Init(void);
 void UART1_BufferInit(volatile USART1_Buffer_t *buff, uint8_t *storage, uint16_t size);
 
 // ONE set of buffer functions that work with ANY buffer (using pointers)
+uint16_t USART1_BufferCount(volatile USART1_Buffer_t *buff);
 bool USART1_BufferEmpty(volatile USART1_Buffer_t *buff);
 bool USART1_BufferFull(volatile USART1_Buffer_t *buff);
 bool USART1_BufferWrite(volatile USART1_Buffer_t *buff, uint8_t data);
@@ -38,12 +56,22 @@ uint8_t USART1_BufferRead(volatile USART1_Buffer_t *buff);
 // High-level functions (these will use the buffer functions)
 void USART1_SendChar(char c);
 void USART1_SendString(char *str);
+void USART1_Write(const uint8_t *buf, uint16_t len);  // Whole spans into the TX ring at once
+
+// Non-blocking sends, whole messages or nothing. 0 if the message was dropped.
+uint8_t USART1_TryWrite(const uint8_t *buf, uint16_t len, USART1_TxPolicy_t policy);
+uint8_t USART1_TrySend(const char *str, USART1_TxPolicy_t policy);
+uint16_t USART1_TxFree(void);  // Free bytes in the TX ring
+void USART1_Task(void);  // Every main loop pass, sends held back telemetry
+void USART1_GetStats(USART1_Stats_t *stats);
 uint8_t USART1_GetChar(void);  // Get a character from RX buffer
 bool USART1_DataAvailable(void);  // Check if RX data is available
 
 void USART1_SendNumber(uint32_t num);
 
-// Interrupt handler
+// Interrupt handlers, TX runs on DMA1 channel 4 and RX on channel 5
 void USART1_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
 
 #endif /* UART_H */
@@ -14,6 +14,7 @@
 #define W25Q64_CMD_WRITE_ENABLE     0x06
 #define W25Q64_CMD_WRITE_DISABLE    0x04
 #define W25Q64_CMD_READ_STATUS      0x05
+#define W25Q64_CMD_READ_STATUS2     0x35
 #define W25Q64_CMD_READ_DATA        0x03
 #define W25Q64_CMD_FAST_READ        0x0B
 #define W25Q64_CMD_PAGE_PROGRAM     0x02
@@ -22,10 +23,13 @@
 #define W25Q64_CMD_BLOCK_ERASE_64K  0xD8
 #define W25Q64_CMD_CHIP_ERASE       0xC7
 #define W25Q64_CMD_READ_ID          0x9F
+#define W25Q64_CMD_SUSPEND          0x75
+#define W25Q64_CMD_RESUME           0x7A
 
 // Status register bits
 #define W25Q64_SR_BUSY       (1 << 0)
 #define W25Q64_SR_WEL        (1 << 1) // Write Enable Latch
+#define W25Q64_SR2_SUS       (1 << 7) // Erase or program suspended
 
 // Memory organization
 #define W25Q64_PAGE_SIZE      256
@@ -39,6 +43,7 @@ void W25Q64_Init(void);
 uint8_t W25Q64_ReadID(void);
 uint8_t W25Q64_ReadStatus(void);
 void W25Q64_WaitBusy(void);
+uint8_t W25Q64_IsBusy(void);
 void W25Q64_WriteEnable(void);
 void W25Q64_WriteDisable(void);
 
@@ -47,10 +52,34 @@ void W25Q64_Read(uint32_t addr, uint8_t *buf, uint32_t len);
 void W25Q64_WritePage(uint32_t addr, const uint8_t *buf, uint32_t len);
 void W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len);
 
+// DMA variants, return once the transfer is started
+void W25Q64_StartRead(uint32_t addr, uint8_t *buf, uint32_t len);
+uint8_t W25Q64_TransferDone(void);
+void W25Q64_StartWritePage(uint32_t addr, const uint8_t *buf, uint32_t len);
+
+// Streaming Fast Read, one chip select for a whole sequential range
+void W25Q64_ReadBegin(uint32_t addr);
+void W25Q64_ReadStream(uint8_t *buf, uint32_t len);
+void W25Q64_StartReadStream(uint8_t *buf, uint32_t len);
+void W25Q64_ReadEnd(void);
+
 // Erase functions
 void W25Q64_EraseSector(uint32_t addr);
 void W25Q64_EraseBlock32K(uint32_t addr);
 void W25Q64_EraseBlock64K(uint32_t addr);
 void W25Q64_EraseChip(void);
 
+// Non-blocking erase, poll W25Q64_IsBusy() for completion
+void W25Q64_StartEraseSector(uint32_t addr);
+void W25Q64_StartEraseBlock32K(uint32_t addr);
+void W25Q64_StartEraseBlock64K(uint32_t addr);
+
+// Erase suspend. While an erase from the functions above is suspended, reads
+// and page programs outside the range being erased run as usual, other
+// erases resume it and wait for it first.
+uint8_t W25Q64_ReadStatus2(void);
+uint8_t W25Q64_SuspendErase(void);  // 1 if an erase was running and is now suspended
+void W25Q64_ResumeErase(void);
+uint8_t W25Q64_IsSuspended(void);
+
 #endif /* W25Q64_H_ */
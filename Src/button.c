@@ -19,7 +19,7 @@ static volatile DisplayMode_t current_mode = DISPLAY_MODE_TEMP_HUM;
 // Button states for debouncing
 static volatile uint8_t button1_pressed = 0;  // PA0 - Mode switch
 static volatile uint8_t button2_pressed = 0;  // PA1 - Save/Dump
-static volatile uint8_t button3_pressed = 0;  // PA2 - Erase
+static volatile uint8_t button3_pressed = 0;  // PA2 - Record/Erase
 
 // For long press detection
 static volatile uint16_t button2_press_counter = 0;
@@ -28,7 +28,9 @@ static volatile uint16_t button3_press_counter = 0;
 // Event flag for main loop
 volatile uint8_t g_button2_short = 0;
 volatile uint8_t g_button2_long = 0;
+volatile uint8_t g_button3_short = 0;
 volatile uint8_t g_button3_long = 0;
+volatile uint8_t g_mode_changed = 0;
 
 void Button_Init(void)
 {
@@ -118,7 +120,7 @@ void EXTI1_IRQHandler(void)
   }
 }
 
-// EXTI2 - Button 3 (Erase)
+// EXTI2 - Button 3 (Record/Erase)
 void EXTI2_IRQHandler(void)
 {
   if(EXTI->PR & EXTI_PR_PR2)
@@ -213,7 +215,7 @@ void TIM4_IRQHandler(void)
       }
     }
 
-    // Button 3 - Erase
+    // Button 3 - Record/Erase
     if(button3_pressed)
     {
       if(!(GPIOA->IDR & GPIO_IDR_IDR2))  // Still pressed
@@ -237,6 +239,7 @@ void TIM4_IRQHandler(void)
       }
       else  // Released early
       {
+        g_button3_short = 1;      // Short press detected
         button3_pressed = 0;
         button3_press_counter = 0;
         EXTI->IMR |= EXTI_IMR_MR2;
@@ -250,7 +253,7 @@ DisplayMode_t Button_GetMode(void)
   return current_mode;
 }
 
-// Change to next mode
+// Change to next mode, runs in the TIM4 interrupt
 void Button_NextMode(void)
 {
   current_mode++;
@@ -259,7 +262,13 @@ void Button_NextMode(void)
     current_mode = DISPLAY_MODE_TEMP_HUM;
   }
 
-  // Debug message
+  // The UART TX ring has the main loop as its only writer
+  g_mode_changed = 1;
+}
+
+// Debug message for a mode change
+void Button_ReportMode(void)
+{
   USART1_SendString("Mode changed to: ");
   switch(current_mode)
   {
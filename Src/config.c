@@ -0,0 +1,281 @@
+/*
+ * config.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include <string.h>
+#include "config.h"
+#include "w25q64.h"
+#include "uart.h"
+#include "crc.h"
+#include "logger.h"
+#include "recorder.h"
+
+#define CONFIG_SLOT_SIZE         sizeof(Config_t)  // Should be 32
+#define CONFIG_SLOTS_PER_PAGE    (W25Q64_PAGE_SIZE / CONFIG_SLOT_SIZE)
+#define CONFIG_SLOTS_PER_BANK    (W25Q64_SECTOR_SIZE / CONFIG_SLOT_SIZE)
+
+static const uint16_t bank_sector[2] = { CONFIG_BANK0_SECTOR, CONFIG_BANK1_SECTOR };
+
+static const char *const key_names[CONFIG_KEYS] = { "loop_ms",     "ds18b20_ticks", "mpu_ticks",
+                                                    "lcd_ticks",   "uart_ticks",    "record_rate",
+                                                    "accel_range", "gyro_range",    "log_mode" };
+
+static Config_t config;         // Settings in effect
+static uint8_t bank = 0;        // Bank the next copy goes to
+static uint16_t next_slot = 0;  // First slot after the last programmed one
+static uint8_t loaded = 0;      // Settings came from flash
+
+static uint32_t SlotAddr(uint8_t b, uint16_t slot)
+{
+  return (uint32_t) bank_sector[b] * W25Q64_SECTOR_SIZE + (uint32_t) slot * CONFIG_SLOT_SIZE;
+}
+
+static uint16_t ConfigCrc(const Config_t *c)
+{
+  return CRC16_Update(CRC16_INIT, (const uint8_t*) c, CONFIG_SLOT_SIZE - 2);
+}
+
+static uint8_t IsValid(const Config_t *c)
+{
+  return c->magic == CONFIG_MAGIC && c->version == CONFIG_VERSION && c->crc == ConfigCrc(c);
+}
+
+static uint8_t IsBlank(const uint8_t *p)
+{
+  for(uint8_t i = 0; i < CONFIG_SLOT_SIZE; i++)
+  {
+    if(p[i] != 0xFF)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Every value is checked again after a load, a copy from a build with other
+// limits never gets applied as it is
+static uint8_t InRange(ConfigKey_t key, uint32_t value)
+{
+  switch(key)
+  {
+    case CONFIG_KEY_LOOP_MS:
+      return value >= 1 && value <= CONFIG_LOOP_MS_MAX;
+
+    case CONFIG_KEY_DS18B20_TICKS:
+    case CONFIG_KEY_MPU_TICKS:
+    case CONFIG_KEY_LCD_TICKS:
+    case CONFIG_KEY_UART_TICKS:
+      return value <= CONFIG_TICKS_MAX || value == CONFIG_TICKS_OFF;
+
+    case CONFIG_KEY_RECORD_RATE:
+      return value >= 1 && value <= RECORDER_MAX_RATE;
+
+    case CONFIG_KEY_ACCEL_RANGE:
+    case CONFIG_KEY_GYRO_RANGE:
+      return value <= 3;
+
+    case CONFIG_KEY_LOG_MODE:
+      return value <= LOGGER_MODE_RING;
+
+    default:
+      return 0;
+  }
+}
+
+static uint32_t GetValue(const Config_t *c, ConfigKey_t key)
+{
+  switch(key)
+  {
+    case CONFIG_KEY_LOOP_MS:       return c->loop_ms;
+    case CONFIG_KEY_DS18B20_TICKS: return c->ds18b20_ticks;
+    case CONFIG_KEY_MPU_TICKS:     return c->mpu_ticks;
+    case CONFIG_KEY_LCD_TICKS:     return c->lcd_ticks;
+    case CONFIG_KEY_UART_TICKS:    return c->uart_ticks;
+    case CONFIG_KEY_RECORD_RATE:   return c->record_rate;
+    case CONFIG_KEY_ACCEL_RANGE:   return c->accel_range;
+    case CONFIG_KEY_GYRO_RANGE:    return c->gyro_range;
+    case CONFIG_KEY_LOG_MODE:      return c->log_mode;
+    default:                       return 0;
+  }
+}
+
+static uint8_t AllInRange(const Config_t *c)
+{
+  for(uint8_t k = 0; k < CONFIG_KEYS; k++)
+  {
+    if(!InRange((ConfigKey_t) k, GetValue(c, (ConfigKey_t) k)))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Built-in settings, the rates the firmware always ran at
+static void Defaults(void)
+{
+  for(uint8_t i = 0; i < CONFIG_SLOT_SIZE; i++)
+  {
+    ((uint8_t*) &config)[i] = 0xFF;
+  }
+
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.log_mode = LOGGER_MODE_RING;
+  config.accel_range = 0;
+  config.gyro_range = 0;
+  config.generation = 0;
+  config.loop_ms = 10;
+  config.ds18b20_ticks = 100;
+  config.mpu_ticks = 5;
+  config.lcd_ticks = 10;
+  config.uart_ticks = 10;
+  config.record_rate = RECORDER_DEFAULT_RATE;
+}
+
+// Both banks are read up to their first blank slot. Copies are only ever
+// appended, so that is where the next one goes in the bank holding the
+// newest. A torn copy fails its CRC and the one before it is used.
+void Config_Load(void)
+{
+  uint8_t page[W25Q64_PAGE_SIZE];
+  const Config_t *c;
+  uint16_t used[2];
+  uint8_t best_bank = 0;
+  uint8_t found = 0;
+
+  // A reset can land in the middle of an erase
+  W25Q64_WaitBusy();
+
+  Defaults();
+
+  for(uint8_t b = 0; b < 2; b++)
+  {
+    used[b] = CONFIG_SLOTS_PER_BANK;
+
+    for(uint16_t slot = 0; slot < CONFIG_SLOTS_PER_BANK; slot++)
+    {
+      if(slot % CONFIG_SLOTS_PER_PAGE == 0)
+      {
+        W25Q64_Read(SlotAddr(b, slot), page, W25Q64_PAGE_SIZE);
+      }
+
+      c = (const Config_t*) &page[(slot % CONFIG_SLOTS_PER_PAGE) * CONFIG_SLOT_SIZE];
+      if(IsBlank((const uint8_t*) c))
+      {
+        used[b] = slot;
+        break;
+      }
+
+      if(IsValid(c) && AllInRange(c) && (!found || c->generation > config.generation))
+      {
+        config = *c;
+        best_bank = b;
+        found = 1;
+      }
+    }
+  }
+
+  loaded = found;
+  bank = best_bank;
+  next_slot = used[best_bank];
+}
+
+const Config_t* Config_Get(void)
+{
+  return &config;
+}
+
+uint8_t Config_Set(ConfigKey_t key, uint32_t value)
+{
+  if(!InRange(key, value))
+  {
+    return 0;
+  }
+
+  switch(key)
+  {
+    case CONFIG_KEY_LOOP_MS:       config.loop_ms = value; break;
+    case CONFIG_KEY_DS18B20_TICKS: config.ds18b20_ticks = value; break;
+    case CONFIG_KEY_MPU_TICKS:     config.mpu_ticks = value; break;
+    case CONFIG_KEY_LCD_TICKS:     config.lcd_ticks = value; break;
+    case CONFIG_KEY_UART_TICKS:    config.uart_ticks = value; break;
+    case CONFIG_KEY_RECORD_RATE:   config.record_rate = value; break;
+    case CONFIG_KEY_ACCEL_RANGE:   config.accel_range = value; break;
+    case CONFIG_KEY_GYRO_RANGE:    config.gyro_range = value; break;
+    case CONFIG_KEY_LOG_MODE:      config.log_mode = value; break;
+    default:                       return 0;
+  }
+
+  return 1;
+}
+
+ConfigKey_t Config_KeyByName(const char *name)
+{
+  for(uint8_t k = 0; k < CONFIG_KEYS; k++)
+  {
+    if(strcmp(name, key_names[k]) == 0)
+    {
+      return (ConfigKey_t) k;
+    }
+  }
+  return CONFIG_KEYS;
+}
+
+// Append the settings as a new copy. A full bank switches to the other one,
+// which is erased first while the full one still holds the previous copy.
+uint8_t Config_Save(void)
+{
+  Config_t check;
+
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.generation++;
+  config.crc = ConfigCrc(&config);
+
+  if(next_slot >= CONFIG_SLOTS_PER_BANK)
+  {
+    bank ^= 1;
+    next_slot = 0;
+    W25Q64_EraseSector(SlotAddr(bank, 0));
+  }
+
+  // A failed program still used the slot up
+  W25Q64_WritePage(SlotAddr(bank, next_slot), (const uint8_t*) &config, CONFIG_SLOT_SIZE);
+  W25Q64_Read(SlotAddr(bank, next_slot), (uint8_t*) &check, CONFIG_SLOT_SIZE);
+  next_slot++;
+
+  if(!IsValid(&check) || check.generation != config.generation)
+  {
+    return 0;
+  }
+
+  loaded = 1;
+  return 1;
+}
+
+// One "key,name,value" line per setting, "set" on the console takes the
+// key or the name
+void Config_Report(void)
+{
+  USART1_SendString(loaded ? "Config generation " : "Config defaults, generation ");
+  USART1_SendNumber(config.generation);
+  USART1_SendString(", bank ");
+  USART1_SendNumber(bank);
+  USART1_SendString(" slot ");
+  USART1_SendNumber(next_slot);
+  USART1_SendString("\r\n");
+
+  for(uint8_t k = 0; k < CONFIG_KEYS; k++)
+  {
+    USART1_SendNumber(k);
+    USART1_SendChar(',');
+    USART1_SendString((char*) key_names[k]);
+    USART1_SendChar(',');
+    USART1_SendNumber(GetValue(&config, (ConfigKey_t) k));
+    USART1_SendString("\r\n");
+  }
+}
@@ -0,0 +1,524 @@
+/*
+ * console.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include <string.h>
+#include "console.h"
+#include "uart.h"
+#include "logger.h"
+#include "logqueue.h"
+#include "recorder.h"
+#include "rollup.h"
+#include "config.h"
+#include "tasks.h"
+
+typedef struct
+{
+  const char *name;
+  void (*run)(uint8_t argc, char **argv);  // argv[0] is the command
+  const char *usage;
+} ConsoleCommand_t;
+
+static char line[CONSOLE_LINE_SIZE];
+static uint8_t line_len = 0;
+static uint8_t line_overflow = 0;  // Line too long, skipping to its end
+
+static void Error(const char *reason)
+{
+  USART1_SendString("ERR ");
+  USART1_SendString((char*) reason);
+  USART1_SendString("\r\n");
+}
+
+// Decimal or 0x hex, the whole argument or it fails
+static uint8_t ParseNumber(const char *str, uint32_t *value)
+{
+  uint32_t base = 10;
+  uint32_t n = 0;
+  uint32_t digit;
+
+  if(str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+  {
+    base = 16;
+    str += 2;
+  }
+
+  if(*str == '\0')
+  {
+    return 0;
+  }
+
+  for(; *str; str++)
+  {
+    if(*str >= '0' && *str <= '9')
+      digit = *str - '0';
+    else if(base == 16 && *str >= 'a' && *str <= 'f')
+      digit = *str - 'a' + 10;
+    else if(base == 16 && *str >= 'A' && *str <= 'F')
+      digit = *str - 'A' + 10;
+    else
+      return 0;
+
+    if(n > (0xFFFFFFFF - digit) / base)
+    {
+      return 0;  // Overflow
+    }
+    n = n * base + digit;
+  }
+
+  *value = n;
+  return 1;
+}
+
+// Numbers from argv[first] on into values, "ERR bad number" if one isn't
+static uint8_t ParseArgs(char **argv, uint8_t first, uint8_t count, uint32_t *values)
+{
+  for(uint8_t i = 0; i < count; i++)
+  {
+    if(!ParseNumber(argv[first + i], &values[i]))
+    {
+      Error("bad number");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// "seq|time <from> <to>" from argv[1] on, "ERR <usage>" if it isn't
+static uint8_t ParseRange(uint8_t argc, char **argv, const char *usage, LoggerRange_t *key, uint32_t *range)
+{
+  if(argc != 4 || (strcmp(argv[1], "seq") != 0 && strcmp(argv[1], "time") != 0))
+  {
+    Error(usage);
+    return 0;
+  }
+
+  if(!ParseArgs(argv, 2, 2, range))
+  {
+    return 0;
+  }
+
+  *key = (argv[1][0] == 's') ? LOGGER_RANGE_SEQUENCE : LOGGER_RANGE_TIME;
+  return 1;
+}
+
+// Dumps read the log, the erase would take it from under them
+static uint8_t LogReadable(void)
+{
+  if(Logger_IsErasing())
+  {
+    Error("erasing");
+    return 0;
+  }
+  return 1;
+}
+
+static void CmdHelp(uint8_t argc, char **argv);
+
+static void CmdStats(uint8_t argc, char **argv)
+{
+  const LogQueue_Stats_t *q = LogQueue_GetStats();
+
+  Recorder_Report();
+  Task_UART_Report();
+
+  USART1_SendString("Log: ");
+  USART1_SendNumber(Logger_GetEntryCount());
+  USART1_SendString(" entries, ");
+  USART1_SendNumber(Logger_GetFlashBytes());
+  USART1_SendString(" flash bytes, queue ");
+  USART1_SendNumber(q->dropped);
+  USART1_SendString(" dropped, ");
+  USART1_SendNumber(q->high_water);
+  USART1_SendString(" high water\r\n");
+}
+
+static void CmdConfig(uint8_t argc, char **argv)
+{
+  Config_Report();
+}
+
+static void CmdSet(uint8_t argc, char **argv)
+{
+  uint32_t key;
+  uint32_t value;
+
+  if(argc != 3)
+  {
+    Error("usage: set <key|name> <value>");
+    return;
+  }
+
+  // Key number or setting name
+  if(!ParseNumber(argv[1], &key))
+  {
+    key = Config_KeyByName(argv[1]);
+  }
+
+  if(key >= CONFIG_KEYS)
+  {
+    Error("unknown setting");
+    return;
+  }
+
+  if(!ParseArgs(argv, 2, 1, &value))
+  {
+    return;
+  }
+
+  Task_Config_Set((ConfigKey_t) key, value);
+}
+
+static void CmdRate(uint8_t argc, char **argv)
+{
+  uint32_t rate;
+
+  if(argc != 2)
+  {
+    Error("usage: rate <hz>");
+    return;
+  }
+
+  if(!ParseArgs(argv, 1, 1, &rate))
+  {
+    return;
+  }
+
+  if(rate == 0 || rate > RECORDER_MAX_RATE)
+  {
+    Error("rate out of range");
+    return;
+  }
+
+  Task_Recorder_SetRate(rate);
+  USART1_SendString("Next recording at ");
+  USART1_SendNumber(rate);
+  USART1_SendString(" Hz\r\n");
+}
+
+static void CmdRec(uint8_t argc, char **argv)
+{
+  uint32_t rate;
+
+  if(argc == 1)
+  {
+    Task_Recorder_Toggle();
+    return;
+  }
+
+  if(strcmp(argv[1], "start") == 0 && argc <= 3)
+  {
+    if(Recorder_IsRunning())
+    {
+      Error("already recording");
+      return;
+    }
+
+    if(argc == 3)
+    {
+      if(!ParseArgs(argv, 2, 1, &rate))
+      {
+        return;
+      }
+      if(rate == 0 || rate > RECORDER_MAX_RATE)
+      {
+        Error("rate out of range");
+        return;
+      }
+      Task_Recorder_SetRate(rate);
+    }
+
+    if(Logger_IsErasing())
+    {
+      Error("erasing");
+      return;
+    }
+    if(Logger_IsFull())
+    {
+      Error("log full");
+      return;
+    }
+
+    Task_Recorder_Toggle();
+  }
+  else if(strcmp(argv[1], "stop") == 0 && argc == 2)
+  {
+    if(!Recorder_IsRunning())
+    {
+      Error("not recording");
+      return;
+    }
+
+    Task_Recorder_Toggle();
+  }
+  else
+  {
+    Error("usage: rec [start [hz] | stop]");
+  }
+}
+
+static void CmdDump(uint8_t argc, char **argv)
+{
+  LoggerRange_t key;
+  uint32_t range[2];
+
+  if(argc == 1)
+  {
+    if(LogReadable())
+    {
+      Logger_DumpAll();
+    }
+    return;
+  }
+
+  if(!ParseRange(argc, argv, "usage: dump [seq|time <from> <to>]", &key, range) || !LogReadable())
+  {
+    return;
+  }
+
+  Logger_DumpRange(key, range[0], range[1]);
+}
+
+static void CmdBinaryDump(uint8_t argc, char **argv)
+{
+  uint32_t addr = 0;
+
+  if(argc > 2)
+  {
+    Error("usage: bdump [addr]");
+    return;
+  }
+
+  if((argc == 2 && !ParseArgs(argv, 1, 1, &addr)) || !LogReadable())
+  {
+    return;
+  }
+
+  Logger_DumpBinary(addr);
+}
+
+static void CmdSummary(uint8_t argc, char **argv)
+{
+  LoggerRange_t key = LOGGER_RANGE_SEQUENCE;
+  uint32_t range[2] = { 0, 0xFFFFFFFF };
+
+  if(argc != 1 && !ParseRange(argc, argv, "usage: summary [seq|time <from> <to>]", &key, range))
+  {
+    return;
+  }
+
+  if(!LogReadable())
+  {
+    return;
+  }
+
+  Logger_Summary(key, range[0], range[1]);
+}
+
+static void CmdPeaks(uint8_t argc, char **argv)
+{
+  uint32_t args[2];
+
+  if(argc != 3)
+  {
+    Error("usage: peaks <channel> <min>");
+    return;
+  }
+
+  if(!ParseArgs(argv, 1, 2, args))
+  {
+    return;
+  }
+
+  if(args[0] >= LOGGER_CHANNELS)
+  {
+    Error("unknown channel");
+    return;
+  }
+
+  if(!LogReadable())
+  {
+    return;
+  }
+
+  Logger_DumpPeaks((LoggerChannel_t) args[0], (args[1] < 0xFFFF) ? args[1] : 0xFFFF);
+}
+
+static void CmdRollup(uint8_t argc, char **argv)
+{
+  uint32_t tier;
+
+  if(argc != 2)
+  {
+    Error("usage: rollup <tier>");
+    return;
+  }
+
+  if(!ParseArgs(argv, 1, 1, &tier))
+  {
+    return;
+  }
+
+  if(tier >= ROLLUP_TIERS)
+  {
+    Error("unknown tier");
+    return;
+  }
+
+  if(!LogReadable())
+  {
+    return;
+  }
+
+  Logger_DumpRollup(tier);
+}
+
+// Takes the whole log, so it has to be asked for twice over
+static void CmdErase(uint8_t argc, char **argv)
+{
+  if(argc != 2 || strcmp(argv[1], "yes") != 0)
+  {
+    Error("usage: erase yes");
+    return;
+  }
+
+  if(Logger_IsErasing())
+  {
+    Error("erasing");
+    return;
+  }
+
+  Logger_EraseAll();
+}
+
+static const ConsoleCommand_t commands[] = {
+  { "help",    CmdHelp,       "" },
+  { "stats",   CmdStats,      "" },
+  { "config",  CmdConfig,     "" },
+  { "set",     CmdSet,        " <key|name> <value>" },
+  { "rate",    CmdRate,       " <hz>" },
+  { "rec",     CmdRec,        " [start [hz] | stop]" },
+  { "dump",    CmdDump,       " [seq|time <from> <to>]" },
+  { "bdump",   CmdBinaryDump, " [addr]" },
+  { "summary", CmdSummary,    " [seq|time <from> <to>]" },
+  { "peaks",   CmdPeaks,      " <channel> <min>" },
+  { "rollup",  CmdRollup,     " <tier>" },
+  { "erase",   CmdErase,      " yes" },
+};
+
+#define CONSOLE_COMMANDS  (sizeof(commands) / sizeof(commands[0]))
+
+static void CmdHelp(uint8_t argc, char **argv)
+{
+  for(uint8_t i = 0; i < CONSOLE_COMMANDS; i++)
+  {
+    USART1_SendString((char*) commands[i].name);
+    USART1_SendString((char*) commands[i].usage);
+    USART1_SendString("\r\n");
+  }
+}
+
+// Split the line at spaces in place and run its command
+static void Execute(void)
+{
+  char *argv[CONSOLE_MAX_ARGS];
+  uint8_t argc = 0;
+  char *p = line;
+
+  while(*p)
+  {
+    while(*p == ' ' || *p == '\t')
+    {
+      *p++ = '\0';
+    }
+    if(*p == '\0')
+    {
+      break;
+    }
+
+    if(argc == CONSOLE_MAX_ARGS)
+    {
+      Error("too many arguments");
+      return;
+    }
+    argv[argc++] = p;
+
+    while(*p && *p != ' ' && *p != '\t')
+    {
+      p++;
+    }
+  }
+
+  if(argc == 0)
+  {
+    return;  // Blank line, or the LF of a CR LF
+  }
+
+  for(uint8_t i = 0; i < CONSOLE_COMMANDS; i++)
+  {
+    if(strcmp(argv[0], commands[i].name) == 0)
+    {
+      commands[i].run(argc, argv);
+      return;
+    }
+  }
+
+  Error("unknown command, try help");
+}
+
+// Whatever DMA brought in since the last pass, every complete line is run
+void Console_Task(void)
+{
+  uint8_t c;
+
+  // Replies would run into the dump, lines wait in the RX ring until it is done
+  if(Logger_IsDumping())
+  {
+    return;
+  }
+
+  while(USART1_DataAvailable())
+  {
+    c = USART1_GetChar();
+
+    if(c == '\r' || c == '\n')
+    {
+      if(line_overflow)
+      {
+        Error("line too long");
+      }
+      else
+      {
+        line[line_len] = '\0';
+        Execute();
+      }
+
+      line_len = 0;
+      line_overflow = 0;
+
+      // That line started a dump, the rest of the burst waits for it
+      if(Logger_IsDumping())
+      {
+        break;
+      }
+    }
+    else if(c == '\b' || c == 0x7F)
+    {
+      if(line_len > 0)
+      {
+        line_len--;
+      }
+    }
+    else if(line_len < CONSOLE_LINE_SIZE - 1)
+    {
+      line[line_len++] = c;
+    }
+    else
+    {
+      line_overflow = 1;
+    }
+  }
+}
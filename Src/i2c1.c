@@ -8,6 +8,9 @@
 #include "stm32f103xb.h"
 #include "i2c1.h"
 
+// Bus clock in effect, 100kHz after I2C1_Init
+static uint8_t i2c1_fast = 0;
+
 void I2C1_Init(void)
 {
   // Enable Clocks
@@ -52,6 +55,45 @@ void I2C1_Init(void)
 
   // Enable I2C with ACK
   I2C1->CR1 |= I2C_CR1_PE | I2C_CR1_ACK;
+  i2c1_fast = 0;
+}
+
+// Bus clock, the LCD backpack is only rated for 100kHz, the MPU6050 takes 400kHz.
+// Only reprogrammed when it changes, once the last STOP is out and the bus is idle.
+void I2C1_SetFastMode(uint8_t fast)
+{
+  uint32_t timeout = 10000;
+
+  if(fast == i2c1_fast)
+  {
+    return;
+  }
+
+  // Turning PE off under a transfer can leave BUSY stuck, keep the old speed
+  while((I2C1->CR1 & I2C_CR1_STOP) || (I2C1->SR2 & I2C_SR2_BUSY))
+  {
+    if(--timeout == 0)
+    {
+      return;
+    }
+  }
+
+  // CCR and TRISE only change while the peripheral is off, that also clears ACK
+  I2C1->CR1 &= ~I2C_CR1_PE;
+
+  if(fast)
+  {
+    I2C1->CCR = I2C_CCR_FS | 30;  // 36MHz / 3 / 400kHz = 30, DUTY=0
+    I2C1->TRISE = 11;             // 300ns rise time
+  }
+  else
+  {
+    I2C1->CCR = 180;
+    I2C1->TRISE = 37;
+  }
+
+  I2C1->CR1 |= I2C_CR1_PE | I2C_CR1_ACK;
+  i2c1_fast = fast;
 }
 
 void I2C1_Start(void)
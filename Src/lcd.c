@@ -26,6 +26,9 @@ static void LCD_SendNibble(uint8_t nibble, uint8_t rs)
   if(rs)
     data |= LCD_RS;  // Set RS for data
 
+  // Backpack is only rated for 100kHz, the recorder may have left the bus fast
+  I2C1_SetFastMode(0);
+
   // ENABLE HIGH
   I2C1_Start();
   I2C1_SendAddr(LCD_ADDR, I2C_WRITE);
@@ -0,0 +1,466 @@
+/*
+ * logcodec.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include "logcodec.h"
+#include "crc.h"
+
+// Rice parameter adaptation, sums are halved every LOGCODEC_WINDOW records
+#define LOGCODEC_WINDOW    16
+#define LOGCODEC_SUM_INIT  8
+#define LOGCODEC_MAX_K     15
+
+// Checkpoints take the type code after the record types
+#define LOGCODEC_CHECK_TYPE  LOG_RECORD_TYPES
+
+// Stream of each record type and channels per stream
+static const uint8_t stream_of[LOG_RECORD_TYPES] = { 0, 1, 2, 2 };
+static const uint8_t stream_channels[LOGCODEC_STREAMS] = { 7, 1, 0 };
+
+static void RecordToValues(const LogRecord_t *r, int16_t *v)
+{
+  if(r->type == LOG_RECORD_IMU)
+  {
+    v[0] = r->imu.mpu_temp;
+    v[1] = r->imu.accel_x;
+    v[2] = r->imu.accel_y;
+    v[3] = r->imu.accel_z;
+    v[4] = r->imu.gyro_x;
+    v[5] = r->imu.gyro_y;
+    v[6] = r->imu.gyro_z;
+  }
+  else if(r->type == LOG_RECORD_DS18B20)
+  {
+    v[0] = r->ds18b20_temp;
+  }
+}
+
+static void ValuesToRecord(const int16_t *v, LogRecord_t *r)
+{
+  if(r->type == LOG_RECORD_IMU)
+  {
+    r->imu.mpu_temp = v[0];
+    r->imu.accel_x = v[1];
+    r->imu.accel_y = v[2];
+    r->imu.accel_z = v[3];
+    r->imu.gyro_x = v[4];
+    r->imu.gyro_y = v[5];
+    r->imu.gyro_z = v[6];
+  }
+  else if(r->type == LOG_RECORD_DS18B20)
+  {
+    r->ds18b20_temp = v[0];
+  }
+}
+
+// Checkpoints cover the records as decoded, so a damaged bit anywhere in
+// their code shows up, even one that leaves the stream in step
+static uint16_t RecordCRC(uint16_t crc, const LogRecord_t *r, const int16_t *v, uint8_t n)
+{
+  uint8_t buf[1 + 4 + LOGCODEC_MAX_CHANNELS * 2];
+  uint8_t len = 0;
+
+  buf[len++] = r->type;
+  buf[len++] = r->timestamp & 0xFF;
+  buf[len++] = (r->timestamp >> 8) & 0xFF;
+  buf[len++] = (r->timestamp >> 16) & 0xFF;
+  buf[len++] = (r->timestamp >> 24) & 0xFF;
+
+  for(uint8_t ch = 0; ch < n; ch++)
+  {
+    buf[len++] = (uint16_t) v[ch] & 0xFF;
+    buf[len++] = ((uint16_t) v[ch] >> 8) & 0xFF;
+  }
+
+  if(n == 0)
+  {
+    buf[len++] = r->event.id & 0xFF;
+    buf[len++] = (r->event.id >> 8) & 0xFF;
+    buf[len++] = r->event.value & 0xFF;
+    buf[len++] = (r->event.value >> 8) & 0xFF;
+    buf[len++] = (r->event.value >> 16) & 0xFF;
+    buf[len++] = (r->event.value >> 24) & 0xFF;
+  }
+
+  return CRC16_Update(crc, buf, len);
+}
+
+// Smallest k where count * 2^k covers the recent deltas
+static uint8_t RiceParam(const LogCodecStream_t *s, uint8_t f)
+{
+  uint8_t k = 0;
+
+  while(((uint32_t) s->count << k) < s->sum[f] && k < LOGCODEC_MAX_K)
+  {
+    k++;
+  }
+
+  return k;
+}
+
+static void Adapt(LogCodecStream_t *s, const uint32_t *zz, uint8_t fields)
+{
+  for(uint8_t f = 0; f < fields; f++)
+  {
+    // Saturate, a timestamp jump must not overflow the sum
+    s->sum[f] += (zz[f] < 0x10000) ? zz[f] : 0x10000;
+  }
+
+  if(++s->count >= LOGCODEC_WINDOW)
+  {
+    for(uint8_t f = 0; f < fields; f++)
+    {
+      s->sum[f] >>= 1;
+    }
+    s->count >>= 1;
+  }
+}
+
+// The buffer starts out as 0xFF, so only the 0 bits have to be written
+static void PutBits(LogCodec_t *c, uint32_t value, uint8_t n)
+{
+  while(n--)
+  {
+    if(!((value >> n) & 1))
+    {
+      c->data[c->bit >> 3] &= ~(0x80 >> (c->bit & 7));
+    }
+    c->bit++;
+  }
+}
+
+static uint32_t GetBits(LogCodec_t *c, uint8_t n)
+{
+  uint32_t value = 0;
+
+  while(n--)
+  {
+    value = (value << 1) | ((c->data[c->bit >> 3] >> (7 - (c->bit & 7))) & 1);
+    c->bit++;
+  }
+
+  return value;
+}
+
+// Rice code, or the escape and the raw value when the quotient gets too long
+static void PutRice(LogCodec_t *c, uint32_t zz, uint8_t k, uint8_t width)
+{
+  uint32_t q = zz >> k;
+
+  if(q < LOGCODEC_ESCAPE)
+  {
+    c->bit += q;  // Unary 1 bits are already there
+    PutBits(c, 0, 1);
+    PutBits(c, zz, k);
+  }
+  else
+  {
+    c->bit += LOGCODEC_ESCAPE;
+    PutBits(c, zz, width);
+  }
+}
+
+static uint32_t RiceBits(uint32_t zz, uint8_t k, uint8_t width)
+{
+  uint32_t q = zz >> k;
+
+  return (q < LOGCODEC_ESCAPE) ? q + 1 + k : (uint32_t) LOGCODEC_ESCAPE + width;
+}
+
+// Returns 0 if the code runs past the end of the page
+static uint8_t GetRice(LogCodec_t *c, uint8_t k, uint8_t width, uint32_t *zz)
+{
+  uint32_t end = (uint32_t) c->size * 8;
+  uint32_t q = 0;
+
+  while(q < LOGCODEC_ESCAPE && c->bit < end && GetBits(c, 1))
+  {
+    q++;
+  }
+
+  if((uint32_t) c->bit + ((q < LOGCODEC_ESCAPE) ? k : width) > end)
+  {
+    return 0;
+  }
+
+  *zz = (q < LOGCODEC_ESCAPE) ? ((q << k) | GetBits(c, k)) : GetBits(c, width);
+  return 1;
+}
+
+void LogCodec_Begin(LogCodec_t *c, uint8_t *data, uint16_t size)
+{
+  c->data = data;
+  c->size = size;
+  c->bit = 0;
+  c->records = 0;
+  c->checked = 0;
+  c->crc = CRC16_INIT;
+
+  for(uint8_t i = 0; i < LOGCODEC_STREAMS; i++)
+  {
+    LogCodecStream_t *s = &c->stream[i];
+
+    s->prev_time = 0;
+    s->prev_step = 0;
+    s->count = 1;
+    s->seen = 0;
+
+    for(uint8_t f = 0; f < LOGCODEC_MAX_CHANNELS; f++)
+    {
+      s->prev[f] = 0;
+    }
+
+    for(uint8_t f = 0; f <= LOGCODEC_MAX_CHANNELS; f++)
+    {
+      s->sum[f] = LOGCODEC_SUM_INIT;
+    }
+  }
+}
+
+void LogCodec_Seed(LogCodec_t *c, const uint8_t *data, uint16_t len)
+{
+  c->crc = CRC16_Update(c->crc, data, len);
+}
+
+uint8_t LogCodec_Put(LogCodec_t *c, const LogRecord_t *rec)
+{
+  LogCodecStream_t *s;
+  int16_t v[LOGCODEC_MAX_CHANNELS];
+  uint32_t zz[LOGCODEC_MAX_CHANNELS + 1];
+  uint8_t k[LOGCODEC_MAX_CHANNELS + 1];
+  uint32_t step;
+  uint32_t bits;
+  uint8_t n;
+
+  if(rec->type >= LOG_RECORD_TYPES)
+  {
+    return 0;
+  }
+
+  s = &c->stream[stream_of[rec->type]];
+  n = stream_channels[stream_of[rec->type]];
+  step = rec->timestamp - s->prev_time;
+  bits = 1 + rec->type + 1;  // Presence and type
+
+  RecordToValues(rec, v);
+
+  // Size first, a record that doesn't fit leaves the page untouched
+  if(!s->seen)
+  {
+    bits += n * 16 + 32;
+  }
+  else
+  {
+    for(uint8_t ch = 0; ch < n; ch++)
+    {
+      int16_t d = (int16_t) (v[ch] - s->prev[ch]);  // Wraps, the decoder wraps back
+
+      zz[ch] = (uint16_t) (((uint16_t) d << 1) ^ (uint16_t) (d >> 15));
+      k[ch] = RiceParam(s, ch);
+      bits += RiceBits(zz[ch], k[ch], 16);
+    }
+
+    // Change of the interval, wraps the same way
+    int32_t dt = (int32_t) (step - s->prev_step);
+    zz[n] = ((uint32_t) dt << 1) ^ (uint32_t) (dt >> 31);
+    k[n] = RiceParam(s, n);
+    bits += RiceBits(zz[n], k[n], 32);
+  }
+
+  if(n == 0)
+  {
+    bits += 16 + 32;
+  }
+
+  // Room for the checkpoint after it stays free
+  if(c->bit + bits + LOGCODEC_CHECK_BITS > (uint32_t) c->size * 8)
+  {
+    return 0;
+  }
+
+  // Presence bit and the type in unary
+  PutBits(c, 0, 1);
+  c->bit += rec->type;
+  PutBits(c, 0, 1);
+
+  if(!s->seen)
+  {
+    for(uint8_t ch = 0; ch < n; ch++)
+    {
+      PutBits(c, (uint16_t) v[ch], 16);
+    }
+    PutBits(c, rec->timestamp, 32);
+    step = 0;
+  }
+  else
+  {
+    for(uint8_t f = 0; f <= n; f++)
+    {
+      PutRice(c, zz[f], k[f], (f == n) ? 32 : 16);
+    }
+    Adapt(s, zz, n + 1);
+  }
+
+  if(n == 0)
+  {
+    PutBits(c, rec->event.id, 16);
+    PutBits(c, rec->event.value, 32);
+  }
+
+  for(uint8_t ch = 0; ch < n; ch++)
+  {
+    s->prev[ch] = v[ch];
+  }
+  s->prev_time = rec->timestamp;
+  s->prev_step = step;
+  s->seen = 1;
+  c->records++;
+  c->crc = RecordCRC(c->crc, rec, v, n);
+
+  return 1;
+}
+
+// Every LogCodec_Put left room for this
+uint8_t LogCodec_Check(LogCodec_t *c)
+{
+  if(c->checked == c->records)
+  {
+    return 0;
+  }
+
+  PutBits(c, 0, 1);
+  c->bit += LOGCODEC_CHECK_TYPE;
+  PutBits(c, 0, 1);
+  PutBits(c, c->crc, 16);
+
+  c->checked = c->records;
+  c->crc = CRC16_INIT;
+
+  return 1;
+}
+
+uint8_t LogCodec_Get(LogCodec_t *c, LogRecord_t *rec)
+{
+  LogCodecStream_t *s;
+  int16_t v[LOGCODEC_MAX_CHANNELS];
+  uint32_t zz[LOGCODEC_MAX_CHANNELS + 1];
+  uint32_t end = (uint32_t) c->size * 8;
+  uint32_t time;
+  uint32_t step;
+  uint8_t type;
+  uint8_t n;
+
+  while(1)
+  {
+    // Erased bits or no room for another record
+    if(c->bit >= end || GetBits(c, 1) != 0)
+    {
+      return 0;
+    }
+
+    type = 0;
+    while(c->bit < end && GetBits(c, 1))
+    {
+      if(++type > LOGCODEC_CHECK_TYPE)
+      {
+        return 0;  // Not a record
+      }
+    }
+
+    if(type != LOGCODEC_CHECK_TYPE)
+    {
+      break;
+    }
+
+    // Checkpoint, a mismatch means the program before it was cut short
+    if((uint32_t) c->bit + 16 > end || GetBits(c, 16) != c->crc)
+    {
+      return 0;
+    }
+    c->checked = c->records;
+    c->crc = CRC16_INIT;
+  }
+
+  rec->type = type;
+  s = &c->stream[stream_of[type]];
+  n = stream_channels[stream_of[type]];
+
+  if(!s->seen)
+  {
+    if((uint32_t) c->bit + n * 16 + 32 > end)
+    {
+      return 0;
+    }
+
+    for(uint8_t ch = 0; ch < n; ch++)
+    {
+      v[ch] = (int16_t) GetBits(c, 16);
+    }
+    time = GetBits(c, 32);
+    step = 0;
+  }
+  else
+  {
+    for(uint8_t f = 0; f <= n; f++)
+    {
+      if(!GetRice(c, RiceParam(s, f), (f == n) ? 32 : 16, &zz[f]))
+      {
+        return 0;  // Cut off, not a complete record
+      }
+    }
+
+    for(uint8_t ch = 0; ch < n; ch++)
+    {
+      v[ch] = (int16_t) (s->prev[ch] + (int16_t) ((zz[ch] >> 1) ^ -(zz[ch] & 1)));
+    }
+
+    step = s->prev_step + ((zz[n] >> 1) ^ -(zz[n] & 1));
+    time = s->prev_time + step;
+    Adapt(s, zz, n + 1);
+  }
+
+  if(n == 0)
+  {
+    if((uint32_t) c->bit + 16 + 32 > end)
+    {
+      return 0;
+    }
+
+    rec->event.id = GetBits(c, 16);
+    rec->event.value = GetBits(c, 32);
+  }
+
+  for(uint8_t ch = 0; ch < n; ch++)
+  {
+    s->prev[ch] = v[ch];
+  }
+  s->prev_time = time;
+  s->prev_step = step;
+  s->seen = 1;
+  c->records++;
+
+  ValuesToRecord(v, rec);
+  rec->timestamp = time;
+  c->crc = RecordCRC(c->crc, rec, v, n);
+  return 1;
+}
+
+// Decodes the rest of the page on a copy, the records a checkpoint covers
+// are the ones LogCodec_Get may return
+uint16_t LogCodec_Verify(const LogCodec_t *c)
+{
+  LogCodec_t v = *c;
+  LogRecord_t rec;
+
+  while(LogCodec_Get(&v, &rec));
+
+  return v.checked - c->records;
+}
+
+uint16_t LogCodec_Bytes(const LogCodec_t *c)
+{
+  return (c->bit + 7) / 8;
+}
@@ -11,25 +11,274 @@
 #include "mpu6050.h"
 #include "lcd.h"
 #include "uart.h"
+#include "timer2.h"
+#include "crc.h"
+#include "logcodec.h"
+#include "logqueue.h"
+#include "rollup.h"
 
 // Memory layout
 #define LOGGER_START_ADDR    (1 * W25Q64_SECTOR_SIZE)     // Start at sector 1
-#define LOGGER_MAX_ADDR      (2047 * W25Q64_SECTOR_SIZE)  // Last sector
-#define LOGGER_ENTRY_SIZE    sizeof(LogEntry_t)           // Should be 18
+#define LOGGER_MAX_ADDR      (ROLLUP_FIRST_SECTOR * W25Q64_SECTOR_SIZE)  // Rollup tiers follow
+#define LOGGER_HEADER_SIZE   sizeof(LogSectorHeader_t)    // Should be 16
+#define LOGGER_ZONE_SIZE     sizeof(LogZoneMap_t)         // Should be 74
+
+// Sector layout, a header and zone map followed by pages of compressed entries (logcodec.h).
+// Every page starts with a keyframe, so each one decodes on its own.
+#define LOGGER_FIRST_SECTOR        (LOGGER_START_ADDR / W25Q64_SECTOR_SIZE)
+#define LOGGER_LAST_SECTOR         (LOGGER_MAX_ADDR / W25Q64_SECTOR_SIZE - 1)
+#define LOGGER_PAGES_PER_SECTOR    (W25Q64_SECTOR_SIZE / W25Q64_PAGE_SIZE)
+#define LOGGER_SECTOR_COUNT        (LOGGER_LAST_SECTOR - LOGGER_FIRST_SECTOR + 1)
+#define LOGGER_SECTOR_ADDR(s)      ((uint32_t) (s) * W25Q64_SECTOR_SIZE)
+
+// Byte where the entries of a page start, page 0 holds the header and zone map first
+#define LOGGER_PAGE_DATA(addr)     ((((addr) & (W25Q64_SECTOR_SIZE - 1)) == 0) ? LOGGER_SECTOR_META_SIZE : 0)
+
+// A page is in use once its first record bit is programmed
+#define LOGGER_PAGE_EMPTY(data, addr)  (((data)[LOGGER_PAGE_DATA(addr)] & 0x80) != 0)
+
+// Sparse index, one entry per 64KB block
+#define LOGGER_INDEX_STRIDE        16
+#define LOGGER_INDEX_SIZE          ((LOGGER_SECTOR_COUNT + LOGGER_INDEX_STRIDE - 1) / LOGGER_INDEX_STRIDE)
+#define LOGGER_INDEX_EMPTY         0xFFFFFFFF
+
+// One flash page per binary dump frame
+#define LOGGER_FRAME_DATA_MAX      W25Q64_PAGE_SIZE
+
+// TX ring space a frame needs: header, page, CRC, COBS blocks and delimiters
+#define LOGGER_FRAME_WIRE_MAX      (LOGGER_FRAME_HEADER_SIZE + LOGGER_FRAME_DATA_MAX + LOGGER_FRAME_CRC_SIZE + 4)
+
+// TX ring space a CSV line needs, the longest is a full IMU record
+#define LOGGER_DUMP_LINE_MAX       96
+
+// Sectors a dump step looks at through their zone maps before it lets go
+#define LOGGER_DUMP_SECTORS        16
+
+// Erase time between a resume and the next suspend, so the erase still gets done
+#define LOGGER_ERASE_RUN_MS  5
+
+// QuerySector results
+#define LOGGER_QUERY_NEXT    0  // Nothing more in the sector
+#define LOGGER_QUERY_END     1  // The range ends before it
+#define LOGGER_QUERY_DECODE  2  // Its pages have to be read
+
+// SaveRecord results
+#define LOGGER_SAVE_DONE     0
+#define LOGGER_SAVE_DROPPED  1  // Erasing, or linear mode is full
+#define LOGGER_SAVE_WAIT     2  // Needs a flash operation that is still running
 
 // Static variables
-static uint32_t current_addr = LOGGER_START_ADDR;
 static uint32_t sequence = 0;
 static uint32_t entry_count = 0;
+static uint16_t current_sector = LOGGER_FIRST_SECTOR;  // Sector being written
+static uint16_t oldest_sector = LOGGER_FIRST_SECTOR;   // First sector holding data
+static uint16_t sector_entries = 0;                    // Entries in current sector
+static uint8_t sector_open = 0;                        // Current sector header written
+static uint8_t log_full = 0;                           // Linear mode ran out of space
+static LoggerMode_t log_mode = LOGGER_MODE_RING;
+static uint32_t scan_reads = 0;  // Flash reads used by the boot scan
+static uint32_t flash_bytes = 0; // Bytes programmed since boot
+static uint32_t discarded = 0;   // Records thrown away while erasing or with a full linear log
+
+// Erase ahead of the write pointer, sector 0 is never a log sector so 0 = none
+static uint16_t erase_sector = 0;         // Sector waiting to be erased
+static uint8_t flash_busy = 0;            // Program or erase issued without waiting
+static uint16_t erase_target = 0;         // Log sector of the last erase, 0 for the wipe and rollup tiers
+static uint32_t resume_ms = 0;            // Last time a suspended erase went on
+
+// Erase of the whole log, worked off one block per Logger_Task call
+typedef struct
+{
+  uint16_t bottom;
+  uint16_t top;
+} SectorRange_t;
+
+static SectorRange_t wipe_range[3];  // Used part of the ring in up to two pieces, then the rollup tiers
+static uint8_t wipe_ranges = 0;      // Ranges left, the last one is worked first
+static uint8_t wipe_active = 0;
+static uint16_t wipe_total = 0;      // Sectors to erase
+static uint16_t wipe_done = 0;       // Sectors erase was issued for
+static uint8_t wipe_reported = 0;    // Last progress percentage shown
+
+// Page buffer, entries are collected here and programmed one page at a time
+typedef struct
+{
+  uint8_t data[W25Q64_PAGE_SIZE];  // 0xFF where nothing is stored yet
+  uint32_t addr;     // Flash address of the buffered page
+  uint16_t fill;     // Bytes collected
+  uint16_t written;  // Bytes already in flash
+} LogPage_t;
+
+// Two buffers, so a full page can wait for an erase while the next one fills
+static LogPage_t pages[2];
+static LogPage_t *page = &pages[0];  // Page being filled
+static LogPage_t *pending_page = 0;  // Page waiting for the flash to go idle
+static LogCodec_t codec;             // Encoder of the page being filled
+
+// Commit marker waiting for the flash to go idle, the zone map and count go first
+static uint16_t close_sector = 0;
+static uint16_t close_count = 0;
+static uint8_t close_step = 0;      // Zone map, entry_count, then the commit byte
+static LogZoneMap_t close_zone;     // Read by DMA while it is programmed
+
+// Zone map of the records in the current sector so far
+static LogZoneMap_t zone;
+
+// Sparse index, first sequence and timestamp of every 16th sector, LOGGER_INDEX_EMPTY
+// where that sector holds no log data. Rebuilt from the headers at boot.
+typedef struct
+{
+  uint32_t first_sequence;
+  uint32_t first_timestamp;
+} LogIndexEntry_t;
+
+static LogIndexEntry_t log_index[LOGGER_INDEX_SIZE];
+static uint32_t session_sequence = 1;  // First record of this boot, the time base changes there
+static uint32_t last_timestamp = 0;    // Of the newest record of this boot
+
+// Header and zone map, one read
+typedef struct
+{
+  LogSectorHeader_t header;
+  LogZoneMap_t zone;
+} __attribute__((packed)) LogSectorMeta_t;
+
+// One channel over many sectors
+typedef struct
+{
+  uint32_t count;
+  int16_t min;
+  int16_t max;
+  int64_t sum;
+} LogTotal_t;
+
+// Records a query visits, sent as CSV or summed up
+typedef struct
+{
+  uint8_t by_time;        // Key is the timestamp, otherwise the sequence number
+  uint32_t from;          // Inclusive range of the key
+  uint32_t to;
+  uint32_t min_sequence;  // Records before it are left out
+  uint32_t last_sequence; // Newest record when the query started, later ones are left out
+  uint8_t channel;        // Only records with this channel at or beyond threshold, LOGGER_CHANNELS = all
+  uint16_t threshold;
+  LogTotal_t *totals;     // Records are summed up here instead of sent
+  uint32_t sent;
+  uint16_t sectors;       // Sectors decoded
+  uint16_t zoned;         // Sectors summed up from their zone map
+  uint16_t skipped;       // Sectors the zone map ruled out
+} LogQuery_t;
+
+static const char *const channel_names[LOGGER_CHANNELS] = { "MPU_TEMP", "ACCEL_X", "ACCEL_Y", "ACCEL_Z",
+                                                            "GYRO_X",   "GYRO_Y",  "GYRO_Z",  "DS18B20" };
+
+// Dump buffer, shared by the CSV and the binary dump
+static union
+{
+  uint8_t page[W25Q64_PAGE_SIZE];  // CSV, page being decoded
+  uint8_t frame[LOGGER_FRAME_HEADER_SIZE + LOGGER_FRAME_DATA_MAX + LOGGER_FRAME_CRC_SIZE];
+} dump_buf;
+
+// Steps of a dump, one is worked per Logger_Task pass
+typedef enum
+{
+  DUMP_IDLE = 0,
+  DUMP_QUERY_BEGIN,    // CSV header, first sector of the range
+  DUMP_QUERY_SECTOR,   // Sectors the zone maps answer for
+  DUMP_QUERY_PAGE,     // Read and verify the next page of a sector
+  DUMP_QUERY_RECORDS,  // Records of that page
+  DUMP_QUERY_END,      // Closing lines or summary table
+  DUMP_BINARY_START,   // Start frame
+  DUMP_BINARY_PAGE,    // One page frame per pass
+  DUMP_BINARY_END,     // End frame
+  DUMP_ROLLUP          // Rollup windows
+} DumpStep_t;
+
+// Dump being sent, worked off by Logger_Task between flash operations
+static struct
+{
+  DumpStep_t step;
+  LogQuery_t q;
+  LogTotal_t totals[LOGGER_CHANNELS];
+  uint32_t start_ms;
+  uint16_t sector;          // Sector being read
+  uint16_t newest;          // Binary: newest sector when it started
+  uint32_t addr;            // Next page
+  uint32_t end;             // Binary: end of the sector, 0 before its header is read
+  uint32_t first_sequence;  // Of the sector being decoded
+  uint16_t entries;
+  uint16_t done;            // Records of the sector decoded
+  uint16_t good;            // Verified records left in the page
+  uint8_t known;            // Binary: sector header is valid
+  uint8_t line;             // Closing line sent next
+  uint32_t frames;
+  uint16_t sectors_left;
+  LogCodec_t dec;
+} dump;
 
 // Forward declarations
+static uint16_t NextSector(uint16_t sector);
+static uint16_t NewestSector(void);
+static uint8_t SectorInLog(uint16_t sector, uint16_t newest);
+static uint16_t RingPosition(uint16_t sector);
+static LogIndexEntry_t* IndexEntry(uint16_t sector);
+static void IndexSet(uint16_t sector, const LogSectorHeader_t *hdr);
+static void IndexRebuild(void);
+static uint16_t FindSector(uint8_t by_time, uint32_t value, uint16_t first, uint16_t newest);
+static void QueryBegin(LogQuery_t *q, LoggerRange_t key, uint32_t from, uint32_t to);
+static uint8_t DumpStart(void);
+static void DumpStep(void);
+static void DumpQueryBegin(void);
+static void DumpQuerySectors(void);
+static void DumpQueryNextSector(void);
+static void DumpQueryPage(void);
+static void DumpQueryRecords(void);
+static void DumpQueryEnd(void);
+static void DumpBinaryStep(void);
+static uint8_t QuerySector(uint16_t sector, LogQuery_t *q);
+static uint8_t IsPeak(const LogRecord_t *rec, uint8_t channel, uint16_t threshold);
+static void ZoneReset(LogZoneMap_t *z);
+static void ZoneAdd(LogZoneMap_t *z, const LogRecord_t *rec);
+static void ZoneSeal(LogZoneMap_t *z);
+static uint8_t ZoneValid(const LogZoneMap_t *z);
+static uint16_t ZoneCount(const LogZoneMap_t *z, uint8_t channel);
+static uint8_t ZoneHasPeak(const LogZoneMap_t *z, uint8_t channel, uint16_t threshold);
+static void TotalsAdd(LogTotal_t *t, const LogRecord_t *rec);
+static void TotalsMerge(LogTotal_t *t, const LogZoneMap_t *z);
+static void ResetLog(void);
+static void WipeStep(void);
+static void WipeFinish(void);
+static uint8_t ReadSectorHeader(uint16_t sector, LogSectorHeader_t *hdr);
+static uint8_t ReadSectorMeta(uint16_t sector, LogSectorMeta_t *meta);
+static uint8_t IsHeaderBlank(const LogSectorHeader_t *hdr);
 static void FindFirstEmptyLocation(void);
+static void EraseIfTorn(uint16_t sector);
+static void DrainQueue(uint8_t wait);
+static uint8_t SaveRecord(LogRecord_t *rec, uint8_t wait);
+static uint8_t CanOpenSector(void);
+static uint8_t OpenSector(const LogRecord_t *first);
+static void CloseSector(void);
+static void WriteCommitMarker(void);
+static uint8_t FlashReady(void);
+static void WaitFlashReady(void);
+static void WaitFlashIdle(void);
+static void ResumeErase(void);
+static void FlushPending(void);
+static void StartErase(void);
+static void ProcessPending(void);
+static void PageBuffer_Reset(uint32_t addr);
+static uint8_t PageBuffer_Put(const LogRecord_t *rec);
+static void PageBuffer_Check(void);
+static void PageBuffer_Retire(void);
+static void PageBuffer_Commit(LogPage_t *p);
 static void ShowMessage(const char *msg);
 static void ultoa(uint32_t num, char *str);
 static void send_string(const char *str);
 static void send_int(int16_t num);
 static void send_comma(void);
 static void send_newline(void);
+static void SendRecord(const LogRecord_t *rec);
+static void SendFrame(uint8_t type, uint32_t addr, uint16_t len);
 
 // String conversion and UART helpers
 static void ultoa(uint32_t num, char *str)
@@ -72,14 +321,15 @@ static void send_string(const char *str)
 static void send_int(int16_t num)
 {
   char buf[8];
+  int32_t value = num;  // -32768 has no positive int16 counterpart
 
-  if(num < 0)
+  if(value < 0)
   {
     USART1_SendChar('-');
-    num = -num;
+    value = -value;
   }
 
-  ultoa((uint32_t) num, buf);
+  ultoa((uint32_t) value, buf);
   send_string(buf);
 }
 
@@ -94,13 +344,138 @@ static void send_newline(void)
   USART1_SendChar('\n');
 }
 
+// One CSV line per record, the columns after the type depend on it
+static void SendRecord(const LogRecord_t *rec)
+{
+  // Send sequence and time
+  USART1_SendNumber(rec->sequence);
+  send_comma();
+  USART1_SendNumber(rec->timestamp);
+  send_comma();
+
+  switch(rec->type)
+  {
+    case LOG_RECORD_IMU:
+      send_string("IMU,");
+
+      // Send MPU temp
+      send_int(rec->imu.mpu_temp);
+      send_comma();
+
+      // Send accelerometer
+      send_int(rec->imu.accel_x);
+      send_comma();
+      send_int(rec->imu.accel_y);
+      send_comma();
+      send_int(rec->imu.accel_z);
+      send_comma();
+
+      // Send gyroscope
+      send_int(rec->imu.gyro_x);
+      send_comma();
+      send_int(rec->imu.gyro_y);
+      send_comma();
+      send_int(rec->imu.gyro_z);
+      break;
+
+    case LOG_RECORD_DS18B20:
+      send_string("DS18B20,");
+      send_int(rec->ds18b20_temp);
+      break;
+
+    default:
+      send_string(rec->type == LOG_RECORD_EVENT ? "EVENT," : "CONFIG,");
+      USART1_SendNumber(rec->event.id);
+      send_comma();
+      USART1_SendNumber(rec->event.value);
+      break;
+  }
+
+  send_newline();
+}
+
+// Frame the data already in dump_buf.frame, add the CRC and send it COBS encoded
+static void SendFrame(uint8_t type, uint32_t addr, uint16_t len)
+{
+  uint8_t *frame = dump_buf.frame;
+  uint16_t total = LOGGER_FRAME_HEADER_SIZE + len + LOGGER_FRAME_CRC_SIZE;
+  uint16_t i = 0;
+  uint16_t run;
+  uint32_t crc;
+
+  frame[0] = type;
+  frame[1] = addr & 0xFF;
+  frame[2] = (addr >> 8) & 0xFF;
+  frame[3] = (addr >> 16) & 0xFF;
+  frame[4] = (addr >> 24) & 0xFF;
+  frame[5] = len & 0xFF;
+  frame[6] = (len >> 8) & 0xFF;
+
+  crc = CRC32_Update(0, frame, LOGGER_FRAME_HEADER_SIZE + len);
+  frame[total - 4] = crc & 0xFF;
+  frame[total - 3] = (crc >> 8) & 0xFF;
+  frame[total - 2] = (crc >> 16) & 0xFF;
+  frame[total - 1] = (crc >> 24) & 0xFF;
+
+  // COBS: every block is a length byte and up to 254 non-zero bytes,
+  // a block shorter than 254 stands for a zero after it
+  while(1)
+  {
+    run = 0;
+    while(i + run < total && frame[i + run] != 0 && run < 254)
+    {
+      run++;
+    }
+
+    USART1_SendChar((char) (run + 1));
+    for(uint16_t k = 0; k < run; k++)
+    {
+      USART1_SendChar((char) frame[i + k]);
+    }
+    i += run;
+
+    if(run < 254)
+    {
+      if(i >= total)
+      {
+        break;
+      }
+      i++;  // Skip the zero
+    }
+    else if(i >= total)
+    {
+      break;
+    }
+  }
+
+  // Frame delimiter
+  USART1_SendChar(0);
+}
+
 // Logger Functions
-void Logger_Init(void)
+// The mode comes first, the boot scan arms the erase ahead only in ring mode
+void Logger_Init(LoggerMode_t mode)
 {
   char buf[16];
+  uint32_t scan_start;
+  uint32_t scan_time;
+
+  log_mode = mode;
+
+  // Records queued before a reset are gone
+  LogQueue_Init();
 
   // Find where to start writing
+  scan_start = TIMER2_GetMillis();
+  scan_reads = 0;
   FindFirstEmptyLocation();
+  WaitFlashReady();
+  Rollup_Init();
+  scan_time = TIMER2_GetMillis() - scan_start;
+
+  // Records from here on have this boot's timestamps
+  session_sequence = sequence + 1;
+  last_timestamp = 0;
 
   // Show status on LCD
   LCD_Clear();
@@ -118,42 +493,44 @@ void Logger_Init(void)
 
   // UART output
   send_string("Logger initialized. Entries: ");
-  send_int(entry_count);
+  USART1_SendNumber(entry_count);
   send_newline();
+
+  send_string("Boot scan: ");
+  USART1_SendNumber(scan_time);
+  send_string(" ms, ");
+  USART1_SendNumber(scan_reads);
+  send_string(" reads\r\n");
+
+  // Mark the reboot in the log, records after it restart the clock
+  Logger_SaveEvent(LOGGER_EVENT_BOOT, entry_count);
+  Logger_SaveConfig(LOGGER_CONFIG_MODE, log_mode);
 }
 
+// Snapshot of all sensors on request, with feedback on the LCD and UART
 void Logger_SaveEntry(void)
 {
-  LogEntry_t entry;
   char buf[16];
 
-  // Check if flash is full
-  if(current_addr >= LOGGER_MAX_ADDR)
+  // Log is being erased
+  if(wipe_active)
   {
-    ShowMessage("Flash Full!");
+    ShowMessage("Erasing...");
     return;
   }
 
-  // Read all sensors
-  entry.ds18b20_temp = ds18b20_data.valid ? (int16_t) (ds18b20_data.temperature * 100) : 0x7FFF;  // 0x7FFF = invalid
-  entry.mpu_temp = (int16_t) (mpu6050_scaled.temp * 100);
-
-  entry.accel_x = mpu6050_scaled.accel_x;
-  entry.accel_y = mpu6050_scaled.accel_y;
-  entry.accel_z = mpu6050_scaled.accel_z;
-
-  entry.gyro_x = mpu6050_scaled.gyro_x;
-  entry.gyro_y = mpu6050_scaled.gyro_y;
-  entry.gyro_z = mpu6050_scaled.gyro_z;
-
-  entry.sequence = ++sequence;
+  Logger_SaveIMU();
+  Logger_SaveTemperature();
 
-  // Write to flash
-  W25Q64_Write(current_addr, (uint8_t*) &entry, LOGGER_ENTRY_SIZE);
+  // Rare, so write it through and show its real sequence number
+  DrainQueue(1);
 
-  // Update pointers
-  current_addr += LOGGER_ENTRY_SIZE;
-  entry_count++;
+  // Check if flash is full, only possible in linear mode
+  if(log_full)
+  {
+    ShowMessage("Flash Full!");
+    return;
+  }
 
   // Show feedback on LCD
   LCD_Clear();
@@ -167,94 +544,285 @@ void Logger_SaveEntry(void)
   LCD_SetCursor(1, 0);
   LCD_SendString("Logger");
 
-  // Optional UART feedback
-  send_string("Saved entry #");
-  send_int(sequence);
-  send_newline();
+  // Optional UART feedback, not into a dump
+  if(dump.step == DUMP_IDLE)
+  {
+    send_string("Saved entry #");
+    USART1_SendNumber(sequence);
+    send_newline();
+  }
+}
+
+// Log a fresh MPU6050 sample, call once per new reading
+void Logger_SaveIMU(void)
+{
+  LogRecord_t rec;
+
+  rec.type = LOG_RECORD_IMU;
+  rec.timestamp = TIMER2_GetMillis();
+  rec.imu.mpu_temp = (int16_t) (mpu6050_scaled.temp * 100);
+
+  // Raw sensor LSBs, scaling them to g and deg/s as int16 would lose everything
+  rec.imu.accel_x = mpu6050_raw.accel_x;
+  rec.imu.accel_y = mpu6050_raw.accel_y;
+  rec.imu.accel_z = mpu6050_raw.accel_z;
+
+  rec.imu.gyro_x = mpu6050_raw.gyro_x;
+  rec.imu.gyro_y = mpu6050_raw.gyro_y;
+  rec.imu.gyro_z = mpu6050_raw.gyro_z;
+
+  LogQueue_Push(&rec);
+}
+
+// Log a fresh DS18B20 conversion, a failed one is logged once as a fault
+void Logger_SaveTemperature(void)
+{
+  static uint8_t faulted = 0;
+  LogRecord_t rec;
+
+  if(!ds18b20_data.valid)
+  {
+    if(!faulted)
+    {
+      faulted = 1;
+      Logger_SaveEvent(LOGGER_EVENT_SENSOR_FAULT, LOG_RECORD_DS18B20);
+    }
+    return;
+  }
+
+  faulted = 0;
+
+  rec.type = LOG_RECORD_DS18B20;
+  rec.timestamp = TIMER2_GetMillis();
+  rec.ds18b20_temp = (int16_t) (ds18b20_data.temperature * 100);
+
+  LogQueue_Push(&rec);
+}
+
+void Logger_SaveEvent(uint16_t code, uint32_t value)
+{
+  LogRecord_t rec;
+
+  rec.type = LOG_RECORD_EVENT;
+  rec.timestamp = TIMER2_GetMillis();
+  rec.event.id = code;
+  rec.event.value = value;
+
+  LogQueue_Push(&rec);
+}
+
+// A setting that changes how the records after it read
+void Logger_SaveConfig(uint16_t key, uint32_t value)
+{
+  LogRecord_t rec;
+
+  rec.type = LOG_RECORD_CONFIG;
+  rec.timestamp = TIMER2_GetMillis();
+  rec.event.id = key;
+  rec.event.value = value;
+
+  LogQueue_Push(&rec);
 }
 
 void Logger_DumpAll(void)
 {
-  LogEntry_t entry;
-  uint32_t addr = LOGGER_START_ADDR;
-  uint32_t count = 0;
-  char buf[16];
+  Logger_DumpRange(LOGGER_RANGE_SEQUENCE, 0, 0xFFFFFFFF);
+}
+
+// CSV lines of the records from..to. The index points at the block holding
+// the first one, a few sector headers narrow it down to its sector, and only
+// sectors from there up to the last match are read.
+void Logger_DumpRange(LoggerRange_t key, uint32_t from, uint32_t to)
+{
+  if(!DumpStart())
+  {
+    return;
+  }
+
+  QueryBegin(&dump.q, key, from, to);
+  dump.step = DUMP_QUERY_BEGIN;
+  ShowMessage("Dumping...");
+}
+
+// CSV lines of the records whose channel reached the threshold either way.
+// Sectors whose zone map stays inside it are not read.
+void Logger_DumpPeaks(LoggerChannel_t channel, uint16_t threshold)
+{
+  if(channel >= LOGGER_CHANNELS || !DumpStart())
+  {
+    return;
+  }
 
+  QueryBegin(&dump.q, LOGGER_RANGE_SEQUENCE, 0, 0xFFFFFFFF);
+  dump.q.channel = channel;
+  dump.q.threshold = threshold;
+  dump.step = DUMP_QUERY_BEGIN;
   ShowMessage("Dumping...");
+}
+
+// CSV lines of the windows of a rollup tier, oldest first
+void Logger_DumpRollup(uint8_t tier)
+{
+  if(tier >= ROLLUP_TIERS || !DumpStart())
+  {
+    return;
+  }
+
+  // Windows still in the outbox show up with the next dump
+  Rollup_DumpBegin(tier);
+  dump.step = DUMP_ROLLUP;
+}
+
+const char* Logger_ChannelName(LoggerChannel_t channel)
+{
+  return (channel < LOGGER_CHANNELS) ? channel_names[channel] : "";
+}
 
-  // Send CSV header
-  send_string("\r\n--- SENSOR LOG DUMP ---\r\n");
-  send_string("Seq,DS18B20,MPU,AccelX,AccelY,AccelZ,GyroX,GyroY,GyroZ\r\n");
+// Count, min, max and mean of every channel over from..to. Sectors wholly
+// inside the range add their zone map, only the ones at the ends are decoded.
+void Logger_Summary(LoggerRange_t key, uint32_t from, uint32_t to)
+{
+  if(!DumpStart())
+  {
+    return;
+  }
 
-  // Read and send all entries
-  while(addr < current_addr && addr < LOGGER_MAX_ADDR)
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
   {
-    W25Q64_Read(addr, (uint8_t*) &entry, LOGGER_ENTRY_SIZE);
+    dump.totals[ch].count = 0;
+    dump.totals[ch].min = INT16_MAX;
+    dump.totals[ch].max = INT16_MIN;
+    dump.totals[ch].sum = 0;
+  }
 
-    // Send sequence
-    send_int(entry.sequence);
-    send_comma();
+  QueryBegin(&dump.q, key, from, to);
+  dump.q.totals = dump.totals;
+  dump.step = DUMP_QUERY_BEGIN;
+}
 
-    // Send DS18B20 temp
-    send_int(entry.ds18b20_temp);
-    send_comma();
+// Whole flash pages of the log in frames, oldest sector first, from_addr
+// resumes an earlier dump. Sectors the erase ahead takes before the dump
+// gets to them are left out.
+void Logger_DumpBinary(uint32_t from_addr)
+{
+  LogDumpInfo_t info;
+  uint16_t newest;
 
-    // Send MPU temp
-    send_int(entry.mpu_temp);
-    send_comma();
+  if(!DumpStart())
+  {
+    return;
+  }
 
-    // Send accelerometer
-    send_int(entry.accel_x);
-    send_comma();
-    send_int(entry.accel_y);
-    send_comma();
-    send_int(entry.accel_z);
-    send_comma();
+  ShowMessage("Dumping...");
 
-    // Send gyroscope
-    send_int(entry.gyro_x);
-    send_comma();
-    send_int(entry.gyro_y);
-    send_comma();
-    send_int(entry.gyro_z);
+  newest = NewestSector();
+  dump.sector = oldest_sector;
+  dump.addr = LOGGER_SECTOR_ADDR(dump.sector);
 
-    send_newline();
+  if(from_addr != 0 && SectorInLog(from_addr / W25Q64_SECTOR_SIZE, newest))
+  {
+    dump.sector = from_addr / W25Q64_SECTOR_SIZE;
+    dump.addr = from_addr & ~(uint32_t) (W25Q64_PAGE_SIZE - 1);
+  }
+  else
+  {
+    from_addr = 0;
+  }
+
+  info.version = LOGGER_FORMAT_VERSION;
+  info.mode = log_mode;
+  info.first_sector = LOGGER_FIRST_SECTOR;
+  info.last_sector = LOGGER_LAST_SECTOR;
+  info.oldest_sector = oldest_sector;
+  info.newest_sector = newest;
+  info.sector_size = W25Q64_SECTOR_SIZE;
+  info.entry_count = entry_count;
+  info.from_addr = from_addr;
 
-    count++;
-    addr += LOGGER_ENTRY_SIZE;
+  for(uint16_t i = 0; i < sizeof(info); i++)
+  {
+    dump_buf.frame[LOGGER_FRAME_HEADER_SIZE + i] = ((uint8_t*) &info)[i];
   }
 
-  send_string("--- END ---\r\n");
-  send_string("Total: ");
-  send_int(count);
-  send_string(" entries\r\n");
+  dump.newest = newest;
+  dump.sectors_left = (entry_count > 0) ? LOGGER_SECTOR_COUNT : 0;
+  dump.frames = 0;
+  dump.step = DUMP_BINARY_START;
+}
 
-  // Show on LCD
-  buf[0] = 'D';
-  buf[1] = 'u';
-  buf[2] = 'm';
-  buf[3] = 'p';
-  buf[4] = 'e';
-  buf[5] = 'd';
-  buf[6] = ' ';
-  ultoa(count, &buf[7]);
-  ShowMessage(buf);
+// Returns 1 while a dump is being sent
+uint8_t Logger_IsDumping(void)
+{
+  return (dump.step != DUMP_IDLE) ? 1 : 0;
 }
 
+// Start erasing the sectors in use. The erase runs from Logger_Task in 64K, 32K
+// or 4K steps, so sampling continues while it works through the flash.
 void Logger_EraseAll(void)
 {
+  uint16_t newest;
+
+  if(wipe_active)
+  {
+    return;  // Already running
+  }
+
+  // The dump would read sectors while they are erased
+  if(dump.step != DUMP_IDLE)
+  {
+    ShowMessage("Dump running");
+    return;
+  }
+
   ShowMessage("Erasing...");
-  send_string("Erasing entire flash...\r\n");
+  send_string("Erasing used sectors...\r\n");
 
-  W25Q64_EraseChip();
+  newest = NewestSector();
+  wipe_ranges = 0;
+  wipe_total = 0;
 
-  // Reset all pointers
-  current_addr = LOGGER_START_ADDR;
-  sequence = 0;
-  entry_count = 0;
+  // Highest addresses go first, an interrupted erase leaves the front of the log
+  if(entry_count > 0 || sector_open)
+  {
+    if(oldest_sector <= newest)
+    {
+      wipe_range[0].bottom = oldest_sector;
+      wipe_range[0].top = newest;
+      wipe_ranges = 1;
+    }
+    else
+    {
+      wipe_range[0].bottom = LOGGER_FIRST_SECTOR;
+      wipe_range[0].top = newest;
+      wipe_range[1].bottom = oldest_sector;
+      wipe_range[1].top = LOGGER_LAST_SECTOR;
+      wipe_ranges = 2;
+    }
+  }
 
-  ShowMessage("Flash Erased!");
-  send_string("Flash erase complete!\r\n");
+  // Rollup tiers are wiped with the log, they go first
+  wipe_range[wipe_ranges].bottom = ROLLUP_FIRST_SECTOR;
+  wipe_range[wipe_ranges].top = ROLLUP_FIRST_SECTOR + ROLLUP_SECTORS - 1;
+  wipe_ranges++;
+
+  for(uint8_t i = 0; i < wipe_ranges; i++)
+  {
+    wipe_total += wipe_range[i].top - wipe_range[i].bottom + 1;
+  }
+
+  // Anything still buffered is discarded
+  ResetLog();
+  Rollup_Reset();
+
+  wipe_done = 0;
+  wipe_reported = 0;
+  wipe_active = 1;
+}
+
+// Returns 1 while Logger_EraseAll is still working
+uint8_t Logger_IsErasing(void)
+{
+  return wipe_active;
 }
 
 uint32_t Logger_GetEntryCount(void)
@@ -262,44 +830,1752 @@ uint32_t Logger_GetEntryCount(void)
   return entry_count;
 }
 
-// Private helper functions
-static void FindFirstEmptyLocation(void)
+uint32_t Logger_GetFlashBytes(void)
 {
-  uint8_t buffer[LOGGER_ENTRY_SIZE];
-  uint32_t addr = LOGGER_START_ADDR;
+  return flash_bytes;
+}
 
-  entry_count = 0;
-  sequence = 0;
+uint32_t Logger_GetDiscarded(void)
+{
+  return discarded;
+}
+
+// Linear mode reached the end of flash, records are thrown away
+uint8_t Logger_IsFull(void)
+{
+  return log_full;
+}
+
+// Program any queued and buffered records, call before dump or power down
+void Logger_Flush(void)
+{
+  if(wipe_active)
+  {
+    return;  // Nothing buffered while erasing
+  }
+
+  DrainQueue(1);
+  FlushPending();
+  PageBuffer_Check();
+  PageBuffer_Commit(page);
+  WaitFlashIdle();
+}
 
-  // Scan through flash to find first empty spot
-  while(addr < LOGGER_MAX_ADDR)
+// Call from the main loop, the flash writer. Finishes deferred page programs,
+// runs the erase ahead and moves queued records into the page buffer.
+void Logger_Task(void)
+{
+  // Dumps read between the flash operations of the log, never during one
+  if(dump.step != DUMP_IDLE && FlashReady() && !W25Q64_IsSuspended())
   {
-    W25Q64_Read(addr, buffer, LOGGER_ENTRY_SIZE);
+    DumpStep();
+  }
 
-    // Check if this location is empty (all 0xFF)
-    int empty = 1;
-    for(int i = 0; i < LOGGER_ENTRY_SIZE; i++)
+  // Nothing starts while an erase or program is running
+  if(FlashReady())
+  {
+    if(W25Q64_IsSuspended())
     {
-      if(buffer[i] != 0xFF)
+      // Programs that came up during the suspend, then the erase goes on
+      if(pending_page != 0 || close_sector != 0)
       {
-        empty = 0;
-        break;
+        ProcessPending();
+      }
+      else
+      {
+        ResumeErase();
+      }
+    }
+    else if(wipe_active)
+    {
+      if(wipe_ranges > 0)
+      {
+        WipeStep();
+      }
+      else
+      {
+        WipeFinish();
       }
     }
+    else if(Rollup_Urgent() && Rollup_Task())
+    {
+      // A log that keeps the flash busy would starve the rollup tiers
+      erase_target = 0;
+      flash_busy = 1;
+    }
+    else if(pending_page != 0 || close_sector != 0)
+    {
+      // Programs are asynchronous too, the erase waits for the next call
+      ProcessPending();
+    }
+    else if(erase_sector != 0)
+    {
+      StartErase();
+    }
+    else if(Rollup_Task())
+    {
+      erase_target = 0;
+      flash_busy = 1;
+    }
+  }
+  else if((pending_page != 0 || close_sector != 0) && TIMER2_GetMillis() - resume_ms >= LOGGER_ERASE_RUN_MS &&
+          W25Q64_SuspendErase())
+  {
+    // Waiting pages go ahead of the erase, they never fall in the sector it erases
+    flash_busy = 0;
+    ProcessPending();
+  }
+
+  DrainQueue(0);
+}
 
-    if(empty)
+void Logger_SetMode(LoggerMode_t mode)
+{
+  log_mode = mode;
+
+  if(mode == LOGGER_MODE_RING)
+  {
+    // Ring mode never runs out of space
+    log_full = 0;
+    if(sector_open)
     {
-      current_addr = addr;
-      return;  // Found empty spot
+      erase_sector = NextSector(current_sector);
     }
+  }
+  else
+  {
+    // Linear mode keeps old data
+    erase_sector = 0;
+  }
+
+  Logger_SaveConfig(LOGGER_CONFIG_MODE, mode);
+}
 
-    // Not empty, move to next entry
-    addr += LOGGER_ENTRY_SIZE;
-    entry_count++;
+LoggerMode_t Logger_GetMode(void)
+{
+  return log_mode;
+}
+
+// Private helper functions
+static uint16_t NextSector(uint16_t sector)
+{
+  return (sector >= LOGGER_LAST_SECTOR) ? LOGGER_FIRST_SECTOR : sector + 1;
+}
+
+// Newest sector is the open one, or the one before it when nothing was written yet
+static uint16_t NewestSector(void)
+{
+  if(sector_open)
+  {
+    return current_sector;
+  }
+
+  return (current_sector > LOGGER_FIRST_SECTOR) ? current_sector - 1 : LOGGER_LAST_SECTOR;
+}
+
+// 1 if the sector lies between the oldest and the newest sector of the ring
+static uint8_t SectorInLog(uint16_t sector, uint16_t newest)
+{
+  uint16_t pos;
+  uint16_t span;
+
+  if(sector < LOGGER_FIRST_SECTOR || sector > LOGGER_LAST_SECTOR)
+  {
+    return 0;
+  }
+
+  pos = RingPosition(sector);
+  span = RingPosition(newest);
+
+  return (pos <= span) ? 1 : 0;
+}
+
+// Sectors between the oldest one and this one
+static uint16_t RingPosition(uint16_t sector)
+{
+  return (sector + LOGGER_SECTOR_COUNT - oldest_sector) % LOGGER_SECTOR_COUNT;
+}
+
+// Index entry of a sector, 0 if the index skips it
+static LogIndexEntry_t* IndexEntry(uint16_t sector)
+{
+  if((sector - LOGGER_FIRST_SECTOR) % LOGGER_INDEX_STRIDE != 0)
+  {
+    return 0;
+  }
+
+  return &log_index[(sector - LOGGER_FIRST_SECTOR) / LOGGER_INDEX_STRIDE];
+}
+
+// Record a sector that was opened or erased, hdr = 0 for erased
+static void IndexSet(uint16_t sector, const LogSectorHeader_t *hdr)
+{
+  LogIndexEntry_t *e = IndexEntry(sector);
+
+  if(e == 0)
+  {
+    return;
+  }
+
+  e->first_sequence = hdr ? hdr->first_sequence : LOGGER_INDEX_EMPTY;
+  e->first_timestamp = hdr ? hdr->first_timestamp : 0;
+}
+
+// One header read per entry, 128 in all
+static void IndexRebuild(void)
+{
+  LogSectorHeader_t hdr;
+  uint16_t newest = NewestSector();
+  uint16_t sector;
+
+  for(uint16_t i = 0; i < LOGGER_INDEX_SIZE; i++)
+  {
+    sector = LOGGER_FIRST_SECTOR + i * LOGGER_INDEX_STRIDE;
+
+    if(entry_count > 0 && SectorInLog(sector, newest) && ReadSectorHeader(sector, &hdr))
+    {
+      IndexSet(sector, &hdr);
+    }
+    else
+    {
+      IndexSet(sector, 0);
+    }
+  }
+}
+
+// Last sector from first to newest whose first record has a key at or below
+// value. Keys rise in ring order, so the index entry at or below value that
+// is furthest along gives the block, at most 15 headers after it do the rest.
+static uint16_t FindSector(uint8_t by_time, uint32_t value, uint16_t first, uint16_t newest)
+{
+  LogSectorHeader_t hdr;
+  LogIndexEntry_t *e;
+  uint16_t best = first;
+  uint16_t sector;
+  uint16_t next;
+  uint32_t key;
+
+  for(uint16_t i = 0; i < LOGGER_INDEX_SIZE; i++)
+  {
+    e = &log_index[i];
+    sector = LOGGER_FIRST_SECTOR + i * LOGGER_INDEX_STRIDE;
+    key = by_time ? e->first_timestamp : e->first_sequence;
+
+    if(e->first_sequence == LOGGER_INDEX_EMPTY || !SectorInLog(sector, newest))
+    {
+      continue;
+    }
+
+    if(RingPosition(sector) > RingPosition(best) && key <= value)
+    {
+      best = sector;
+    }
+  }
+
+  sector = best;
+  while(sector != newest)
+  {
+    next = NextSector(sector);
+    if(!ReadSectorHeader(next, &hdr) || (by_time ? hdr.first_timestamp : hdr.first_sequence) > value)
+    {
+      break;
+    }
+    sector = next;
+  }
+
+  return sector;
+}
+
+// A query over every record, key from..to
+static void QueryBegin(LogQuery_t *q, LoggerRange_t key, uint32_t from, uint32_t to)
+{
+  q->by_time = (key == LOGGER_RANGE_TIME);
+  q->from = from;
+  q->to = to;
+
+  // Records of earlier boots have their own time base
+  q->min_sequence = q->by_time ? session_sequence : 0;
+  q->last_sequence = sequence;
+
+  q->channel = LOGGER_CHANNELS;
+  q->threshold = 0;
+  q->totals = 0;
+  q->sent = 0;
+  q->sectors = 0;
+  q->zoned = 0;
+  q->skipped = 0;
+  dump.start_ms = TIMER2_GetMillis();
+}
+
+// A new dump, after what is buffered went into flash. 0 while the log is
+// being erased or another dump runs.
+static uint8_t DumpStart(void)
+{
+  if(wipe_active)
+  {
+    ShowMessage("Erasing...");
+    return 0;
+  }
+
+  if(dump.step != DUMP_IDLE)
+  {
+    ShowMessage("Dump running");
+    return 0;
+  }
+
+  // Make sure buffered entries are in flash before reading back
+  Logger_Flush();
+
+  dump.line = 0;
+  return 1;
+}
+
+// Next piece of the running dump, from Logger_Task with the flash idle.
+// Text goes out only as far as the TX ring has room, the rest waits for
+// the next call.
+static void DumpStep(void)
+{
+  switch(dump.step)
+  {
+    case DUMP_QUERY_BEGIN:
+      DumpQueryBegin();
+      break;
+
+    case DUMP_QUERY_SECTOR:
+      DumpQuerySectors();
+      break;
+
+    case DUMP_QUERY_PAGE:
+      DumpQueryPage();
+      break;
+
+    case DUMP_QUERY_RECORDS:
+      DumpQueryRecords();
+      break;
+
+    case DUMP_QUERY_END:
+      DumpQueryEnd();
+      break;
+
+    case DUMP_BINARY_START:
+    case DUMP_BINARY_PAGE:
+    case DUMP_BINARY_END:
+      DumpBinaryStep();
+      break;
+
+    case DUMP_ROLLUP:
+      if(Rollup_DumpStep())
+      {
+        dump.step = DUMP_IDLE;
+      }
+      break;
+
+    default:
+      dump.step = DUMP_IDLE;
+      break;
+  }
+}
+
+// CSV header, then the sector holding the first record of the range
+static void DumpQueryBegin(void)
+{
+  LogQuery_t *q = &dump.q;
+  uint16_t newest;
+  uint16_t first;
+
+  if(!q->totals)
+  {
+    if(USART1_TxFree() < LOGGER_DUMP_LINE_MAX)
+    {
+      return;
+    }
+
+    send_string("\r\n--- SENSOR LOG DUMP ---\r\n");
+    send_string("Seq,TimeMs,Type,Values\r\n");
+  }
+
+  if(entry_count == 0)
+  {
+    dump.step = DUMP_QUERY_END;
+    return;
+  }
+
+  newest = NewestSector();
+  first = oldest_sector;
+  if(q->min_sequence > 0)
+  {
+    first = FindSector(0, q->min_sequence, oldest_sector, newest);
+  }
+
+  dump.sector = FindSector(q->by_time, q->from, first, newest);
+  dump.step = DUMP_QUERY_SECTOR;
+}
+
+// Sectors the zone maps answer for, a few per call, up to the first one
+// that has to be decoded
+static void DumpQuerySectors(void)
+{
+  uint16_t newest = NewestSector();
+  uint8_t result;
+
+  for(uint8_t n = 0; n < LOGGER_DUMP_SECTORS; n++)
+  {
+    // The erase ahead took it, the log starts later now
+    if(!SectorInLog(dump.sector, newest))
+    {
+      dump.sector = oldest_sector;
+    }
+
+    result = QuerySector(dump.sector, &dump.q);
+    if(result == LOGGER_QUERY_DECODE)
+    {
+      dump.step = DUMP_QUERY_PAGE;
+      return;
+    }
+
+    if(result == LOGGER_QUERY_END || dump.sector == newest)
+    {
+      dump.step = DUMP_QUERY_END;
+      return;
+    }
+
+    dump.sector = NextSector(dump.sector);
+  }
+}
+
+// On to the sector after the one just decoded
+static void DumpQueryNextSector(void)
+{
+  if(dump.sector == NewestSector())
+  {
+    dump.step = DUMP_QUERY_END;
+    return;
+  }
+
+  dump.sector = NextSector(dump.sector);
+  dump.step = DUMP_QUERY_SECTOR;
+}
+
+// Read the next page of the sector and check its records
+static void DumpQueryPage(void)
+{
+  uint16_t offset;
+
+  if(!SectorInLog(dump.sector, NewestSector()))
+  {
+    dump.sector = oldest_sector;
+    dump.step = DUMP_QUERY_SECTOR;
+    return;
+  }
+
+  W25Q64_Read(dump.addr, dump_buf.page, W25Q64_PAGE_SIZE);
+
+  // Programming stops at the first empty page
+  if(LOGGER_PAGE_EMPTY(dump_buf.page, dump.addr))
+  {
+    DumpQueryNextSector();
+    return;
+  }
+
+  offset = LOGGER_PAGE_DATA(dump.addr);
+  LogCodec_Begin(&dump.dec, &dump_buf.page[offset], W25Q64_PAGE_SIZE - offset);
+  if(offset != 0)
+  {
+    LogCodec_Seed(&dump.dec, &dump_buf.page[LOGGER_HEADER_SEED_OFFSET], LOGGER_HEADER_SEED_SIZE);
+  }
+
+  // Records of a program cut short by a power loss are left out
+  dump.good = LogCodec_Verify(&dump.dec);
+  dump.step = DUMP_QUERY_RECORDS;
+  DumpQueryRecords();
+}
+
+// Records of the page the query asks for, one CSV line each while the TX
+// ring has room for it. A summary takes the whole page at once.
+static void DumpQueryRecords(void)
+{
+  LogQuery_t *q = &dump.q;
+  LogRecord_t rec;
+  uint32_t key;
+
+  while(dump.done < dump.entries && dump.good > 0)
+  {
+    if(!q->totals && USART1_TxFree() < LOGGER_DUMP_LINE_MAX)
+    {
+      return;
+    }
+
+    if(!LogCodec_Get(&dump.dec, &rec))
+    {
+      break;
+    }
+
+    rec.sequence = dump.first_sequence + dump.done;
+    dump.done++;
+    dump.good--;
+
+    key = q->by_time ? rec.timestamp : rec.sequence;
+    if(rec.sequence < q->min_sequence || key < q->from)
+    {
+      continue;
+    }
+
+    // Records logged since the dump started are left for the next one
+    if(key > q->to || rec.sequence > q->last_sequence)
+    {
+      dump.step = DUMP_QUERY_END;
+      return;
+    }
+
+    if(q->totals)
+    {
+      TotalsAdd(q->totals, &rec);
+    }
+    else if(q->channel == LOGGER_CHANNELS || IsPeak(&rec, q->channel, q->threshold))
+    {
+      SendRecord(&rec);
+      q->sent++;
+    }
+  }
+
+  dump.addr += W25Q64_PAGE_SIZE;
+  if(dump.done >= dump.entries || (dump.addr & (W25Q64_SECTOR_SIZE - 1)) == 0)
+  {
+    DumpQueryNextSector();
+  }
+  else
+  {
+    dump.step = DUMP_QUERY_PAGE;
+  }
+}
+
+// Closing lines of a dump or the table of a summary, one line at a time
+static void DumpQueryEnd(void)
+{
+  LogQuery_t *q = &dump.q;
+  LogTotal_t *t;
+  char buf[16];
+
+  while(USART1_TxFree() >= LOGGER_DUMP_LINE_MAX)
+  {
+    if(q->totals)
+    {
+      if(dump.line == 0)
+      {
+        send_string("\r\n--- LOG SUMMARY ---\r\n");
+        send_string("Channel,Count,Min,Max,Mean\r\n");
+      }
+      else if(dump.line <= LOGGER_CHANNELS)
+      {
+        t = &q->totals[dump.line - 1];
+        send_string(channel_names[dump.line - 1]);
+        send_comma();
+        USART1_SendNumber(t->count);
+        if(t->count > 0)
+        {
+          send_comma();
+          send_int(t->min);
+          send_comma();
+          send_int(t->max);
+          send_comma();
+          send_int((int16_t) (t->sum / (int32_t) t->count));
+        }
+        send_newline();
+      }
+      else
+      {
+        send_string("--- END ---\r\n");
+        send_string("Sectors: ");
+        USART1_SendNumber(q->zoned);
+        send_string(" from zone maps, ");
+        USART1_SendNumber(q->sectors);
+        send_string(" decoded, ");
+        USART1_SendNumber(TIMER2_GetMillis() - dump.start_ms);
+        send_string(" ms\r\n");
+
+        ShowMessage("Summary sent");
+        dump.step = DUMP_IDLE;
+        return;
+      }
+    }
+    else if(dump.line == 0)
+    {
+      send_string("--- END ---\r\n");
+      send_string("Total: ");
+      USART1_SendNumber(q->sent);
+      send_string(" entries, ");
+      USART1_SendNumber(q->sectors);
+      send_string(" sectors read, ");
+      USART1_SendNumber(q->skipped);
+      send_string(" skipped\r\n");
+    }
+    else
+    {
+      send_string("Queue: high water ");
+      USART1_SendNumber(LogQueue_GetStats()->high_water);
+      send_string(" of ");
+      USART1_SendNumber(LOGQUEUE_SIZE);
+      send_string(", dropped ");
+      USART1_SendNumber(LogQueue_GetStats()->dropped);
+      send_newline();
+
+      // Show on LCD
+      buf[0] = 'D';
+      buf[1] = 'u';
+      buf[2] = 'm';
+      buf[3] = 'p';
+      buf[4] = 'e';
+      buf[5] = 'd';
+      buf[6] = ' ';
+      ultoa(q->sent, &buf[7]);
+      ShowMessage(buf);
+      dump.step = DUMP_IDLE;
+      return;
+    }
+
+    dump.line++;
+  }
+}
+
+// Start frame, one page frame per call while the TX ring has room for a
+// whole one, then the end frame with the count
+static void DumpBinaryStep(void)
+{
+  LogSectorHeader_t hdr;
+  uint8_t *data = &dump_buf.frame[LOGGER_FRAME_HEADER_SIZE];
+  uint8_t known;
+
+  if(USART1_TxFree() < LOGGER_FRAME_WIRE_MAX)
+  {
+    return;
+  }
+
+  if(dump.step == DUMP_BINARY_START)
+  {
+    // Delimiter first, so text sent before does not run into the first frame
+    USART1_SendChar(0);
+    SendFrame(LOGGER_FRAME_START, 0, sizeof(LogDumpInfo_t));
+    dump.end = 0;
+    dump.step = DUMP_BINARY_PAGE;
+    return;
+  }
+
+  // Pages from dump.addr up to dump.end, then on around the ring
+  while(dump.step == DUMP_BINARY_PAGE)
+  {
+    if(dump.sectors_left == 0)
+    {
+      dump.step = DUMP_BINARY_END;
+      break;
+    }
+
+    if(!SectorInLog(dump.sector, NewestSector()))
+    {
+      // The erase ahead took it, the log starts later now
+      dump.sector = oldest_sector;
+      dump.addr = LOGGER_SECTOR_ADDR(dump.sector);
+      dump.end = 0;
+    }
+
+    if(dump.end == 0)
+    {
+      // Erased sectors have nothing, unknown ones go out whole for the host to sort out
+      known = ReadSectorHeader(dump.sector, &hdr);
+      dump.known = known;
+      dump.end = (known || !IsHeaderBlank(&hdr)) ? LOGGER_SECTOR_ADDR(dump.sector) + W25Q64_SECTOR_SIZE : dump.addr;
+    }
+
+    if(dump.addr < dump.end)
+    {
+      W25Q64_Read(dump.addr, data, LOGGER_FRAME_DATA_MAX);
+
+      // Log pages are filled in order, the first empty one ends the sector
+      if(!dump.known || !LOGGER_PAGE_EMPTY(data, dump.addr))
+      {
+        SendFrame(LOGGER_FRAME_DATA, dump.addr, LOGGER_FRAME_DATA_MAX);
+        dump.addr += LOGGER_FRAME_DATA_MAX;
+        dump.frames++;
+        return;
+      }
+    }
+
+    // Sector done
+    dump.sectors_left--;
+    if(dump.sector == dump.newest)
+    {
+      dump.step = DUMP_BINARY_END;
+      break;
+    }
+    dump.sector = NextSector(dump.sector);
+    dump.addr = LOGGER_SECTOR_ADDR(dump.sector);
+    dump.end = 0;
+  }
+
+  if(USART1_TxFree() < LOGGER_FRAME_WIRE_MAX)
+  {
+    return;
+  }
+
+  data[0] = dump.frames & 0xFF;
+  data[1] = (dump.frames >> 8) & 0xFF;
+  data[2] = (dump.frames >> 16) & 0xFF;
+  data[3] = (dump.frames >> 24) & 0xFF;
+  SendFrame(LOGGER_FRAME_END, 0, 4);
+
+  ShowMessage("Dump done");
+  dump.step = DUMP_IDLE;
+}
+
+// Decide on a sector from its header and zone map. LOGGER_QUERY_NEXT if
+// it has nothing for the query or the zone map answered for all of it,
+// LOGGER_QUERY_END once the range ends before it, LOGGER_QUERY_DECODE if
+// its pages have to be read, from dump.addr on.
+static uint8_t QuerySector(uint16_t sector, LogQuery_t *q)
+{
+  LogSectorMeta_t meta;
+  uint32_t key;
+  uint32_t last;
+  uint16_t entries = 0;
+  uint8_t zoned = 0;
+
+  // Closed sectors know their count and zone map, the open one is tracked in RAM
+  if(ReadSectorMeta(sector, &meta))
+  {
+    if(meta.header.commit == LOGGER_SECTOR_COMMITTED)
+    {
+      entries = meta.header.entry_count;
+      zoned = ZoneValid(&meta.zone);
+    }
+    else if(sector == current_sector)
+    {
+      entries = sector_entries;
+      meta.zone = zone;
+      zoned = 1;
+    }
+  }
+
+  if(entries == 0)
+  {
+    return LOGGER_QUERY_NEXT;
+  }
+
+  if(meta.header.first_sequence > q->last_sequence)
+  {
+    return LOGGER_QUERY_END;
+  }
+
+  // Keys of the first and last record, unless the sector reaches into an earlier boot
+  if(zoned && meta.header.first_sequence >= q->min_sequence)
+  {
+    key = q->by_time ? meta.header.first_timestamp : meta.header.first_sequence;
+    last = q->by_time ? meta.zone.last_timestamp : meta.header.first_sequence + entries - 1;
+
+    if(key > q->to)
+    {
+      return LOGGER_QUERY_END;
+    }
+
+    if(q->channel < LOGGER_CHANNELS && !ZoneHasPeak(&meta.zone, q->channel, q->threshold))
+    {
+      q->skipped++;
+      return (last > q->to) ? LOGGER_QUERY_END : LOGGER_QUERY_NEXT;
+    }
+
+    if(q->totals && key >= q->from && last <= q->to && meta.header.first_sequence + entries - 1 <= q->last_sequence)
+    {
+      TotalsMerge(q->totals, &meta.zone);
+      q->zoned++;
+      return LOGGER_QUERY_NEXT;
+    }
+  }
+
+  q->sectors++;
+
+  dump.addr = LOGGER_SECTOR_ADDR(sector);
+  dump.first_sequence = meta.header.first_sequence;
+  dump.entries = entries;
+  dump.done = 0;
+  dump.good = 0;
+
+  return LOGGER_QUERY_DECODE;
+}
+
+// Value of a channel, 0 if the record doesn't have it
+uint8_t Logger_ChannelValue(const LogRecord_t *rec, LoggerChannel_t channel, int16_t *value)
+{
+  if(rec->type == LOG_RECORD_DS18B20 && channel == LOGGER_CHANNEL_DS18B20)
+  {
+    *value = rec->ds18b20_temp;
+    return 1;
+  }
+
+  if(rec->type != LOG_RECORD_IMU)
+  {
+    return 0;
+  }
+
+  switch(channel)
+  {
+    case LOGGER_CHANNEL_MPU_TEMP:
+      *value = rec->imu.mpu_temp;
+      break;
+    case LOGGER_CHANNEL_ACCEL_X:
+      *value = rec->imu.accel_x;
+      break;
+    case LOGGER_CHANNEL_ACCEL_Y:
+      *value = rec->imu.accel_y;
+      break;
+    case LOGGER_CHANNEL_ACCEL_Z:
+      *value = rec->imu.accel_z;
+      break;
+    case LOGGER_CHANNEL_GYRO_X:
+      *value = rec->imu.gyro_x;
+      break;
+    case LOGGER_CHANNEL_GYRO_Y:
+      *value = rec->imu.gyro_y;
+      break;
+    case LOGGER_CHANNEL_GYRO_Z:
+      *value = rec->imu.gyro_z;
+      break;
+    default:
+      return 0;
+  }
+
+  return 1;
+}
+
+// Channel at or beyond the threshold either way
+static uint8_t IsPeak(const LogRecord_t *rec, uint8_t channel, uint16_t threshold)
+{
+  int16_t v;
+
+  if(!Logger_ChannelValue(rec, channel, &v))
+  {
+    return 0;
+  }
+
+  return (v >= (int32_t) threshold || v <= -(int32_t) threshold) ? 1 : 0;
+}
+
+static void ZoneReset(LogZoneMap_t *z)
+{
+  z->imu_count = 0;
+  z->ds18b20_count = 0;
+  z->last_timestamp = 0;
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    z->channel[ch].min = INT16_MAX;
+    z->channel[ch].max = INT16_MIN;
+    z->channel[ch].sum = 0;
+  }
+}
+
+static void ZoneAdd(LogZoneMap_t *z, const LogRecord_t *rec)
+{
+  int16_t v;
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    if(!Logger_ChannelValue(rec, ch, &v))
+    {
+      continue;
+    }
+
+    if(v < z->channel[ch].min)
+    {
+      z->channel[ch].min = v;
+    }
+    if(v > z->channel[ch].max)
+    {
+      z->channel[ch].max = v;
+    }
+    z->channel[ch].sum += v;
+  }
+
+  if(rec->type == LOG_RECORD_IMU)
+  {
+    z->imu_count++;
+  }
+  else if(rec->type == LOG_RECORD_DS18B20)
+  {
+    z->ds18b20_count++;
+  }
+  z->last_timestamp = rec->timestamp;
+}
+
+static void ZoneSeal(LogZoneMap_t *z)
+{
+  z->crc = CRC16_Update(CRC16_INIT, (const uint8_t*) z, LOGGER_ZONE_SIZE - 2);
+}
+
+// Erased, torn or corrupt zone maps fail the CRC, those sectors are decoded
+static uint8_t ZoneValid(const LogZoneMap_t *z)
+{
+  return (z->crc == CRC16_Update(CRC16_INIT, (const uint8_t*) z, LOGGER_ZONE_SIZE - 2)) ? 1 : 0;
+}
+
+static uint16_t ZoneCount(const LogZoneMap_t *z, uint8_t channel)
+{
+  return (channel == LOGGER_CHANNEL_DS18B20) ? z->ds18b20_count : z->imu_count;
+}
+
+// Whether any value of the channel in the sector reached the threshold
+static uint8_t ZoneHasPeak(const LogZoneMap_t *z, uint8_t channel, uint16_t threshold)
+{
+  if(ZoneCount(z, channel) == 0)
+  {
+    return 0;
+  }
+
+  return (z->channel[channel].max >= (int32_t) threshold || z->channel[channel].min <= -(int32_t) threshold) ? 1 : 0;
+}
+
+static void TotalsAdd(LogTotal_t *t, const LogRecord_t *rec)
+{
+  int16_t v;
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    if(!Logger_ChannelValue(rec, ch, &v))
+    {
+      continue;
+    }
+
+    if(v < t[ch].min)
+    {
+      t[ch].min = v;
+    }
+    if(v > t[ch].max)
+    {
+      t[ch].max = v;
+    }
+    t[ch].sum += v;
+    t[ch].count++;
+  }
+}
+
+static void TotalsMerge(LogTotal_t *t, const LogZoneMap_t *z)
+{
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    if(ZoneCount(z, ch) == 0)
+    {
+      continue;
+    }
+
+    if(z->channel[ch].min < t[ch].min)
+    {
+      t[ch].min = z->channel[ch].min;
+    }
+    if(z->channel[ch].max > t[ch].max)
+    {
+      t[ch].max = z->channel[ch].max;
+    }
+    t[ch].sum += z->channel[ch].sum;
+    t[ch].count += ZoneCount(z, ch);
+  }
+}
+
+// Empty log starting at the first sector
+static void ResetLog(void)
+{
+  sequence = 0;
+  entry_count = 0;
+  current_sector = LOGGER_FIRST_SECTOR;
+  oldest_sector = LOGGER_FIRST_SECTOR;
+  sector_entries = 0;
+  sector_open = 0;
+  log_full = 0;
+  erase_sector = 0;
+  pending_page = 0;
+  close_sector = 0;
+  close_step = 0;
+  session_sequence = 1;
+  ZoneReset(&zone);
+  PageBuffer_Reset(LOGGER_START_ADDR);
+
+  for(uint16_t i = 0; i < LOGGER_INDEX_SIZE; i++)
+  {
+    log_index[i].first_sequence = LOGGER_INDEX_EMPTY;
+  }
+}
+
+// Issue the largest erase that fits at the top of the current range
+static void WipeStep(void)
+{
+  SectorRange_t *r = &wipe_range[wipe_ranges - 1];
+  uint16_t count = r->top - r->bottom + 1;
+  uint16_t n;
+  uint8_t percent;
+
+  if(((r->top + 1) % 16) == 0 && count >= 16)
+  {
+    n = 16;
+    W25Q64_StartEraseBlock64K(LOGGER_SECTOR_ADDR(r->top - 15));
+  }
+  else if(((r->top + 1) % 8) == 0 && count >= 8)
+  {
+    n = 8;
+    W25Q64_StartEraseBlock32K(LOGGER_SECTOR_ADDR(r->top - 7));
+  }
+  else
+  {
+    n = 1;
+    W25Q64_StartEraseSector(LOGGER_SECTOR_ADDR(r->top));
+  }
+
+  erase_target = 0;
+  flash_busy = 1;
+  wipe_done += n;
+
+  if(n == count)
+  {
+    wipe_ranges--;
+  }
+  else
+  {
+    r->top -= n;
+  }
+
+  // Progress every 10%
+  percent = (uint32_t) wipe_done * 100 / wipe_total;
+  if(percent >= wipe_reported + 10)
+  {
+    char buf[16];
+
+    wipe_reported = percent - (percent % 10);
+    ultoa(wipe_reported, buf);
+
+    send_string("Erasing... ");
+    send_string(buf);
+    send_string("%\r\n");
+
+    LCD_SetCursor(1, 0);
+    LCD_SendString("Erasing ");
+    LCD_SendString(buf);
+    LCD_SendString("%  ");
+  }
+}
+
+// Last erase has completed
+static void WipeFinish(void)
+{
+  wipe_active = 0;
+  Rollup_Reset();
+
+  ShowMessage("Flash Erased!");
+  send_string("Flash erase complete!\r\n");
+}
+
+// Read a sector header, returns 1 if it belongs to a log sector
+static uint8_t ReadSectorHeader(uint16_t sector, LogSectorHeader_t *hdr)
+{
+  W25Q64_Read(LOGGER_SECTOR_ADDR(sector), (uint8_t*) hdr, LOGGER_HEADER_SIZE);
+  scan_reads++;
+
+  return (hdr->magic == LOGGER_SECTOR_MAGIC && hdr->version == LOGGER_FORMAT_VERSION);
+}
+
+// Header and zone map in one read, returns what ReadSectorHeader would
+static uint8_t ReadSectorMeta(uint16_t sector, LogSectorMeta_t *meta)
+{
+  W25Q64_Read(LOGGER_SECTOR_ADDR(sector), (uint8_t*) meta, LOGGER_SECTOR_META_SIZE);
+
+  return (meta->header.magic == LOGGER_SECTOR_MAGIC && meta->header.version == LOGGER_FORMAT_VERSION);
+}
+
+// Header is the first thing programmed in a sector, blank header means blank sector
+static uint8_t IsHeaderBlank(const LogSectorHeader_t *hdr)
+{
+  const uint8_t *p = (const uint8_t*) hdr;
+
+  for(uint32_t i = 0; i < LOGGER_HEADER_SIZE; i++)
+  {
+    if(p[i] != 0xFF)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Sectors are filled in ring order, so in address order the log looks like
+// [newer sectors][erased gap][older sectors], each part with rising sequence numbers.
+// Taking the first used sector as reference, "used and sequence >= reference" holds
+// up to the newest sector and fails after it, so it can be found by binary search.
+// The pages of the newest sector are then decoded to count its entries. ~25 reads in total.
+//
+// A power loss can cut the last program short. Its records fail their checkpoint
+// and are not counted, writing goes on in the next page. A newest sector with no
+// good record at all, its header may be torn, is erased and the scan runs again.
+// Bits programmed in the page after the last one in use end the sector.
+static void FindFirstEmptyLocation(void)
+{
+  LogSectorHeader_t hdr;
+  LogRecord_t rec;
+  LogCodec_t dec;
+  uint32_t addr = 0;
+  uint16_t ref = 0;
+  uint32_t ref_sequence = 0;
+  uint16_t newest;
+  uint16_t sector;
+  uint16_t low;
+  uint16_t high;
+  uint16_t mid;
+  uint16_t good;
+  uint8_t offset;
+  uint8_t torn = 0;
+
+  flash_busy = 0;
+  ResetLog();
+
+  // A reset can land in the middle of an erase
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+
+  // Erased gap ahead of the writer is at most two sectors
+  for(sector = LOGGER_FIRST_SECTOR; sector < LOGGER_FIRST_SECTOR + 3; sector++)
+  {
+    if(ReadSectorHeader(sector, &hdr))
+    {
+      ref = sector;
+      ref_sequence = hdr.first_sequence;
+      break;
+    }
+  }
+
+  // Empty log
+  if(ref == 0)
+  {
+    return;
+  }
+
+  // Newest sector is the last one in [ref, LAST] that passes the test
+  low = ref + 1;
+  high = LOGGER_LAST_SECTOR + 1;
+  while(low < high)
+  {
+    mid = low + (high - low) / 2;
+
+    if(ReadSectorHeader(mid, &hdr) && hdr.first_sequence >= ref_sequence)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+
+  newest = low - 1;
+  ReadSectorHeader(newest, &hdr);
+
+  if(hdr.commit == LOGGER_SECTOR_COMMITTED)
+  {
+    // Newest sector was sealed, continue in a fresh one
+    sequence = hdr.first_sequence + hdr.entry_count - 1;
+    current_sector = NextSector(newest);
+  }
+  else
+  {
+    // Newest sector still open, count the entries in its pages. Writing
+    // goes on in the first empty page, a partly filled one is left alone.
+    addr = LOGGER_SECTOR_ADDR(newest);
+    W25Q64_ReadBegin(addr);
+    scan_reads++;
+
+    for(uint8_t p = 0; p < LOGGER_PAGES_PER_SECTOR; p++)
+    {
+      W25Q64_ReadStream(dump_buf.page, W25Q64_PAGE_SIZE);
+
+      if(LOGGER_PAGE_EMPTY(dump_buf.page, addr))
+      {
+        // Writing can only go on in a page that is still erased
+        for(uint16_t i = 0; i < W25Q64_PAGE_SIZE; i++)
+        {
+          torn |= (dump_buf.page[i] != 0xFF);
+        }
+        break;
+      }
+
+      offset = LOGGER_PAGE_DATA(addr);
+      LogCodec_Begin(&dec, &dump_buf.page[offset], W25Q64_PAGE_SIZE - offset);
+      if(offset != 0)
+      {
+        LogCodec_Seed(&dec, &dump_buf.page[LOGGER_HEADER_SEED_OFFSET], LOGGER_HEADER_SEED_SIZE);
+      }
+      // Zone map of the records so far, the sector is closed with it
+      good = LogCodec_Verify(&dec);
+      sector_entries += good;
+      while(good > 0 && LogCodec_Get(&dec, &rec))
+      {
+        ZoneAdd(&zone, &rec);
+        good--;
+      }
+
+      addr += W25Q64_PAGE_SIZE;
+    }
+
+    W25Q64_ReadEnd();
+
+    // Nothing in it can be trusted, not even the header. The sector before
+    // it was complete, so the second scan ends there.
+    if(sector_entries == 0)
+    {
+      W25Q64_EraseSector(LOGGER_SECTOR_ADDR(newest));
+      FindFirstEmptyLocation();
+      return;
+    }
+
+    current_sector = newest;
+    sequence = hdr.first_sequence + sector_entries - 1;
+    sector_open = 1;
+  }
+
+  // Oldest data is the first used sector after the gap, or the reference if never wrapped
+  oldest_sector = ref;
+  sector = NextSector(newest);
+  for(uint8_t i = 0; i < 3 && sector != newest; i++)
+  {
+    if(ReadSectorHeader(sector, &hdr))
+    {
+      oldest_sector = sector;
+      break;
+    }
+    sector = NextSector(sector);
+  }
+
+  ReadSectorHeader(oldest_sector, &hdr);
+  entry_count = sequence - hdr.first_sequence + 1;
+
+  // Before closing a torn sector starts programs and the erase ahead
+  IndexRebuild();
+
+  // Sector the erase ahead had, the one after an open sector or the one a
+  // sealed sector is followed by
+  EraseIfTorn(sector_open ? NextSector(current_sector) : current_sector);
+
+  if(sector_open)
+  {
+    PageBuffer_Reset(addr + LOGGER_PAGE_DATA(addr));
+
+    // No empty page left, power was lost before the commit marker
+    if(addr == LOGGER_SECTOR_ADDR(current_sector + 1) || torn)
+    {
+      CloseSector();
+    }
+    else if(log_mode == LOGGER_MODE_RING)
+    {
+      erase_sector = NextSector(current_sector);
+    }
+  }
+}
+
+// A power loss in an erase can leave the header blank and the rest not.
+// The erase ahead and OpenSector only look at the header, so a sector that
+// looks blank is checked whole at boot and erased again if it isn't.
+static void EraseIfTorn(uint16_t sector)
+{
+  LogSectorHeader_t hdr;
+  uint8_t dirty = 0;
+
+  ReadSectorHeader(sector, &hdr);
+  if(!IsHeaderBlank(&hdr))
+  {
+    return;  // Erased before it is written anyway
+  }
+
+  W25Q64_ReadBegin(LOGGER_SECTOR_ADDR(sector));
+  scan_reads++;
+  for(uint8_t p = 0; p < LOGGER_PAGES_PER_SECTOR && !dirty; p++)
+  {
+    W25Q64_ReadStream(dump_buf.page, W25Q64_PAGE_SIZE);
+    for(uint16_t i = 0; i < W25Q64_PAGE_SIZE; i++)
+    {
+      dirty |= (dump_buf.page[i] != 0xFF);
+    }
+  }
+  W25Q64_ReadEnd();
+
+  if(dirty)
+  {
+    W25Q64_EraseSector(LOGGER_SECTOR_ADDR(sector));
+  }
+}
+
+// Move queued records into the log. Without wait it stops at the first record
+// that would have to wait for the flash, Logger_Task tries again next time.
+static void DrainQueue(uint8_t wait)
+{
+  LogRecord_t *rec;
+  uint8_t result;
+
+  while((rec = LogQueue_Peek()) != 0)
+  {
+    result = SaveRecord(rec, wait);
+    if(result == LOGGER_SAVE_WAIT)
+    {
+      break;
+    }
+    if(result == LOGGER_SAVE_DROPPED)
+    {
+      discarded++;
+    }
+    LogQueue_Pop();
+  }
+}
+
+// Compress a record into the log. Unless wait is set, returns LOGGER_SAVE_WAIT
+// with nothing changed when that would mean waiting for the flash.
+static uint8_t SaveRecord(LogRecord_t *rec, uint8_t wait)
+{
+  if(wipe_active || log_full)
+  {
+    return LOGGER_SAVE_DROPPED;
+  }
+
+  rec->sequence = sequence + 1;  // Not stored, implied by the position in the sector
+
+  // FIFO samples are queued up to a FIFO depth old, after DS18B20 and event
+  // records stamped since. Time queries, sector bounds and rollups need
+  // times that never go back, so a record never gets older than the last.
+  if(rec->timestamp < last_timestamp)
+  {
+    rec->timestamp = last_timestamp;
+  }
+
+  if(!sector_open)
+  {
+    if(!wait && !CanOpenSector())
+    {
+      return LOGGER_SAVE_WAIT;
+    }
+    if(!OpenSector(rec))
+    {
+      return LOGGER_SAVE_DROPPED;
+    }
+  }
+
+  // Compress into the page buffer, flash is programmed once per full page
+  if(!PageBuffer_Put(rec))
+  {
+    // Both page buffers taken, or the last commit marker not out yet
+    if(!wait && (pending_page != 0 || close_sector != 0))
+    {
+      return LOGGER_SAVE_WAIT;
+    }
+
+    if(((page->addr + W25Q64_PAGE_SIZE) & (W25Q64_SECTOR_SIZE - 1)) == 0)
+    {
+      // Sector full, seal it and move on. The record opens the next one.
+      CloseSector();
+      if(log_full)
+      {
+        return LOGGER_SAVE_DROPPED;
+      }
+      if(!wait && !CanOpenSector())
+      {
+        return LOGGER_SAVE_WAIT;
+      }
+      if(!OpenSector(rec))
+      {
+        return LOGGER_SAVE_DROPPED;
+      }
+    }
+    else
+    {
+      PageBuffer_Retire();
+    }
+
+    // A keyframe always fits in an empty page
+    PageBuffer_Put(rec);
+  }
+
+  // Update pointers
+  sequence++;
+  sector_entries++;
+  entry_count++;
+  last_timestamp = rec->timestamp;
+  ZoneAdd(&zone, rec);
+  Rollup_Add(rec);
+
+  return LOGGER_SAVE_DONE;
+}
+
+// OpenSector reads the header and may have to erase, both need an idle flash
+// and the erase ahead to have started already
+static uint8_t CanOpenSector(void)
+{
+  if(erase_sector == current_sector)
+  {
+    return 0;  // Logger_Task issues it first
+  }
+
+  if(FlashReady())
+  {
+    return !W25Q64_IsSuspended() || erase_target != current_sector;
+  }
+
+  // Only an erase of this sector has to finish, any other is suspended
+  if(erase_target != current_sector && TIMER2_GetMillis() - resume_ms >= LOGGER_ERASE_RUN_MS &&
+     W25Q64_SuspendErase())
+  {
+    flash_busy = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Start a new sector by putting its header in the page buffer, first is the
+// record about to be saved. Returns 0 if linear mode has no blank sector left.
+static uint8_t OpenSector(const LogRecord_t *first)
+{
+  LogSectorHeader_t hdr;
+
+  // Normally erased long ago by the erase ahead, otherwise finish it now.
+  // An erase elsewhere only has to let the header read through.
+  if(erase_sector == current_sector || erase_target == current_sector)
+  {
+    WaitFlashReady();
+    if(erase_sector == current_sector)
+    {
+      StartErase();
+    }
+    WaitFlashReady();
+  }
+  else
+  {
+    WaitFlashIdle();
+  }
+
+  ReadSectorHeader(current_sector, &hdr);
+  if(!IsHeaderBlank(&hdr))
+  {
+    if(log_mode != LOGGER_MODE_RING)
+    {
+      log_full = 1;
+      return 0;
+    }
+
+    erase_sector = current_sector;
+    WaitFlashReady();
+    StartErase();
+    WaitFlashReady();
+  }
+
+  // Keep the next sector erased so the writer never waits for it
+  if(log_mode == LOGGER_MODE_RING)
+  {
+    erase_sector = NextSector(current_sector);
+  }
+
+  hdr.magic = LOGGER_SECTOR_MAGIC;
+  hdr.version = LOGGER_FORMAT_VERSION;
+  hdr.commit = 0xFF;
+  hdr.entry_count = 0xFFFF;
+  hdr.first_sequence = first->sequence;
+  hdr.first_timestamp = first->timestamp;
+
+  // Header goes out with the first page of entries
+  PageBuffer_Reset(LOGGER_SECTOR_ADDR(current_sector) + LOGGER_SECTOR_META_SIZE);
+  for(uint16_t i = 0; i < LOGGER_HEADER_SIZE; i++)
+  {
+    page->data[i] = ((uint8_t*) &hdr)[i];
+  }
+  page->written = 0;
+  LogCodec_Seed(&codec, &page->data[LOGGER_HEADER_SEED_OFFSET], LOGGER_HEADER_SEED_SIZE);
+  IndexSet(current_sector, &hdr);
+  ZoneReset(&zone);
+
+  sector_entries = 0;
+  sector_open = 1;
+
+  return 1;
+}
+
+// Flush the sector and queue its zone map, entry count and commit marker
+static void CloseSector(void)
+{
+  PageBuffer_Retire();
+
+  // Only one marker can wait, flush the older one first
+  if(close_sector != 0)
+  {
+    FlushPending();
+  }
+
+  close_sector = current_sector;
+  close_count = sector_entries;
+  close_zone = zone;
+  ZoneSeal(&close_zone);
+
+  if(FlashReady())
+  {
+    ProcessPending();
+  }
+
+  // Linear mode stops at the end of flash
+  if(log_mode != LOGGER_MODE_RING && current_sector == LOGGER_LAST_SECTOR)
+  {
+    log_full = 1;
+  }
+
+  current_sector = NextSector(current_sector);
+  PageBuffer_Reset(LOGGER_SECTOR_ADDR(current_sector));
+  sector_entries = 0;
+  sector_open = 0;
+}
+
+// Header fields were left erased, so they can be programmed now. Three
+// programs, the zone map, the count and the commit byte only once both are
+// complete, so a power loss before it leaves an open sector and the boot
+// scan counts it again. Rebuilt from the same records, the zone map and
+// count come out the same and programming them again is harmless.
+static void WriteCommitMarker(void)
+{
+  static LogSectorHeader_t hdr;  // Read by DMA after we return
+  uint8_t *p = (uint8_t*) &hdr;
+
+  if(close_step == 0)
+  {
+    W25Q64_StartWritePage(LOGGER_SECTOR_ADDR(close_sector) + LOGGER_HEADER_SIZE, (const uint8_t*) &close_zone,
+                          LOGGER_ZONE_SIZE);
+    close_step = 1;
+  }
+  else if(close_step == 1)
+  {
+    hdr.entry_count = close_count;
+    W25Q64_StartWritePage(LOGGER_SECTOR_ADDR(close_sector) + 6, &p[6], 2);  // entry_count
+    close_step = 2;
+  }
+  else
+  {
+    hdr.commit = LOGGER_SECTOR_COMMITTED;
+    W25Q64_StartWritePage(LOGGER_SECTOR_ADDR(close_sector) + 5, &p[5], 1);  // commit
+    close_step = 0;
+    close_sector = 0;
+  }
+  flash_busy = 1;
+}
+
+// Returns 1 if no program or erase is running
+static uint8_t FlashReady(void)
+{
+  if(flash_busy)
+  {
+    if(W25Q64_IsBusy())
+    {
+      return 0;
+    }
+    flash_busy = 0;
+  }
+
+  return 1;
+}
+
+// Blocking fallback, only used when the buffers can't absorb an erase.
+// Waits for a suspended erase too.
+static void WaitFlashReady(void)
+{
+  if(W25Q64_IsSuspended())
+  {
+    ResumeErase();
+  }
+
+  if(flash_busy)
+  {
+    W25Q64_WaitBusy();
+    flash_busy = 0;
+  }
+}
+
+// Blocking, ready for reads and programs. A running erase is suspended
+// rather than waited for, Logger_Task resumes it.
+static void WaitFlashIdle(void)
+{
+  if(flash_busy)
+  {
+    if(!W25Q64_SuspendErase())
+    {
+      W25Q64_WaitBusy();
+    }
+    flash_busy = 0;
+  }
+}
+
+static void ResumeErase(void)
+{
+  W25Q64_ResumeErase();
+  resume_ms = TIMER2_GetMillis();
+  flash_busy = 1;
+}
+
+// Blocking, program everything that is waiting
+static void FlushPending(void)
+{
+  WaitFlashIdle();
+
+  while(pending_page != 0 || close_sector != 0)
+  {
+    ProcessPending();
+    WaitFlashIdle();
+  }
+}
+
+// Issue the queued erase without waiting, flash must be idle
+static void StartErase(void)
+{
+  LogSectorHeader_t hdr;
+  uint16_t sector = erase_sector;
+
+  erase_sector = 0;
+
+  // Never written, nothing to do
+  ReadSectorHeader(sector, &hdr);
+  if(IsHeaderBlank(&hdr))
+  {
+    return;
+  }
+
+  // Erasing the oldest data moves the start of the log forward
+  if(sector == oldest_sector)
+  {
+    if(hdr.magic == LOGGER_SECTOR_MAGIC && hdr.commit == LOGGER_SECTOR_COMMITTED)
+    {
+      entry_count -= hdr.entry_count;
+    }
+    oldest_sector = NextSector(sector);
+  }
+
+  IndexSet(sector, 0);
+  W25Q64_StartEraseSector(LOGGER_SECTOR_ADDR(sector));
+  erase_target = sector;
+  flash_busy = 1;
+}
+
+// Start the next program that waited for the flash, flash must be idle.
+// Page goes first so the commit marker never runs ahead of the data.
+static void ProcessPending(void)
+{
+  if(pending_page != 0)
+  {
+    PageBuffer_Commit(pending_page);
+    pending_page = 0;
+  }
+  else if(close_sector != 0)
+  {
+    WriteCommitMarker();
+  }
+}
+
+// Point the page buffer at a flash address, bytes before it count as written.
+// The encoder starts a new page there.
+static void PageBuffer_Reset(uint32_t addr)
+{
+  page->addr = addr & ~(uint32_t) (W25Q64_PAGE_SIZE - 1);
+  page->fill = addr - page->addr;
+  page->written = page->fill;
+
+  for(uint16_t i = 0; i < W25Q64_PAGE_SIZE; i++)
+  {
+    page->data[i] = 0xFF;
+  }
+
+  LogCodec_Begin(&codec, &page->data[page->fill], W25Q64_PAGE_SIZE - page->fill);
+}
+
+// Compress a record into the page buffer, returns 0 if the page is full
+static uint8_t PageBuffer_Put(const LogRecord_t *rec)
+{
+  uint16_t offset = codec.data - page->data;
+  uint16_t first = offset + codec.bit / 8;  // Byte the record starts in
+
+  if(!LogCodec_Put(&codec, rec))
+  {
+    return 0;
+  }
+
+  // Byte was programmed half used by a flush, program it again with the
+  // new bits. Erased bits are 1, so this only clears more of them.
+  if(page->written > first)
+  {
+    page->written = first;
+  }
+  page->fill = offset + LogCodec_Bytes(&codec);
+
+  return 1;
+}
+
+// Close the records in the page buffer with a checkpoint before they are
+// programmed, LogCodec_Put always leaves room for it
+static void PageBuffer_Check(void)
+{
+  uint16_t offset = codec.data - page->data;
+  uint16_t first = offset + codec.bit / 8;
+
+  if(!LogCodec_Check(&codec))
+  {
+    return;  // Nothing new since the last one
+  }
+
+  if(page->written > first)
+  {
+    page->written = first;
+  }
+  page->fill = offset + LogCodec_Bytes(&codec);
+}
+
+// Program the current page now or queue it behind a running erase,
+// then continue filling the other buffer at the following page
+static void PageBuffer_Retire(void)
+{
+  LogPage_t *next = (page == &pages[0]) ? &pages[1] : &pages[0];
+  uint32_t addr = page->addr + W25Q64_PAGE_SIZE;
+
+  // Both buffers in use, the older one goes out first
+  if(pending_page != 0)
+  {
+    FlushPending();
+  }
+
+  PageBuffer_Check();
+
+  if(page->fill != page->written)
+  {
+    if(FlashReady())
+    {
+      PageBuffer_Commit(page);
+    }
+    else
+    {
+      pending_page = page;
+    }
+  }
+
+  // Other buffer may still be going out on DMA
+  while(!W25Q64_TransferDone());
+
+  page = next;
+  PageBuffer_Reset(addr);
+}
+
+// Start programming the part of a page buffer that is not in flash yet.
+// Data goes out on DMA, flash must be idle.
+static void PageBuffer_Commit(LogPage_t *p)
+{
+  if(p->fill == p->written)
+  {
+    return;  // Nothing new
   }
 
-  // If we get here, flash is full
-  current_addr = LOGGER_MAX_ADDR;
+  // One program operation, never crosses the page boundary
+  W25Q64_StartWritePage(p->addr + p->written, &p->data[p->written], p->fill - p->written);
+  flash_bytes += p->fill - p->written;
+  p->written = p->fill;
+  flash_busy = 1;
 }
 
 static void ShowMessage(const char *msg)
@@ -0,0 +1,85 @@
+/*
+ * logqueue.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include "stm32f103xb.h"
+#include "logqueue.h"
+
+#define LOGQUEUE_MASK  (LOGQUEUE_SIZE - 1)
+
+// Free running indices, the slot is index & LOGQUEUE_MASK. Each side only
+// writes its own index, head - tail is the number of records waiting.
+static LogRecord_t queue[LOGQUEUE_SIZE];
+static volatile uint16_t head = 0;  // Next slot to fill, written by the producer
+static volatile uint16_t tail = 0;  // Next slot to read, written by the consumer
+
+static LogQueue_Stats_t stats;
+
+void LogQueue_Init(void)
+{
+  head = 0;
+  tail = 0;
+  stats.pushed = 0;
+  stats.dropped = 0;
+  stats.high_water = 0;
+}
+
+uint8_t LogQueue_Push(const LogRecord_t *rec)
+{
+  uint16_t h = head;
+  uint16_t used = (uint16_t) (h - tail);
+
+  if(used >= LOGQUEUE_SIZE)
+  {
+    stats.dropped++;
+    return 0;
+  }
+
+  queue[h & LOGQUEUE_MASK] = *rec;
+
+  // Record must be complete before the consumer can see it
+  __DMB();
+  head = h + 1;
+
+  stats.pushed++;
+  if(used + 1 > stats.high_water)
+  {
+    stats.high_water = used + 1;
+  }
+
+  return 1;
+}
+
+LogRecord_t* LogQueue_Peek(void)
+{
+  uint16_t t = tail;
+
+  if(t == head)
+  {
+    return 0;
+  }
+
+  // Don't read the slot before seeing the new head
+  __DMB();
+  return &queue[t & LOGQUEUE_MASK];
+}
+
+void LogQueue_Pop(void)
+{
+  // Done reading the slot before the producer may reuse it
+  __DMB();
+  tail = tail + 1;
+}
+
+uint16_t LogQueue_Count(void)
+{
+  return (uint16_t) (head - tail);
+}
+
+const LogQueue_Stats_t* LogQueue_GetStats(void)
+{
+  return &stats;
+}
@@ -20,11 +20,25 @@
 #include "spi1.h"
 #include "w25q64.h"
 #include "logger.h"
+#include "recorder.h"
+#include "config.h"
+#include "console.h"
 
-#define DS18B20_READ_TICKS  100
-#define MPU_READ_TICKS      5
-#define LCD_UPDATE_TICKS    10
-#define UART_UPDATE_TICKS   10
+// Task due on this pass, ticks come from the config block
+static uint8_t TaskDue(uint16_t *count, uint16_t ticks)
+{
+  if(ticks == CONFIG_TICKS_OFF)
+  {
+    return 0;
+  }
+
+  if((*count)++ >= ticks)
+  {
+    *count = 0;
+    return 1;
+  }
+  return 0;
+}
 
 int main(void)
 {
@@ -41,10 +55,11 @@ int main(void)
   SPI1_Init();
 
   // Loop counters
-  uint8_t ds18b20_count = 0;
-  uint8_t mpu_count = 0;
-  uint8_t lcd_count = 0;
-  uint8_t uart_count = 0;
+  uint16_t ds18b20_count = 0;
+  uint16_t mpu_count = 0;
+  uint16_t lcd_count = 0;
+  uint16_t uart_count = 0;
+  const Config_t *cfg;
 
   LCD_Clear();
   LCD_SendString("STM32 PROJECT");
@@ -54,68 +69,111 @@ int main(void)
   DWT_Delay_ms(2000);
 
   W25Q64_Init();
+  Config_Load();
+  cfg = Config_Get();
   DWT_Delay_ms(2000);
 
-  Logger_Init();
+  // Configured mode from the start, Task_Config_Apply then finds it in effect
+  Logger_Init((LoggerMode_t) cfg->log_mode);
   DWT_Delay_ms(2000);
 
-  // Setup TIM3 for 10ms control loop
-  TIMER3_SetupPeriod(10);  // 10ms period
+  // Sensor ranges, log mode and the TIM3 control loop period (10ms by default)
+  Task_Config_Apply();
 
   while(1)
   {
-    // Handle button
+    // Handle button 1 - Display mode
+    if(g_mode_changed)
+    {
+      g_mode_changed = 0;
+      if(!Logger_IsDumping())
+      {
+        Button_ReportMode();
+      }
+    }
+
+    // Handle button 2 short press - Save a snapshot of both sensors
     if(g_button2_short)
     {
       g_button2_short = 0;
-      // Logger_SaveEntry();
-      Feedback_Show("Logger", "DATA SAVED", 1000);  // Show for 2 seconds
+      Logger_SaveEntry();
     }
 
-    // Handle button 2 long press - Dump
+    // Handle button 2 long press - CSV dump of the whole log, sent from Logger_Task
     if(g_button2_long)
     {
       g_button2_long = 0;
-      Feedback_Show("Logger", "DATA DUMPED", 1000);
+      if(Logger_IsErasing())
+      {
+        Feedback_Show("Logger", "LOG ERASING", 1000);
+      }
+      else if(Logger_IsDumping())
+      {
+        Feedback_Show("Logger", "DUMP RUNNING", 1000);
+      }
+      else
+      {
+        Logger_DumpAll();
+        Feedback_Show("Logger", "DUMPING", 1000);
+      }
     }
 
-    // Handle button 3 long press - Erase
+    // Handle button 3 short press - Start/stop recording
+    if(g_button3_short)
+    {
+      g_button3_short = 0;
+      Task_Recorder_Toggle();
+    }
+
+    // Handle button 3 long press - Erase the log, runs on from Logger_Task
     if(g_button3_long)
     {
       g_button3_long = 0;
-      Feedback_Show("Logger", "DATA ERASED", 1000);
+      Logger_EraseAll();
+      Feedback_Show("Logger", Logger_IsErasing() ? "ERASING" : "DUMP RUNNING", 1000);
+    }
+
+    // Command lines from the UART
+    Console_Task();
+
+    // Telemetry held back while the TX ring was full, not into a dump
+    if(!Logger_IsDumping())
+    {
+      USART1_Task();
     }
 
     // Update feedback timer (check if time expired)
     Task_Feedback_Update();
+
+    // MPU6050 FIFO into the log queue while recording
+    Recorder_Task();
+
+    // Flash writer of the logger, queued records, page programs, erase ahead
+    Logger_Task();
     // Run tasks at different rates
 
     // Read DS18B20 every 1 seconds
-    if(ds18b20_count++ >= DS18B20_READ_TICKS)
+    if(TaskDue(&ds18b20_count, cfg->ds18b20_ticks))
     {
       Task_DS18B20_Read();
-      ds18b20_count = 0;
     }
 
     // Read MPU6050 every 50ms
-    if(mpu_count++ >= MPU_READ_TICKS)
+    if(TaskDue(&mpu_count, cfg->mpu_ticks))
     {
       Task_MPU6050_Read();
-      mpu_count = 0;
     }
 
     // Update LCD every 100ms
-    if(lcd_count++ >= LCD_UPDATE_TICKS)
+    if(TaskDue(&lcd_count, cfg->lcd_ticks))
     {
       Task_LCD_Update();
-      lcd_count = 0;
     }
 
     // Update UART output every 100ms
-    if(uart_count++ >= UART_UPDATE_TICKS)
+    if(TaskDue(&uart_count, cfg->uart_ticks))
     {
       Task_UART_Output();
-      uart_count = 0;
     }
 
     TIMER3_WaitPeriod();
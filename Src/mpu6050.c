@@ -14,6 +14,12 @@
 volatile MPU6050_RawData_t mpu6050_raw;
 volatile MPU6050_ScaledData_t mpu6050_scaled;
 
+// LSB per g and per deg/s of the ranges set, +-2g and +-250 deg/s after reset
+static const float accel_lsb_table[4] = { 16384.0f, 8192.0f, 4096.0f, 2048.0f };
+static const float gyro_lsb_table[4] = { 131.0f, 65.5f, 32.8f, 16.4f };
+static float accel_lsb = 16384.0f;
+static float gyro_lsb = 131.0f;
+
 // Read a single register from MPU6050
 static uint8_t MPU6050_ReadReg(uint8_t reg, uint8_t *data)
 {
@@ -101,6 +107,27 @@ uint8_t MPU6050_Init(void)
   return I2C_OK;
 }
 
+uint8_t MPU6050_SetRange(uint8_t accel_range, uint8_t gyro_range)
+{
+  accel_range &= 0x03;
+  gyro_range &= 0x03;
+
+  if(MPU6050_WriteReg(MPU6050_ACCEL_CONFIG, accel_range << 3) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  if(MPU6050_WriteReg(MPU6050_GYRO_CONFIG, gyro_range << 3) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  accel_lsb = accel_lsb_table[accel_range];
+  gyro_lsb = gyro_lsb_table[gyro_range];
+
+  return I2C_OK;
+}
+
 // Read multiple bytes from MPU6050 (burst read)
 static uint8_t MPU6050_ReadBurst(uint8_t start_reg, uint8_t *data, uint8_t len)
 {
@@ -158,6 +185,96 @@ uint8_t MPU6050_ReadAll(void)
   return I2C_OK;
 }
 
+// Start sampling into the FIFO. With the low pass filter on the gyro runs
+// at 1kHz, so the sample rate is 1kHz / (1 + div).
+uint8_t MPU6050_FIFO_Start(uint8_t div, uint8_t dlpf)
+{
+  if(MPU6050_WriteReg(MPU6050_CONFIG, dlpf & 0x07) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  if(MPU6050_WriteReg(MPU6050_SMPLRT_DIV, div) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  if(MPU6050_FIFO_Reset() != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  // Accelerometer, temperature and all gyro axes, same order as ReadAll
+  return MPU6050_WriteReg(MPU6050_FIFO_EN, 0xF8);
+}
+
+// Back to direct register reads with the filter off, like after MPU6050_Init
+uint8_t MPU6050_FIFO_Stop(void)
+{
+  if(MPU6050_WriteReg(MPU6050_FIFO_EN, 0x00) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  if(MPU6050_WriteReg(MPU6050_USER_CTRL, 0x00) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  return MPU6050_WriteReg(MPU6050_CONFIG, 0x00);
+}
+
+// Empty the FIFO, needed after an overflow as the samples lose their alignment
+uint8_t MPU6050_FIFO_Reset(void)
+{
+  // FIFO_RESET only works with the FIFO disabled
+  if(MPU6050_WriteReg(MPU6050_USER_CTRL, 0x04) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  return MPU6050_WriteReg(MPU6050_USER_CTRL, 0x40);  // FIFO_EN
+}
+
+uint8_t MPU6050_FIFO_Count(uint16_t *count)
+{
+  uint8_t buffer[2];
+
+  if(MPU6050_ReadBurst(MPU6050_FIFO_COUNTH, buffer, 2) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  *count = (uint16_t) ((buffer[0] << 8) | buffer[1]);
+  return I2C_OK;
+}
+
+// Read n whole samples, n <= MPU6050_FIFO_MAX_BURST
+uint8_t MPU6050_FIFO_Read(MPU6050_RawData_t *samples, uint8_t n)
+{
+  uint8_t buffer[MPU6050_FIFO_MAX_BURST * MPU6050_FIFO_SAMPLE_SIZE];
+
+  if(MPU6050_ReadBurst(MPU6050_FIFO_R_W, buffer, n * MPU6050_FIFO_SAMPLE_SIZE) != I2C_OK)
+  {
+    return I2C_ERROR;
+  }
+
+  for(uint8_t i = 0; i < n; i++)
+  {
+    const uint8_t *b = &buffer[i * MPU6050_FIFO_SAMPLE_SIZE];
+
+    samples[i].accel_x = (int16_t) ((b[0] << 8) | b[1]);
+    samples[i].accel_y = (int16_t) ((b[2] << 8) | b[3]);
+    samples[i].accel_z = (int16_t) ((b[4] << 8) | b[5]);
+    samples[i].temp = (int16_t) ((b[6] << 8) | b[7]);
+    samples[i].gyro_x = (int16_t) ((b[8] << 8) | b[9]);
+    samples[i].gyro_y = (int16_t) ((b[10] << 8) | b[11]);
+    samples[i].gyro_z = (int16_t) ((b[12] << 8) | b[13]);
+  }
+
+  return I2C_OK;
+}
+
 // Read only accelerometer data
 uint8_t MPU6050_ReadAccel(void)
 {
@@ -210,15 +327,15 @@ uint8_t MPU6050_ReadTemp(void)
 // Scale all sensor data
 void MPU6050_ScaleAll(void)
 {
-  // Scale accelerometer (±2g range: 16384 LSB/g)
-  mpu6050_scaled.accel_x = mpu6050_raw.accel_x / 16384.0f;
-  mpu6050_scaled.accel_y = mpu6050_raw.accel_y / 16384.0f;
-  mpu6050_scaled.accel_z = mpu6050_raw.accel_z / 16384.0f;
+  // Scale accelerometer (16384 LSB/g at ±2g)
+  mpu6050_scaled.accel_x = mpu6050_raw.accel_x / accel_lsb;
+  mpu6050_scaled.accel_y = mpu6050_raw.accel_y / accel_lsb;
+  mpu6050_scaled.accel_z = mpu6050_raw.accel_z / accel_lsb;
 
-  // Scale gyroscope (±250°/s range: 131 LSB/°/s)
-  mpu6050_scaled.gyro_x = mpu6050_raw.gyro_x / 131.0f;
-  mpu6050_scaled.gyro_y = mpu6050_raw.gyro_y / 131.0f;
-  mpu6050_scaled.gyro_z = mpu6050_raw.gyro_z / 131.0f;
+  // Scale gyroscope (131 LSB/°/s at ±250°/s)
+  mpu6050_scaled.gyro_x = mpu6050_raw.gyro_x / gyro_lsb;
+  mpu6050_scaled.gyro_y = mpu6050_raw.gyro_y / gyro_lsb;
+  mpu6050_scaled.gyro_z = mpu6050_raw.gyro_z / gyro_lsb;
 
   // Scale temperature: Temperature = (raw_temp / 340.0) + 36.53
   mpu6050_scaled.temp = (mpu6050_raw.temp / 340.0f) + 36.53f;
@@ -227,17 +344,17 @@ void MPU6050_ScaleAll(void)
 // Scale only accelerometer data
 void MPU6050_ScaleAccel(void)
 {
-  mpu6050_scaled.accel_x = mpu6050_raw.accel_x / 16384.0f;
-  mpu6050_scaled.accel_y = mpu6050_raw.accel_y / 16384.0f;
-  mpu6050_scaled.accel_z = mpu6050_raw.accel_z / 16384.0f;
+  mpu6050_scaled.accel_x = mpu6050_raw.accel_x / accel_lsb;
+  mpu6050_scaled.accel_y = mpu6050_raw.accel_y / accel_lsb;
+  mpu6050_scaled.accel_z = mpu6050_raw.accel_z / accel_lsb;
 }
 
 // Scale only gyroscope data
 void MPU6050_ScaleGyro(void)
 {
-  mpu6050_scaled.gyro_x = mpu6050_raw.gyro_x / 131.0f;
-  mpu6050_scaled.gyro_y = mpu6050_raw.gyro_y / 131.0f;
-  mpu6050_scaled.gyro_z = mpu6050_raw.gyro_z / 131.0f;
+  mpu6050_scaled.gyro_x = mpu6050_raw.gyro_x / gyro_lsb;
+  mpu6050_scaled.gyro_y = mpu6050_raw.gyro_y / gyro_lsb;
+  mpu6050_scaled.gyro_z = mpu6050_raw.gyro_z / gyro_lsb;
 }
 
 // Scale only temperature data
@@ -252,14 +369,14 @@ float MPU6050_ConvertTemp(int16_t raw_temp)
   return (raw_temp / 340.0f) + 36.53f;
 }
 
-// Convert raw accelerometer to g (±2g range)
+// Convert raw accelerometer to g in the range set
 float MPU6050_ConvertAccel(int16_t raw_accel)
 {
-  return raw_accel / 16384.0f;
+  return raw_accel / accel_lsb;
 }
 
-// Convert raw gyroscope to degrees/sec (±250°/s range)
+// Convert raw gyroscope to degrees/sec in the range set
 float MPU6050_ConvertGyro(int16_t raw_gyro)
 {
-  return raw_gyro / 131.0f;
+  return raw_gyro / gyro_lsb;
 }
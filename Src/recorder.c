@@ -0,0 +1,269 @@
+/*
+ * recorder.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include "recorder.h"
+#include "mpu6050.h"
+#include "i2c1.h"
+#include "uart.h"
+#include "timer2.h"
+#include "logger.h"
+#include "logqueue.h"
+
+static uint8_t running = 0;
+static uint16_t rate = RECORDER_DEFAULT_RATE;
+static uint32_t start_ms = 0;
+static uint32_t stop_ms = 0;
+
+// Sample clock, index counts every sample since the start including lost ones
+static uint32_t index = 0;
+static uint32_t samples = 0;
+static uint32_t lost = 0;
+
+// Counters of the other modules at the start
+static uint32_t queue_dropped_base = 0;
+static uint32_t discarded_base = 0;
+static uint32_t flash_bytes_base = 0;
+
+// Widest low pass filter that still cuts off below half the sample rate
+static uint8_t FilterFor(uint16_t hz)
+{
+  if(hz >= 500)
+  {
+    return 1;  // 188 Hz
+  }
+  if(hz >= 200)
+  {
+    return 2;  // 98 Hz
+  }
+  if(hz >= 100)
+  {
+    return 3;  // 42 Hz
+  }
+  if(hz >= 50)
+  {
+    return 4;  // 20 Hz
+  }
+  if(hz >= 20)
+  {
+    return 5;  // 10 Hz
+  }
+  return 6;    // 5 Hz
+}
+
+// Time of a sample age samples older than the newest one in the FIFO, which
+// was taken about now. Counting back from TIMER2 at every read keeps the
+// samples on the time base of the other records, the MPU6050 clock drifts.
+static uint32_t SampleTime(uint32_t now, uint16_t age)
+{
+  uint32_t back = (uint32_t) age * 1000 / rate;
+
+  return (back < now - start_ms) ? now - back : start_ms;
+}
+
+// A full FIFO overwrote its oldest bytes. Start over empty and skip the
+// sample clock ahead to now.
+static void Overflow(void)
+{
+  uint32_t now_index = (uint32_t) (((uint64_t) (TIMER2_GetMillis() - start_ms) * rate) / 1000);
+  uint32_t missed = 1;
+
+  MPU6050_FIFO_Reset();
+
+  if(now_index > index)
+  {
+    missed = now_index - index;
+    index = now_index;
+  }
+  lost += missed;
+
+  Logger_SaveEvent(LOGGER_EVENT_SAMPLES_LOST, missed);
+}
+
+uint8_t Recorder_Start(uint16_t rate_hz)
+{
+  uint16_t div;
+
+  if(running)
+  {
+    return 1;
+  }
+
+  // Every sample would be thrown away
+  if(Logger_IsErasing() || Logger_IsFull())
+  {
+    return 0;
+  }
+
+  if(rate_hz == 0 || rate_hz > RECORDER_MAX_RATE)
+  {
+    rate_hz = RECORDER_MAX_RATE;
+  }
+
+  // Nearest rate the divider can make
+  div = (RECORDER_MAX_RATE + rate_hz / 2) / rate_hz - 1;
+  if(div > 255)
+  {
+    div = 255;
+  }
+  rate = RECORDER_MAX_RATE / (div + 1);
+
+  if(MPU6050_FIFO_Start(div, FilterFor(rate)) != I2C_OK)
+  {
+    return 0;
+  }
+
+  start_ms = TIMER2_GetMillis();
+  index = 0;
+  samples = 0;
+  lost = 0;
+  queue_dropped_base = LogQueue_GetStats()->dropped;
+  discarded_base = Logger_GetDiscarded();
+  flash_bytes_base = Logger_GetFlashBytes();
+  running = 1;
+
+  Logger_SaveEvent(LOGGER_EVENT_RECORD_START, rate);
+
+  return 1;
+}
+
+void Recorder_Stop(void)
+{
+  if(!running)
+  {
+    return;
+  }
+
+  // Collect what is still in the FIFO
+  Recorder_Task();
+
+  MPU6050_FIFO_Stop();
+  stop_ms = TIMER2_GetMillis();
+  running = 0;
+
+  Logger_SaveEvent(LOGGER_EVENT_RECORD_STOP, samples);
+}
+
+uint8_t Recorder_IsRunning(void)
+{
+  return running;
+}
+
+// Move whole samples from the FIFO to the log queue. What the queue can't
+// take stays in the FIFO, at 1kHz it holds another 72 ms.
+void Recorder_Task(void)
+{
+  MPU6050_RawData_t burst[MPU6050_FIFO_MAX_BURST];
+  LogRecord_t rec;
+  uint16_t count;
+  uint16_t queued;
+  uint16_t n;
+  uint16_t age;
+  uint32_t now;
+  uint8_t len = 0;
+
+  if(!running)
+  {
+    return;
+  }
+
+  // 14 bytes per sample at 1kHz is more than 100kHz can carry. Stays fast
+  // until the LCD needs the bus again.
+  I2C1_SetFastMode(1);
+
+  if(MPU6050_FIFO_Count(&count) != I2C_OK)
+  {
+    return;
+  }
+
+  if(count > MPU6050_FIFO_SIZE - MPU6050_FIFO_SAMPLE_SIZE)
+  {
+    Overflow();
+    return;
+  }
+
+  now = TIMER2_GetMillis();
+  n = count / MPU6050_FIFO_SAMPLE_SIZE;
+  age = n;
+  queued = LogQueue_Count();
+  if(queued + n > LOGQUEUE_SIZE - RECORDER_QUEUE_RESERVE)
+  {
+    n = (queued < LOGQUEUE_SIZE - RECORDER_QUEUE_RESERVE) ? LOGQUEUE_SIZE - RECORDER_QUEUE_RESERVE - queued : 0;
+  }
+
+  rec.type = LOG_RECORD_IMU;
+
+  while(n > 0)
+  {
+    len = (n > MPU6050_FIFO_MAX_BURST) ? MPU6050_FIFO_MAX_BURST : n;
+    if(MPU6050_FIFO_Read(burst, len) != I2C_OK)
+    {
+      len = 0;
+      break;
+    }
+
+    for(uint8_t i = 0; i < len; i++)
+    {
+      rec.timestamp = SampleTime(now, --age);
+      index++;
+      rec.imu.mpu_temp = (int16_t) ((int32_t) burst[i].temp * 100 / 340 + 3653);  // 0.01 deg C
+      rec.imu.accel_x = burst[i].accel_x;
+      rec.imu.accel_y = burst[i].accel_y;
+      rec.imu.accel_z = burst[i].accel_z;
+      rec.imu.gyro_x = burst[i].gyro_x;
+      rec.imu.gyro_y = burst[i].gyro_y;
+      rec.imu.gyro_z = burst[i].gyro_z;
+
+      LogQueue_Push(&rec);
+      samples++;
+    }
+
+    n -= len;
+  }
+
+  // Newest sample for the LCD and UART tasks
+  if(len > 0)
+  {
+    mpu6050_raw = burst[len - 1];
+    MPU6050_ScaleAll();
+  }
+}
+
+void Recorder_GetStats(Recorder_Stats_t *stats)
+{
+  stats->rate = rate;
+  stats->samples = samples;
+  stats->dropped = lost + LogQueue_GetStats()->dropped - queue_dropped_base + Logger_GetDiscarded() - discarded_base;
+  stats->elapsed_ms = (running ? TIMER2_GetMillis() : stop_ms) - start_ms;
+  stats->flash_bytes = Logger_GetFlashBytes() - flash_bytes_base;
+}
+
+void Recorder_Report(void)
+{
+  Recorder_Stats_t st;
+  uint32_t secs;
+
+  Recorder_GetStats(&st);
+  secs = st.elapsed_ms / 1000;
+  if(secs == 0)
+  {
+    secs = 1;
+  }
+
+  USART1_SendString(running ? "Recording " : "Recorded ");
+  USART1_SendNumber(st.rate);
+  USART1_SendString(" Hz: ");
+  USART1_SendNumber(st.samples);
+  USART1_SendString(" samples in ");
+  USART1_SendNumber(st.elapsed_ms);
+  USART1_SendString(" ms, ");
+  USART1_SendNumber(st.samples / secs);
+  USART1_SendString(" samples/s, ");
+  USART1_SendNumber(st.flash_bytes / secs);
+  USART1_SendString(" flash B/s, ");
+  USART1_SendNumber(st.dropped);
+  USART1_SendString(" dropped\r\n");
+}
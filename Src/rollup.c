@@ -0,0 +1,536 @@
+/*
+ * rollup.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ */
+
+#include "rollup.h"
+#include "w25q64.h"
+#include "uart.h"
+#include "timer2.h"
+#include "crc.h"
+
+#define ROLLUP_SLOT_SIZE         sizeof(RollupRecord_t)  // Should be 64
+#define ROLLUP_SLOTS_PER_SECTOR  (W25Q64_SECTOR_SIZE / ROLLUP_SLOT_SIZE)
+#define ROLLUP_OUTBOX_SIZE       4  // Windows waiting for the flash, power of two
+#define ROLLUP_NONE              0xFFFFFFFF
+#define ROLLUP_DUMP_LINE_MAX     256  // TX ring space a dump line needs
+
+// Layout of the tiers, one after the other from ROLLUP_FIRST_SECTOR
+typedef struct
+{
+  uint32_t period_ms;
+  uint16_t first_sector;
+  uint16_t sectors;
+  const char *name;
+} RollupTier_t;
+
+static const RollupTier_t tiers[ROLLUP_TIERS] = { { 1000, ROLLUP_FIRST_SECTOR, 64, "1 s" },
+                                                  { 60000, ROLLUP_FIRST_SECTOR + 64, 192, "1 min" },
+                                                  { 3600000, ROLLUP_FIRST_SECTOR + 256, 32, "1 h" } };
+
+// Window being collected, every tier is built from the windows of the one below
+typedef struct
+{
+  uint8_t open;
+  uint32_t sequence;
+  uint32_t start_ms;
+  uint32_t imu_count;
+  uint16_t ds18b20_count;
+  int16_t min[LOGGER_CHANNELS];
+  int16_t max[LOGGER_CHANNELS];
+  int64_t sum[LOGGER_CHANNELS];
+} RollupWindow_t;
+
+static RollupWindow_t window[ROLLUP_TIERS];
+
+// Where the next window of a tier goes, a new sector is erased first
+typedef struct
+{
+  uint16_t sector;          // Index in the tier
+  uint8_t slot;
+  uint8_t erased;           // Sector erased since it was entered
+  uint32_t last_sequence;   // Of the newest window in flash, ROLLUP_NONE if none
+} RollupPosition_t;
+
+static RollupPosition_t position[ROLLUP_TIERS];
+
+// Finished windows, the head one stays until its program is done
+static RollupRecord_t outbox[ROLLUP_OUTBOX_SIZE];
+static uint8_t outbox_tier[ROLLUP_OUTBOX_SIZE];
+static uint8_t outbox_head = 0;
+static uint8_t outbox_count = 0;
+static uint8_t outbox_busy = 0;  // Head record is being programmed
+
+static Rollup_Stats_t stats;
+
+// Dump being sent, a line per Rollup_DumpStep
+static struct
+{
+  uint8_t tier;
+  uint16_t first;  // Sector before the oldest one
+  uint16_t i;      // Sectors after it, 0 before the header
+  uint8_t slot;
+  uint32_t count;
+} dump;
+
+static uint32_t SlotAddr(uint8_t tier, uint16_t sector, uint8_t slot)
+{
+  return (uint32_t) (tiers[tier].first_sector + sector) * W25Q64_SECTOR_SIZE + (uint32_t) slot * ROLLUP_SLOT_SIZE;
+}
+
+static uint16_t RecordCrc(const RollupRecord_t *r)
+{
+  return CRC16_Update(CRC16_INIT, (const uint8_t*) r, ROLLUP_SLOT_SIZE - 2);
+}
+
+static void SendInt(int16_t num)
+{
+  int32_t value = num;
+
+  if(value < 0)
+  {
+    USART1_SendChar('-');
+    value = -value;
+  }
+  USART1_SendNumber((uint32_t) value);
+}
+
+static uint8_t IsErased(const RollupRecord_t *r)
+{
+  const uint8_t *p = (const uint8_t*) r;
+
+  for(uint8_t i = 0; i < ROLLUP_SLOT_SIZE; i++)
+  {
+    if(p[i] != 0xFF)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void WindowReset(RollupWindow_t *w)
+{
+  w->open = 0;
+  w->imu_count = 0;
+  w->ds18b20_count = 0;
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    w->min[ch] = INT16_MAX;
+    w->max[ch] = INT16_MIN;
+    w->sum[ch] = 0;
+  }
+}
+
+static void WindowOpen(uint8_t tier, uint32_t sequence, uint32_t ms)
+{
+  window[tier].open = 1;
+  window[tier].sequence = sequence;
+  window[tier].start_ms = ms - ms % tiers[tier].period_ms;
+}
+
+// Time ms belongs to a later window, or to an earlier boot's clock
+static uint8_t WindowEnded(uint8_t tier, uint32_t ms)
+{
+  const RollupWindow_t *w = &window[tier];
+
+  return (ms >= w->start_ms + tiers[tier].period_ms || ms + tiers[tier].period_ms <= w->start_ms) ? 1 : 0;
+}
+
+static uint16_t WindowCount(const RollupWindow_t *w, uint8_t channel)
+{
+  return (channel == LOGGER_CHANNEL_DS18B20) ? w->ds18b20_count : (w->imu_count ? 1 : 0);
+}
+
+// Queue the record of a finished window for the flash
+static void Emit(uint8_t tier)
+{
+  const RollupWindow_t *w = &window[tier];
+  RollupRecord_t *r;
+  uint32_t count;
+  uint8_t slot;
+
+  if(w->imu_count == 0 && w->ds18b20_count == 0)
+  {
+    return;  // Only events, nothing to summarize
+  }
+
+  if(outbox_count == ROLLUP_OUTBOX_SIZE)
+  {
+    stats.dropped++;
+    return;
+  }
+
+  slot = (outbox_head + outbox_count) & (ROLLUP_OUTBOX_SIZE - 1);
+  r = &outbox[slot];
+  outbox_tier[slot] = tier;
+  outbox_count++;
+
+  // Log records lost to a power loss can make the sequence restart lower
+  r->sequence = w->sequence;
+  if(position[tier].last_sequence != ROLLUP_NONE && r->sequence <= position[tier].last_sequence)
+  {
+    r->sequence = position[tier].last_sequence + 1;
+  }
+  position[tier].last_sequence = r->sequence;
+
+  r->start_ms = w->start_ms;
+  r->imu_count = w->imu_count;
+  r->ds18b20_count = w->ds18b20_count;
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    count = (ch == LOGGER_CHANNEL_DS18B20) ? w->ds18b20_count : w->imu_count;
+    r->channel[ch].min = w->min[ch];
+    r->channel[ch].max = w->max[ch];
+    r->channel[ch].mean = count ? (int16_t) (w->sum[ch] / (int32_t) count) : 0;
+  }
+
+  r->crc = RecordCrc(r);
+}
+
+// Finish the window of a tier and fold it into the one above
+static void Close(uint8_t tier)
+{
+  RollupWindow_t *w = &window[tier];
+  RollupWindow_t *up;
+
+  Emit(tier);
+
+  if(tier + 1 < ROLLUP_TIERS)
+  {
+    up = &window[tier + 1];
+
+    if(up->open && WindowEnded(tier + 1, w->start_ms))
+    {
+      Close(tier + 1);
+    }
+    if(!up->open)
+    {
+      WindowOpen(tier + 1, w->sequence, w->start_ms);
+    }
+
+    for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+    {
+      if(WindowCount(w, ch) == 0)
+      {
+        continue;
+      }
+      if(w->min[ch] < up->min[ch])
+      {
+        up->min[ch] = w->min[ch];
+      }
+      if(w->max[ch] > up->max[ch])
+      {
+        up->max[ch] = w->max[ch];
+      }
+      up->sum[ch] += w->sum[ch];
+    }
+    up->imu_count += w->imu_count;
+    up->ds18b20_count += w->ds18b20_count;
+  }
+
+  WindowReset(w);
+}
+
+// Newest sector of a tier is the one whose first window has the highest
+// sequence number, writing goes on after its last used slot
+static void FindPosition(uint8_t tier)
+{
+  RollupPosition_t *pos = &position[tier];
+  RollupRecord_t r;
+  uint16_t newest = 0;
+  uint8_t slot;
+
+  pos->last_sequence = ROLLUP_NONE;
+
+  for(uint16_t s = 0; s < tiers[tier].sectors; s++)
+  {
+    W25Q64_Read(SlotAddr(tier, s, 0), (uint8_t*) &r, ROLLUP_SLOT_SIZE);
+
+    if(r.crc == RecordCrc(&r) && (pos->last_sequence == ROLLUP_NONE || r.sequence > pos->last_sequence))
+    {
+      pos->last_sequence = r.sequence;
+      newest = s;
+    }
+  }
+
+  // Empty tier starts at its first sector
+  if(pos->last_sequence == ROLLUP_NONE)
+  {
+    pos->sector = 0;
+    pos->slot = 0;
+    pos->erased = 0;
+    return;
+  }
+
+  // Slots are programmed in order, a torn one is passed over
+  W25Q64_ReadBegin(SlotAddr(tier, newest, 1));
+  for(slot = 1; slot < ROLLUP_SLOTS_PER_SECTOR; slot++)
+  {
+    W25Q64_ReadStream((uint8_t*) &r, ROLLUP_SLOT_SIZE);
+    if(IsErased(&r))
+    {
+      break;
+    }
+    if(r.crc == RecordCrc(&r) && r.sequence > pos->last_sequence)
+    {
+      pos->last_sequence = r.sequence;
+    }
+  }
+  W25Q64_ReadEnd();
+
+  pos->sector = newest;
+  pos->slot = slot;
+  pos->erased = 1;
+
+  if(slot == ROLLUP_SLOTS_PER_SECTOR)
+  {
+    pos->sector = (newest + 1) % tiers[tier].sectors;
+    pos->slot = 0;
+    pos->erased = 0;
+  }
+}
+
+void Rollup_Init(void)
+{
+  for(uint8_t t = 0; t < ROLLUP_TIERS; t++)
+  {
+    WindowReset(&window[t]);
+    FindPosition(t);
+    stats.written[t] = 0;
+  }
+
+  outbox_head = 0;
+  outbox_count = 0;
+  outbox_busy = 0;
+  stats.dropped = 0;
+}
+
+void Rollup_Reset(void)
+{
+  for(uint8_t t = 0; t < ROLLUP_TIERS; t++)
+  {
+    WindowReset(&window[t]);
+    position[t].sector = 0;
+    position[t].slot = 0;
+    position[t].erased = 0;
+    position[t].last_sequence = ROLLUP_NONE;
+  }
+
+  outbox_head = 0;
+  outbox_count = 0;
+  outbox_busy = 0;
+}
+
+void Rollup_Add(const LogRecord_t *rec)
+{
+  RollupWindow_t *w = &window[0];
+  int16_t v;
+
+  if(w->open && WindowEnded(0, rec->timestamp))
+  {
+    Close(0);
+  }
+  if(!w->open)
+  {
+    WindowOpen(0, rec->sequence, rec->timestamp);
+  }
+
+  for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+  {
+    if(!Logger_ChannelValue(rec, ch, &v))
+    {
+      continue;
+    }
+    if(v < w->min[ch])
+    {
+      w->min[ch] = v;
+    }
+    if(v > w->max[ch])
+    {
+      w->max[ch] = v;
+    }
+    w->sum[ch] += v;
+  }
+
+  if(rec->type == LOG_RECORD_IMU)
+  {
+    w->imu_count++;
+  }
+  else if(rec->type == LOG_RECORD_DS18B20)
+  {
+    w->ds18b20_count++;
+  }
+}
+
+// Closes windows no record has come for and programs one queued window, or
+// erases the sector it goes into. A tier only ever waits for its own erase.
+uint8_t Rollup_Task(void)
+{
+  RollupPosition_t *pos;
+  uint32_t now = TIMER2_GetMillis();
+  uint8_t tier;
+
+  for(uint8_t t = 0; t < ROLLUP_TIERS; t++)
+  {
+    if(window[t].open && now >= window[t].start_ms + tiers[t].period_ms + ROLLUP_CLOSE_DELAY_MS)
+    {
+      Close(t);
+    }
+  }
+
+  // Flash is idle, so the last program is done with its record
+  if(outbox_busy)
+  {
+    outbox_head = (outbox_head + 1) & (ROLLUP_OUTBOX_SIZE - 1);
+    outbox_count--;
+    outbox_busy = 0;
+  }
+
+  if(outbox_count == 0)
+  {
+    return 0;
+  }
+
+  tier = outbox_tier[outbox_head];
+  pos = &position[tier];
+
+  if(!pos->erased)
+  {
+    W25Q64_StartEraseSector(SlotAddr(tier, pos->sector, 0));
+    pos->erased = 1;
+    return 1;
+  }
+
+  W25Q64_StartWritePage(SlotAddr(tier, pos->sector, pos->slot), (const uint8_t*) &outbox[outbox_head],
+                        ROLLUP_SLOT_SIZE);
+  outbox_busy = 1;
+  stats.written[tier]++;
+
+  if(++pos->slot == ROLLUP_SLOTS_PER_SECTOR)
+  {
+    pos->sector = (pos->sector + 1) % tiers[tier].sectors;
+    pos->slot = 0;
+    pos->erased = 0;
+  }
+
+  return 1;
+}
+
+// Header of a rollup dump, a tier's windows are oldest first from the
+// sector after the write position. One not erased yet still holds the
+// oldest windows of the last lap, the dump starts with it.
+uint8_t Rollup_DumpBegin(uint8_t tier)
+{
+  if(tier >= ROLLUP_TIERS)
+  {
+    return 0;
+  }
+
+  dump.tier = tier;
+  dump.first = position[tier].sector;
+  if(!position[tier].erased)
+  {
+    dump.first = (dump.first + tiers[tier].sectors - 1) % tiers[tier].sectors;
+  }
+  dump.i = 0;
+  dump.slot = 0;
+  dump.count = 0;
+  return 1;
+}
+
+// One line of the dump while the TX ring has room for it, flash must be
+// idle. Returns 1 once the dump is done.
+uint8_t Rollup_DumpStep(void)
+{
+  const RollupTier_t *t = &tiers[dump.tier];
+  RollupRecord_t r;
+  uint16_t sector;
+
+  while(USART1_TxFree() >= ROLLUP_DUMP_LINE_MAX)
+  {
+    if(dump.i == 0)
+    {
+      USART1_SendString("\r\n--- ROLLUP ");
+      USART1_SendString((char*) t->name);
+      USART1_SendString(" ---\r\nSeq,StartMs,ImuCount,DsCount");
+      for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+      {
+        USART1_SendChar(',');
+        USART1_SendString((char*) Logger_ChannelName(ch));
+        USART1_SendString(" min/max/mean");
+      }
+      USART1_SendString("\r\n");
+      dump.i = 1;
+      return 0;
+    }
+
+    if(dump.i > t->sectors)
+    {
+      USART1_SendString("--- END ---\r\nTotal: ");
+      USART1_SendNumber(dump.count);
+      USART1_SendString(" windows\r\n");
+      return 1;
+    }
+
+    sector = (dump.first + dump.i) % t->sectors;
+    W25Q64_Read(SlotAddr(dump.tier, sector, dump.slot), (uint8_t*) &r, ROLLUP_SLOT_SIZE);
+
+    // A sector ends at the first erased slot
+    if(IsErased(&r) || ++dump.slot == ROLLUP_SLOTS_PER_SECTOR)
+    {
+      dump.i++;
+      dump.slot = 0;
+    }
+
+    if(IsErased(&r) || r.crc != RecordCrc(&r))
+    {
+      continue;
+    }
+
+    USART1_SendNumber(r.sequence);
+    USART1_SendChar(',');
+    USART1_SendNumber(r.start_ms);
+    USART1_SendChar(',');
+    USART1_SendNumber(r.imu_count);
+    USART1_SendChar(',');
+    USART1_SendNumber(r.ds18b20_count);
+
+    for(uint8_t ch = 0; ch < LOGGER_CHANNELS; ch++)
+    {
+      // Same digits as the log dump, empty where the channel had no values
+      if(((ch == LOGGER_CHANNEL_DS18B20) ? r.ds18b20_count : r.imu_count) == 0)
+      {
+        USART1_SendString(",,,");
+        continue;
+      }
+      USART1_SendChar(',');
+      SendInt(r.channel[ch].min);
+      USART1_SendChar(',');
+      SendInt(r.channel[ch].max);
+      USART1_SendChar(',');
+      SendInt(r.channel[ch].mean);
+    }
+    USART1_SendString("\r\n");
+    dump.count++;
+    return 0;
+  }
+
+  return 0;
+}
+
+// One more window and the outbox would drop it
+uint8_t Rollup_Urgent(void)
+{
+  return (outbox_count - outbox_busy >= ROLLUP_OUTBOX_SIZE - 1) ? 1 : 0;
+}
+
+void Rollup_GetStats(Rollup_Stats_t *stats_out)
+{
+  *stats_out = stats;
+}
@@ -6,6 +6,13 @@
  */
 
 #include "stm32f103xb.h"
+#include "spi1.h"
+
+// DMA transfer state
+static volatile uint8_t dma_busy = 0;
+static SPI1_DMA_Callback_t dma_callback = 0;
+static const uint8_t dma_dummy_tx = 0xFF;  // Clocked out when there is no TX buffer
+static uint8_t dma_dummy_rx;               // Sink when there is no RX buffer
 
 void SPI1_Init(void)
 {
@@ -39,8 +46,8 @@ void SPI1_Init(void)
   SPI1->CR1 |= SPI_CR1_SSI;
   SPI1->CR1 |= SPI_CR1_MSTR;
 
-  // 72MHz/8 - 9 MHZ
-  SPI1->CR1 |= SPI_CR1_BR_1;
+  // 72MHz/4 - 18 MHz, the SPI1 maximum in the F103 datasheet
+  SPI1->CR1 |= SPI_CR1_BR_0;
 
   // CPOL and CPHA for W25Q64
   SPI1->CR1 &= ~SPI_CR1_CPOL; // Clock idle low (0)
@@ -51,10 +58,22 @@ void SPI1_Init(void)
 
   // Enable SPI
   SPI1->CR1 |= SPI_CR1_SPE;
+
+  // DMA1 channel 2 = SPI1_RX, channel 3 = SPI1_TX
+  RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+  DMA1_Channel2->CPAR = (uint32_t) &SPI1->DR;
+  DMA1_Channel3->CPAR = (uint32_t) &SPI1->DR;
+
+  // Completion is signalled by the RX channel, the last byte is in by then
+  NVIC_SetPriority(DMA1_Channel2_IRQn, 3);
+  NVIC_EnableIRQ(DMA1_Channel2_IRQn);
 }
 
 void SPI1_CS_Low(void)
 {
+  // A DMA transfer still owns the bus, let it finish first
+  SPI1_DMA_Wait();
+
   GPIOA->BRR = GPIO_BRR_BR3;
 }
 
@@ -77,3 +96,73 @@ uint8_t SPI1_Transfer(uint8_t data)
   // Return received data
   return SPI1->DR;
 }
+
+// Start a bulk transfer and return, callback runs when the last byte is received
+void SPI1_TransferDMA(const uint8_t *tx, uint8_t *rx, uint16_t len, SPI1_DMA_Callback_t callback)
+{
+  SPI1_DMA_Wait();
+
+  if(len == 0)
+  {
+    if(callback)
+    {
+      callback();
+    }
+    return;
+  }
+
+  dma_busy = 1;
+  dma_callback = callback;
+
+  // RX channel: peripheral to memory, high priority so DR never overruns
+  DMA1_Channel2->CCR = 0;
+  DMA1_Channel2->CMAR = rx ? (uint32_t) rx : (uint32_t) &dma_dummy_rx;
+  DMA1_Channel2->CNDTR = len;
+  DMA1_Channel2->CCR = DMA_CCR_PL_1 | DMA_CCR_TCIE | (rx ? DMA_CCR_MINC : 0);
+
+  // TX channel: memory to peripheral
+  DMA1_Channel3->CCR = 0;
+  DMA1_Channel3->CMAR = tx ? (uint32_t) tx : (uint32_t) &dma_dummy_tx;
+  DMA1_Channel3->CNDTR = len;
+  DMA1_Channel3->CCR = DMA_CCR_DIR | (tx ? DMA_CCR_MINC : 0);
+
+  // Drop anything left in DR from polled transfers
+  (void) SPI1->DR;
+  DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+  // RX first, then TX starts the clock
+  DMA1_Channel2->CCR |= DMA_CCR_EN;
+  DMA1_Channel3->CCR |= DMA_CCR_EN;
+  SPI1->CR2 |= SPI_CR2_RXDMAEN;
+  SPI1->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+uint8_t SPI1_DMA_Busy(void)
+{
+  return dma_busy;
+}
+
+void SPI1_DMA_Wait(void)
+{
+  while(dma_busy);
+}
+
+// DMA1 channel 2 (SPI1_RX) transfer complete
+void DMA1_Channel2_IRQHandler(void)
+{
+  if(DMA1->ISR & DMA_ISR_TCIF2)
+  {
+    DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+
+    dma_busy = 0;
+
+    if(dma_callback)
+    {
+      dma_callback();
+    }
+  }
+}
@@ -14,9 +14,23 @@
 #include "i2c1.h"
 #include "lcd.h"
 #include "ds18b20.h"
+#include "logger.h"
+#include "recorder.h"
+#include "config.h"
+#include "timer3.h"
+#include "tasks.h"
 
 static char uart_buf[32];
 
+// Rate for the next recording, from the config block or the console
+static uint16_t record_rate = RECORDER_DEFAULT_RATE;
+
+// Settings in effect, to apply only what changed. 0xFF and 0 until the first apply.
+static uint8_t applied_accel_range = 0xFF;
+static uint8_t applied_gyro_range = 0xFF;
+static uint16_t applied_loop_ms = 0;
+static uint16_t applied_record_rate = 0;
+
 // Struct for feedback display
 typedef struct
 {
@@ -28,6 +42,19 @@ typedef struct
 
 static Feedback_t feedback = {0};
 
+// One whole debug line, so a dropped one goes missing as a whole
+static char uart_msg[64];
+
+// Copy str to uart_msg at pos as far as it fits, returns the new length
+static int AppendMsg(int pos, const char *str)
+{
+  while(*str && pos < (int) sizeof(uart_msg))
+  {
+    uart_msg[pos++] = *str++;
+  }
+  return pos;
+}
+
 // Show a message on LCD for specified duration
 void Feedback_Show(const char *line1, const char *line2, uint16_t duration_ms)
 {
@@ -60,12 +87,19 @@ void Feedback_Show(const char *line1, const char *line2, uint16_t duration_ms)
   LCD_SetCursor(1, 0);
   LCD_SendString(feedback.line2);
 
-  // Optional: Also send to UART for debugging
-  USART1_SendString("Feedback: ");
-  USART1_SendString(line1);
-  USART1_SendString(" - ");
-  USART1_SendString(line2);
-  USART1_SendString("\r\n");
+  // A dump owns the UART until it is done
+  if(Logger_IsDumping())
+  {
+    return;
+  }
+
+  // Optional: Also send to UART for debugging, dropped rather than waited for
+  i = AppendMsg(0, "Feedback: ");
+  i = AppendMsg(i, line1);
+  i = AppendMsg(i, " - ");
+  i = AppendMsg(i, line2);
+  i = AppendMsg(i, "\r\n");
+  USART1_TryWrite((const uint8_t*) uart_msg, i, USART1_TX_DROP);
 }
 
 // Check if feedback time has expired
@@ -100,6 +134,12 @@ void Task_UART_Output(void)
 {
   DisplayMode_t mode = Button_GetMode();
 
+  // Telemetry would run into the lines of a dump
+  if(Logger_IsDumping())
+  {
+    return;
+  }
+
   switch(mode)
   {
     case DISPLAY_MODE_TEMP_HUM:
@@ -118,7 +158,8 @@ void Task_UART_Output(void)
       return;
   }
 
-  USART1_SendString(uart_buf);
+  // Stale readings are worth nothing, a newer line replaces one still waiting
+  USART1_TrySend(uart_buf, USART1_TX_LATEST);
 }
 
 // Task to read DS18b20 sensor
@@ -137,6 +178,9 @@ void Task_DS18B20_Read(void)
     ds18b20_data.valid = 0;
   }
 
+  // Every conversion goes into the log
+  Logger_SaveTemperature();
+
   // Immediately start next conversion
   DS18B20_StartConversion();
 }
@@ -144,9 +188,13 @@ void Task_DS18B20_Read(void)
 // Task to read MPU6050 sensor
 void Task_MPU6050_Read(void)
 {
+  // The recorder owns the MPU6050 and logs every sample itself
+  if(Recorder_IsRunning()) return;
+
   if(MPU6050_ReadAll() == I2C_OK)
   {
     MPU6050_ScaleAll();
+    Logger_SaveIMU();
   }
 }
 
@@ -174,3 +222,133 @@ void Task_LCD_Update(void)
       break;
   }
 }
+
+// Start or stop a continuous recording of the MPU6050
+void Task_Recorder_Toggle(void)
+{
+  Recorder_Stats_t stats;
+  char line[16];
+
+  if(Recorder_IsRunning())
+  {
+    Recorder_Stop();
+    if(!Logger_IsDumping())
+    {
+      Recorder_Report();
+    }
+    Feedback_Show("Recorder", "STOPPED", 1000);
+
+    // Range changes wait for the end of a recording
+    Task_Config_Apply();
+    return;
+  }
+
+  // Samples would only be thrown away
+  if(Logger_IsErasing())
+  {
+    Feedback_Show("Recorder", "LOG ERASING", 1000);
+    return;
+  }
+
+  if(Logger_IsFull())
+  {
+    Feedback_Show("Recorder", "LOG FULL", 1000);
+    return;
+  }
+
+  if(!Recorder_Start(record_rate))
+  {
+    Feedback_Show("Recorder", "MPU6050 ERROR", 1000);
+    return;
+  }
+
+  Recorder_GetStats(&stats);
+  itoa_16((int16_t) stats.rate, line);
+  Feedback_Show("Recording", line, 1000);
+}
+
+// Settings from the config block into the modules, at boot and after a
+// change. New sensor ranges go into the log, the raw values after them
+// read differently.
+void Task_Config_Apply(void)
+{
+  const Config_t *cfg = Config_Get();
+
+  if(cfg->record_rate != applied_record_rate)
+  {
+    record_rate = cfg->record_rate;
+    applied_record_rate = cfg->record_rate;
+  }
+
+  if(cfg->loop_ms != applied_loop_ms)
+  {
+    TIMER3_SetupPeriod(cfg->loop_ms);
+    applied_loop_ms = cfg->loop_ms;
+  }
+
+  if(cfg->log_mode != Logger_GetMode())
+  {
+    Logger_SetMode((LoggerMode_t) cfg->log_mode);
+  }
+
+  // Samples already in the FIFO were taken with the old range
+  if(Recorder_IsRunning())
+  {
+    return;
+  }
+
+  if(cfg->accel_range != applied_accel_range || cfg->gyro_range != applied_gyro_range)
+  {
+    if(MPU6050_SetRange(cfg->accel_range, cfg->gyro_range) == I2C_OK)
+    {
+      applied_accel_range = cfg->accel_range;
+      applied_gyro_range = cfg->gyro_range;
+      Logger_SaveConfig(LOGGER_CONFIG_ACCEL_RANGE, applied_accel_range);
+      Logger_SaveConfig(LOGGER_CONFIG_GYRO_RANGE, applied_gyro_range);
+    }
+  }
+}
+
+// Rate of the next recording, until the config block is applied again
+void Task_Recorder_SetRate(uint16_t rate_hz)
+{
+  record_rate = (rate_hz < RECORDER_MAX_RATE) ? rate_hz : RECORDER_MAX_RATE;
+}
+
+// What the UART output policies cost so far
+void Task_UART_Report(void)
+{
+  USART1_Stats_t st;
+
+  USART1_GetStats(&st);
+  USART1_SendString("UART: ");
+  USART1_SendNumber(st.dropped);
+  USART1_SendString(" bytes dropped, ");
+  USART1_SendNumber(st.overwritten);
+  USART1_SendString(" telemetry bytes replaced, ");
+  USART1_SendNumber(st.waits);
+  USART1_SendString(" waits for room, ");
+  USART1_SendNumber(st.rx_lost);
+  USART1_SendString(" received bytes lost\r\n");
+}
+
+// Set one setting, save the config block and apply it
+uint8_t Task_Config_Set(ConfigKey_t key, uint32_t value)
+{
+  if(key >= CONFIG_KEYS || !Config_Set(key, value))
+  {
+    USART1_SendString("ERR bad value\r\n");
+    return 0;
+  }
+
+  // The config sectors are programmed with the log idle
+  Logger_Flush();
+  if(!Config_Save())
+  {
+    USART1_SendString("ERR config save failed\r\n");
+  }
+
+  Task_Config_Apply();
+  Config_Report();
+  return 1;
+}
@@ -7,9 +7,14 @@
 
 #include "stm32f103xb.h"
 #include "uart.h"
+#include <string.h>
 
-#define USART1_RX_BUF_SIZE 64
-#define USART1_TX_BUF_SIZE 256
+// Powers of two, indices are masked instead of taken modulo
+#define USART1_RX_BUF_SIZE 256
+#define USART1_TX_BUF_SIZE 512
+
+// RX and TX interrupts, equal so the two RX ones never preempt each other
+#define USART1_IRQ_PRIORITY 1
 
 /* Global buffer instances */
 static uint8_t USART1_rxbuf_storage[USART1_RX_BUF_SIZE];
@@ -17,6 +22,64 @@ static uint8_t USART1_txbuf_storage[USART1_TX_BUF_SIZE];
 volatile USART1_Buffer_t usart1_rx_buf;
 volatile USART1_Buffer_t usart1_tx_buf;
 
+// Bytes of the TX ring DMA is sending, they stay in the ring until it is done. 0 = idle.
+static volatile uint16_t tx_dma_len = 0;
+
+// Newest USART1_TX_LATEST message that didn't fit, USART1_Task sends it
+#define USART1_LATEST_SIZE 64
+static uint8_t tx_latest[USART1_LATEST_SIZE];
+static uint16_t tx_latest_len = 0;
+
+static USART1_Stats_t tx_stats;
+
+// Where RX DMA wrote up to when the head was last moved
+static volatile uint16_t rx_dma_pos = 0;
+
+// Publish what RX DMA wrote since the last call as the head of the RX ring.
+// Runs on the IDLE line and on half and full transfers, so it never falls
+// a whole ring behind.
+static void USART1_RxUpdate(void)
+{
+  uint16_t pos = (usart1_rx_buf.mask + 1 - DMA1_Channel5->CNDTR) & usart1_rx_buf.mask;
+
+  usart1_rx_buf.head = usart1_rx_buf.head + ((pos - rx_dma_pos) & usart1_rx_buf.mask);
+  rx_dma_pos = pos;
+}
+
+// Send the bytes from the tail up to the head or the end of the ring in one
+// DMA transfer. Runs in the main loop and in the DMA interrupt, but never in
+// both at once: the interrupt only comes while a transfer is running, and
+// the main loop only starts one while none is.
+static void USART1_TxStart(void)
+{
+  uint16_t tail, index, len;
+
+  // The tail only moves while a transfer is running, read it after this
+  if(tx_dma_len != 0)
+  {
+    return;
+  }
+
+  tail = usart1_tx_buf.tail;
+  index = tail & usart1_tx_buf.mask;
+  len = (uint16_t) (usart1_tx_buf.head - tail);
+  if(len == 0)
+  {
+    return;
+  }
+
+  if(len > usart1_tx_buf.mask + 1 - index)
+  {
+    len = usart1_tx_buf.mask + 1 - index;
+  }
+  tx_dma_len = len;
+
+  DMA1_Channel4->CCR = 0;
+  DMA1_Channel4->CMAR = (uint32_t) &usart1_tx_buf.buffer[index];
+  DMA1_Channel4->CNDTR = len;
+  DMA1_Channel4->CCR = DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_EN;
+}
+
 void USART1_Init(void)
 {
   // Enable clocks
@@ -43,92 +106,236 @@ void USART1_Init(void)
   UART1_BufferInit(&usart1_rx_buf, USART1_rxbuf_storage, USART1_RX_BUF_SIZE);
   UART1_BufferInit(&usart1_tx_buf, USART1_txbuf_storage, USART1_TX_BUF_SIZE);
 
-  // Configure USART
-  USART1->CR1 = USART_CR1_RE | USART_CR1_TE | USART_CR1_RXNEIE | USART_CR1_UE;
+  // DMA1 channel 4 = USART1_TX, one transfer per contiguous piece of the TX ring
+  RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+  DMA1_Channel4->CCR = 0;
+  DMA1_Channel4->CPAR = (uint32_t) &USART1->DR;
+  tx_dma_len = 0;
+
+  // DMA1 channel 5 = USART1_RX, circular over the RX ring, no interrupt per byte
+  DMA1_Channel5->CCR = 0;
+  DMA1_Channel5->CPAR = (uint32_t) &USART1->DR;
+  DMA1_Channel5->CMAR = (uint32_t) USART1_rxbuf_storage;
+  DMA1_Channel5->CNDTR = USART1_RX_BUF_SIZE;
+  DMA1_Channel5->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+  rx_dma_pos = 0;
+
+  // Configure USART, TXE and RXNE requests go to DMA, IDLE ends a burst
+  USART1->CR3 = USART_CR3_DMAT | USART_CR3_DMAR;
+  USART1->CR1 = USART_CR1_RE | USART_CR1_TE | USART_CR1_IDLEIE | USART_CR1_UE;
 
   // Enable interrupt in NVIC
+  NVIC_SetPriority(USART1_IRQn, USART1_IRQ_PRIORITY);
+  NVIC_SetPriority(DMA1_Channel4_IRQn, USART1_IRQ_PRIORITY);
+  NVIC_SetPriority(DMA1_Channel5_IRQn, USART1_IRQ_PRIORITY);
   NVIC_EnableIRQ(USART1_IRQn);
+  NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  NVIC_EnableIRQ(DMA1_Channel5_IRQn);
 }
 
+// size must be a power of two
 void UART1_BufferInit(volatile USART1_Buffer_t *buff, uint8_t *storage, uint16_t size)
 {
   buff->buffer = storage;
-  buff->size = size;
+  buff->mask = size - 1;
   buff->head = 0;
   buff->tail = 0;
-  buff->count = 0;
+}
+
+// Bytes in the buffer, head and tail run freely and wrap together
+uint16_t USART1_BufferCount(volatile USART1_Buffer_t *buff)
+{
+  return (uint16_t) (buff->head - buff->tail);
 }
 
 bool USART1_BufferEmpty(volatile USART1_Buffer_t *buff)
 {
-  return (buff->count == 0);
+  return (buff->head == buff->tail);
 }
 
 // Check if buffer is full
 bool USART1_BufferFull(volatile USART1_Buffer_t *buff)
 {
-  return (buff->count >= buff->size);
+  return (USART1_BufferCount(buff) > buff->mask);
 }
 
-// Write to ANY buffer (TX or RX)
+// Write to ANY buffer (TX or RX), only from its one producer
 bool USART1_BufferWrite(volatile USART1_Buffer_t *buff, uint8_t data)
 {
-  __disable_irq();
+  uint16_t head = buff->head;
 
-  if(USART1_BufferFull(buff))
+  if((uint16_t) (head - buff->tail) > buff->mask)
   {
-    __enable_irq();
     return false;  // Buffer full
   }
 
-  buff->buffer[buff->head] = data;
-  buff->head = (buff->head + 1) % buff->size;
-  buff->count++;
+  buff->buffer[head & buff->mask] = data;
+
+  // The byte has to be in memory before the consumer sees the new head
+  __DMB();
+  buff->head = head + 1;
 
-  __enable_irq();
   return true;
 }
 
-// Read from ANY buffer 
+// Read from ANY buffer, only from its one consumer
 uint8_t USART1_BufferRead(volatile USART1_Buffer_t *buff)
 {
-  uint8_t data = 0;
-
-  __disable_irq();
+  uint16_t tail = buff->tail;
+  uint8_t data;
 
-  if(!USART1_BufferEmpty(buff))
+  if(tail == buff->head)
   {
-    data = buff->buffer[buff->tail];
-    buff->tail = (buff->tail + 1) % buff->size;
-    buff->count--;
+    return 0;
   }
 
-  __enable_irq();
+  data = buff->buffer[tail & buff->mask];
+
+  // Read the byte before the producer may reuse its slot
+  __DMB();
+  buff->tail = tail + 1;
+
   return data;
 }
 
 void USART1_SendChar(char c)
 {
-  // Wait if TX buffer is full
-  while(USART1_BufferFull(&usart1_tx_buf));
+  // Wait if TX buffer is full, DMA frees it
+  if(!USART1_BufferWrite(&usart1_tx_buf, (uint8_t) c))
+  {
+    tx_stats.waits++;
+    while(!USART1_BufferWrite(&usart1_tx_buf, (uint8_t) c));
+  }
+
+  // DMA picks up the next piece by itself while a transfer is running
+  USART1_TxStart();
+}
+
+// Copy len bytes into the TX ring, whole spans at a time. Waits for room.
+void USART1_Write(const uint8_t *buf, uint16_t len)
+{
+  uint16_t size = usart1_tx_buf.mask + 1;
+  uint16_t head, index, n;
+  uint8_t waited = 0;
+
+  while(len > 0)
+  {
+    head = usart1_tx_buf.head;
+    index = head & usart1_tx_buf.mask;
+
+    // Free space up to the end of the ring
+    n = size - (uint16_t) (head - usart1_tx_buf.tail);
+    if(n > size - index)
+    {
+      n = size - index;
+    }
+    if(n > len)
+    {
+      n = len;
+    }
 
-  __disable_irq();
+    // Ring full, wait for DMA
+    if(n == 0)
+    {
+      if(!waited)
+      {
+        waited = 1;
+        tx_stats.waits++;
+      }
+      continue;
+    }
 
-  // Write to TX buffer
-  USART1_BufferWrite(&usart1_tx_buf, (uint8_t) c);
+    memcpy(&usart1_tx_buf.buffer[index], buf, n);
+    __DMB();
+    usart1_tx_buf.head = head + n;
 
-  // ALWAYS enable TX interrupt (let handler disable when done)
-  USART1->CR1 |= USART_CR1_TXEIE;
+    USART1_TxStart();
 
-  __enable_irq();
+    buf += n;
+    len -= n;
+  }
 }
 
 // Send a string
 void USART1_SendString(char *str)
 {
-  while(*str)
+  USART1_Write((const uint8_t*) str, strlen(str));
+}
+
+// Free bytes in the TX ring
+uint16_t USART1_TxFree(void)
+{
+  return usart1_tx_buf.mask + 1 - USART1_BufferCount(&usart1_tx_buf);
+}
+
+// Queue a whole message under a policy, never waits unless it is
+// USART1_TX_BLOCK. Returns 0 if the message was dropped.
+uint8_t USART1_TryWrite(const uint8_t *buf, uint16_t len, USART1_TxPolicy_t policy)
+{
+  if(policy == USART1_TX_BLOCK)
+  {
+    USART1_Write(buf, len);
+    return 1;
+  }
+
+  // Telemetry held back earlier goes out first if it fits now
+  USART1_Task();
+
+  // Held back telemetry stays older than the next one
+  if(len <= USART1_TxFree() && (policy == USART1_TX_DROP || tx_latest_len == 0))
+  {
+    USART1_Write(buf, len);
+    return 1;
+  }
+
+  if(policy == USART1_TX_LATEST && len <= USART1_LATEST_SIZE)
+  {
+    tx_stats.overwritten += tx_latest_len;
+    memcpy(tx_latest, buf, len);
+    tx_latest_len = len;
+    return 1;
+  }
+
+  tx_stats.dropped += len;
+  return 0;
+}
+
+uint8_t USART1_TrySend(const char *str, USART1_TxPolicy_t policy)
+{
+  return USART1_TryWrite((const uint8_t*) str, strlen(str), policy);
+}
+
+// Call from the main loop, sends held back telemetry once there is room
+void USART1_Task(void)
+{
+  if(tx_latest_len != 0 && tx_latest_len <= USART1_TxFree())
+  {
+    USART1_Write(tx_latest, tx_latest_len);
+    tx_latest_len = 0;
+  }
+}
+
+void USART1_GetStats(USART1_Stats_t *stats)
+{
+  *stats = tx_stats;
+}
+
+// RX DMA doesn't wait for the reader. If it went round the ring past the
+// tail, the oldest bytes are gone. Bytes it wrote since the head last moved
+// count too. Head is read before the DMA position, an interrupt between the
+// two only makes the check late.
+static void USART1_RxCheckOverrun(void)
+{
+  uint16_t size = usart1_rx_buf.mask + 1;
+  uint16_t head = usart1_rx_buf.head;
+  uint16_t pos = rx_dma_pos;
+  uint16_t pending = (size - DMA1_Channel5->CNDTR - pos) & usart1_rx_buf.mask;
+  uint16_t count = head - usart1_rx_buf.tail + pending;
+
+  if(count > size)
   {
-    USART1_SendChar(*str++);
+    tx_stats.rx_lost += count - size;
+    usart1_rx_buf.tail = head + pending - size;
   }
 }
 
@@ -141,59 +348,60 @@ bool USART1_DataAvailable(void)
 // Get a character from RX buffer
 uint8_t USART1_GetChar(void)
 {
+  USART1_RxCheckOverrun();
   return USART1_BufferRead(&usart1_rx_buf);
 }
 
 // Send a 32-bit number as ASCII string via UART
 void USART1_SendNumber(uint32_t num)
 {
-  char buffer[16];
-  int i = 0;
-
-  // Handle 0 separately
-  if(num == 0)
-  {
-    USART1_SendChar('0');
-    return;
-  }
+  char buffer[10];
+  int i = sizeof(buffer);
 
-  // Convert number to string (reverse order)
-  while(num > 0)
+  // Convert number to string, last digit first
+  do
   {
-    buffer[i++] = '0' + (num % 10);
+    buffer[--i] = '0' + (num % 10);
     num /= 10;
-  }
+  } while(num > 0);
 
-  // Send in correct order
-  while(i > 0)
+  USART1_Write((const uint8_t*) &buffer[i], sizeof(buffer) - i);
+}
+
+// Line went idle after a burst, whatever DMA received is ready to read
+void USART1_IRQHandler(void)
+{
+  if(USART1->SR & USART_SR_IDLE)
   {
-    USART1_SendChar(buffer[--i]);
+    // Reading SR then DR clears IDLE, DMA has already taken the data
+    (void) USART1->DR;
+    USART1_RxUpdate();
   }
 }
 
-void USART1_IRQHandler(void)
+// DMA1 channel 5 (USART1_RX) half and full transfer, a long burst is
+// published every half ring
+void DMA1_Channel5_IRQHandler(void)
 {
-  // Handle received data - WRITE to RX buffer
-  if(USART1->SR & USART_SR_RXNE)
+  if(DMA1->ISR & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5))
   {
-    uint8_t data = USART1->DR;
-    // Write to RX buffer (ignore if full - data lost)
-    USART1_BufferWrite(&usart1_rx_buf, data);
+    DMA1->IFCR = DMA_IFCR_CGIF5;
+    USART1_RxUpdate();
   }
+}
 
-  // Handle transmit - READ from TX buffer
-  if((USART1->CR1 & USART_CR1_TXEIE) && (USART1->SR & USART_SR_TXE))
+// DMA1 channel 4 (USART1_TX) transfer complete, free the piece that was sent
+// and chain the next one. Bytes written meanwhile are already waiting.
+void DMA1_Channel4_IRQHandler(void)
+{
+  if(DMA1->ISR & DMA_ISR_TCIF4)
   {
-    if(!USART1_BufferEmpty(&usart1_tx_buf))
-    {
-      // Read from TX buffer and send
-      USART1->DR = USART1_BufferRead(&usart1_tx_buf);
-    }
+    DMA1->IFCR = DMA_IFCR_CGIF4;
+    DMA1_Channel4->CCR &= ~DMA_CCR_EN;
 
-    // Disable TX interrupt if buffer is empty
-    if(USART1_BufferEmpty(&usart1_tx_buf))
-    {
-      USART1->CR1 &= ~USART_CR1_TXEIE;
-    }
+    usart1_tx_buf.tail = usart1_tx_buf.tail + tx_dma_len;
+    tx_dma_len = 0;
+
+    USART1_TxStart();
   }
 }
@@ -11,6 +11,20 @@
 #include "lcd.h"
 #include "uart.h"
 
+// Shorter transfers are cheaper to poll than to set up DMA for
+#define W25Q64_DMA_MIN_LEN  16
+
+// Erase issued by a Start function and not seen finished yet, only such an
+// erase is ever suspended
+static uint8_t erasing = 0;
+static uint8_t suspended = 0;
+
+// End of a DMA data phase, runs in the DMA interrupt
+static void W25Q64_DMA_Done(void)
+{
+  SPI1_CS_High();
+}
+
 uint8_t W25Q64_ReadID(void)
 {
   uint8_t id;
@@ -61,6 +75,16 @@ void W25Q64_Init(void)
     USART1_SendString(hex);
     USART1_SendString("\r\n");
   }
+
+  // An MCU reset can leave an erase suspended, the chip then takes no other
+  // erase. Let it finish.
+  if(W25Q64_ReadStatus2() & W25Q64_SR2_SUS)
+  {
+    erasing = 1;
+    suspended = 1;
+    W25Q64_ResumeErase();
+    W25Q64_WaitBusy();
+  }
 }
 
 uint8_t W25Q64_ReadStatus(void)
@@ -78,10 +102,100 @@ uint8_t W25Q64_ReadStatus(void)
   return status;
 }
 
+uint8_t W25Q64_ReadStatus2(void)
+{
+  uint8_t status;
+
+  SPI1_CS_Low();
+  DWT_Delay_us(10);
+
+  SPI1_Transfer(W25Q64_CMD_READ_STATUS2);
+  status = SPI1_Transfer(0xFF);
+
+  SPI1_CS_High();
+
+  return status;
+}
+
 void W25Q64_WaitBusy(void)
 {
-  // Wait until BUSY bit clears
+  // Wait until BUSY bit clears, status reads wait for any DMA transfer first
+  while(W25Q64_ReadStatus() & W25Q64_SR_BUSY);
+
+  // BUSY is also clear while an erase is suspended
+  if(!suspended)
+  {
+    erasing = 0;
+  }
+}
+
+// Check BUSY once without waiting, a running DMA transfer counts as busy
+uint8_t W25Q64_IsBusy(void)
+{
+  if(SPI1_DMA_Busy())
+  {
+    return 1;
+  }
+
+  if(W25Q64_ReadStatus() & W25Q64_SR_BUSY)
+  {
+    return 1;
+  }
+
+  if(!suspended)
+  {
+    erasing = 0;
+  }
+  return 0;
+}
+
+// Suspend a running erase, the chip is ready for reads and programs within
+// tSUS (20us). Returns 0 with nothing sent if no erase is running.
+uint8_t W25Q64_SuspendErase(void)
+{
+  if(!erasing || suspended || W25Q64_IsBusy() == 0)
+  {
+    return 0;
+  }
+
+  SPI1_CS_Low();
+  SPI1_Transfer(W25Q64_CMD_SUSPEND);
+  SPI1_CS_High();
+
   while(W25Q64_ReadStatus() & W25Q64_SR_BUSY);
+
+  // Erase may have completed before the command got there
+  if(!(W25Q64_ReadStatus2() & W25Q64_SR2_SUS))
+  {
+    erasing = 0;
+    return 0;
+  }
+
+  suspended = 1;
+  return 1;
+}
+
+// Let a suspended erase go on, the chip is busy again afterwards
+void W25Q64_ResumeErase(void)
+{
+  if(!suspended)
+  {
+    return;
+  }
+
+  // A program issued during the suspend has to finish first
+  while(W25Q64_ReadStatus() & W25Q64_SR_BUSY);
+
+  SPI1_CS_Low();
+  SPI1_Transfer(W25Q64_CMD_RESUME);
+  SPI1_CS_High();
+
+  suspended = 0;
+}
+
+uint8_t W25Q64_IsSuspended(void)
+{
+  return suspended;
 }
 
 void W25Q64_WriteEnable(void)
@@ -100,31 +214,97 @@ void W25Q64_WriteDisable(void)
 
 void W25Q64_Read(uint32_t addr, uint8_t *buf, uint32_t len)
 {
-  uint32_t i;
+  W25Q64_ReadBegin(addr);
+  W25Q64_ReadStream(buf, len);
+  W25Q64_ReadEnd();
+}
+
+// Start a DMA read and return, buf is valid once W25Q64_TransferDone() returns 1
+void W25Q64_StartRead(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  W25Q64_ReadBegin(addr);
+
+  // Data phase on DMA, CS goes high in the completion interrupt
+  SPI1_TransferDMA(0, buf, len, W25Q64_DMA_Done);
+}
 
+// Open a Fast Read at addr and leave CS low. Data is then pulled with
+// W25Q64_ReadStream / W25Q64_StartReadStream until W25Q64_ReadEnd().
+void W25Q64_ReadBegin(uint32_t addr)
+{
   SPI1_CS_Low();
 
-  // Send read command
-  SPI1_Transfer(W25Q64_CMD_READ_DATA);
+  // Send fast read command
+  SPI1_Transfer(W25Q64_CMD_FAST_READ);
 
   // Send 24-bit address (MSB first)
   SPI1_Transfer((addr >> 16) & 0xFF);
   SPI1_Transfer((addr >> 8) & 0xFF);
   SPI1_Transfer(addr & 0xFF);
 
-  // Read data
-  for(i = 0; i < len; i++)
+  // Fast Read needs one dummy byte before data
+  SPI1_Transfer(0xFF);
+}
+
+// Read the next len bytes of an open read, blocking
+void W25Q64_ReadStream(uint8_t *buf, uint32_t len)
+{
+  uint32_t chunk;
+
+  // Short reads are cheaper to poll than to set up DMA for
+  if(len < W25Q64_DMA_MIN_LEN)
   {
-    buf[i] = SPI1_Transfer(0xFF);
+    for(uint32_t i = 0; i < len; i++)
+    {
+      buf[i] = SPI1_Transfer(0xFF);
+    }
+    return;
   }
 
+  // One DMA transfer moves at most 65535 bytes
+  while(len > 0)
+  {
+    chunk = (len > 0xFFFF) ? 0xFFFF : len;
+    SPI1_TransferDMA(0, buf, chunk, 0);
+    SPI1_DMA_Wait();
+
+    buf += chunk;
+    len -= chunk;
+  }
+}
+
+// Start reading the next len bytes of an open read on DMA and return,
+// buf is valid once W25Q64_TransferDone() returns 1. len is at most 65535.
+void W25Q64_StartReadStream(uint8_t *buf, uint32_t len)
+{
+  SPI1_TransferDMA(0, buf, len, 0);
+}
+
+// Close an open read
+void W25Q64_ReadEnd(void)
+{
+  SPI1_DMA_Wait();
   SPI1_CS_High();
 }
 
+// 1 once the last DMA transfer has finished
+uint8_t W25Q64_TransferDone(void)
+{
+  return !SPI1_DMA_Busy();
+}
+
 void W25Q64_WritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
 {
-  uint32_t i;
+  W25Q64_StartWritePage(addr, buf, len);
 
+  // Wait for programming to complete
+  W25Q64_WaitBusy();
+}
+
+// Send a page program with the data on DMA and return. buf must stay untouched
+// until the transfer is done, the chip is busy programming after that.
+void W25Q64_StartWritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
   // Can't write more than one page
   if(len > W25Q64_PAGE_SIZE)
   {
@@ -137,8 +317,9 @@ void W25Q64_WritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
     len = W25Q64_PAGE_SIZE - (addr & 0xFF);
   }
 
-  W25Q64_WriteEnable();
+  // Write enable is ignored while a previous program or erase is running
   W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
 
   SPI1_CS_Low();
 
@@ -150,16 +331,8 @@ void W25Q64_WritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
   SPI1_Transfer((addr >> 8) & 0xFF);
   SPI1_Transfer(addr & 0xFF);
 
-  // Write data
-  for(i = 0; i < len; i++)
-  {
-    SPI1_Transfer(buf[i]);
-  }
-
-  SPI1_CS_High();
-
-  // Wait for programming to complete
-  W25Q64_WaitBusy();
+  // Write data, CS goes high in the completion interrupt
+  SPI1_TransferDMA(buf, 0, len, W25Q64_DMA_Done);
 }
 
 void W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len)
@@ -192,63 +365,88 @@ void W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len)
 
 void W25Q64_EraseSector(uint32_t addr)
 {
-  W25Q64_WriteEnable();
+  W25Q64_StartEraseSector(addr);
+
+  W25Q64_WaitBusy();  // Wait for erase to complete
+}
+
+void W25Q64_EraseBlock32K(uint32_t addr)
+{
+  W25Q64_StartEraseBlock32K(addr);
+
   W25Q64_WaitBusy();
+}
 
-  SPI1_CS_Low();
+void W25Q64_EraseBlock64K(uint32_t addr)
+{
+  W25Q64_StartEraseBlock64K(addr);
 
-  SPI1_Transfer(W25Q64_CMD_SECTOR_ERASE);
-  SPI1_Transfer((addr >> 16) & 0xFF);
-  SPI1_Transfer((addr >> 8) & 0xFF);
-  SPI1_Transfer(addr & 0xFF);
+  W25Q64_WaitBusy();
+}
+
+void W25Q64_EraseChip(void)
+{
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
 
+  SPI1_CS_Low();
+  SPI1_Transfer(W25Q64_CMD_CHIP_ERASE);
   SPI1_CS_High();
 
-  W25Q64_WaitBusy();  // Wait for erase to complete
+  W25Q64_WaitBusy();  // This takes several seconds!
 }
 
-void W25Q64_EraseBlock32K(uint32_t addr)
+// Issue sector erase and return, the chip stays busy for up to 400ms
+void W25Q64_StartEraseSector(uint32_t addr)
 {
-  W25Q64_WriteEnable();
+  W25Q64_ResumeErase();
   W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
 
   SPI1_CS_Low();
 
-  SPI1_Transfer(W25Q64_CMD_BLOCK_ERASE_32K);
+  SPI1_Transfer(W25Q64_CMD_SECTOR_ERASE);
   SPI1_Transfer((addr >> 16) & 0xFF);
   SPI1_Transfer((addr >> 8) & 0xFF);
   SPI1_Transfer(addr & 0xFF);
 
   SPI1_CS_High();
-
-  W25Q64_WaitBusy();
+  erasing = 1;
 }
 
-void W25Q64_EraseBlock64K(uint32_t addr)
+// Issue 32KB block erase and return, the chip stays busy for up to 1.6s
+void W25Q64_StartEraseBlock32K(uint32_t addr)
 {
-  W25Q64_WriteEnable();
+  W25Q64_ResumeErase();
   W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
 
   SPI1_CS_Low();
 
-  SPI1_Transfer(W25Q64_CMD_BLOCK_ERASE_64K);
+  SPI1_Transfer(W25Q64_CMD_BLOCK_ERASE_32K);
   SPI1_Transfer((addr >> 16) & 0xFF);
   SPI1_Transfer((addr >> 8) & 0xFF);
   SPI1_Transfer(addr & 0xFF);
 
   SPI1_CS_High();
-
-  W25Q64_WaitBusy();
+  erasing = 1;
 }
 
-void W25Q64_EraseChip(void)
+// Issue 64KB block erase and return, the chip stays busy for up to 2s
+void W25Q64_StartEraseBlock64K(uint32_t addr)
 {
-  W25Q64_WriteEnable();
+  W25Q64_ResumeErase();
   W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
 
   SPI1_CS_Low();
-  SPI1_Transfer(W25Q64_CMD_CHIP_ERASE);
-  SPI1_CS_High();
 
-  W25Q64_WaitBusy();  // This takes several seconds!
+  SPI1_Transfer(W25Q64_CMD_BLOCK_ERASE_64K);
+  SPI1_Transfer((addr >> 16) & 0xFF);
+  SPI1_Transfer((addr >> 8) & 0xFF);
+  SPI1_Transfer(addr & 0xFF);
+
+  SPI1_CS_High();
+  erasing = 1;
 }
@@ -0,0 +1,167 @@
+/*
+ * codecbench.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Compression ratio and speed of the log page codec (Src/logcodec.c) on
+ * the synthetic sensor signals, IMU records with a DS18B20 record after
+ * every 100th. Pages are filled exactly like the logger does, 166 bytes
+ * after the sector header and zone map and 256 bytes in the other pages,
+ * and decoded back to check the round trip. Every page ends in a
+ * checkpoint like a full page the logger programs. Sizes are per MPU6050
+ * sample.
+ *
+ * Usage:
+ *   codecbench [-n samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hostsim.h"
+#include "logcodec.h"
+
+#define BENCH_PAGE_SIZE     256
+#define BENCH_HEADER_SIZE   90                          // Sector header and zone map
+#define BENCH_PAGES         (1758 * 16)                 // Log area, sectors 1..1758
+#define BENCH_RAW_SIZE      18                          // Uncompressed entry of format version 1, both sensors
+#define BENCH_RAW_ENTRIES   (1758 * ((4096 - 16) / 18)) // 226 per sector
+
+static double Now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int SameRecord(const LogRecord_t *a, const LogRecord_t *b)
+{
+  if(a->type != b->type || a->timestamp != b->timestamp)
+  {
+    return 0;
+  }
+
+  if(a->type == LOG_RECORD_DS18B20)
+  {
+    return a->ds18b20_temp == b->ds18b20_temp;
+  }
+
+  return a->imu.mpu_temp == b->imu.mpu_temp && a->imu.accel_x == b->imu.accel_x && a->imu.accel_y == b->imu.accel_y
+         && a->imu.accel_z == b->imu.accel_z && a->imu.gyro_x == b->imu.gyro_x && a->imu.gyro_y == b->imu.gyro_y
+         && a->imu.gyro_z == b->imu.gyro_z;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t samples = 1000000;
+  LogRecord_t *in;
+  LogRecord_t out;
+  uint32_t records;
+  uint8_t *pages;
+  uint32_t *page_start;
+  LogCodec_t c;
+  uint32_t page_count;
+  uint32_t n;
+  uint32_t bad;
+  uint16_t good;
+  uint64_t bytes;
+  double t_enc, t_dec;
+
+  if(argc == 3 && !strcmp(argv[1], "-n"))
+  {
+    samples = strtoul(argv[2], 0, 0);
+  }
+  else if(argc != 1)
+  {
+    fprintf(stderr, "Usage: codecbench [-n samples]\n");
+    return 2;
+  }
+
+  records = samples + samples / HOSTSIM_TEMP_EVERY;
+  in = malloc(records * sizeof(LogRecord_t));
+  pages = malloc((size_t) records * BENCH_PAGE_SIZE);  // One page per record is the worst case
+  page_start = malloc(records * sizeof(uint32_t));
+  if(!in || !pages || !page_start)
+  {
+    perror("malloc");
+    return 1;
+  }
+
+  printf("%-10s %8s %7s %10s %8s %12s %12s\n", "signal", "B/sample", "ratio", "samples", "vs raw", "encode ns",
+         "decode ns");
+
+  for(HostSim_Signal_t sig = 0; sig < HOSTSIM_SIGNAL_COUNT; sig++)
+  {
+    n = 0;
+    for(uint32_t i = 0; i < samples; i++)
+    {
+      HostSim_Signal(sig, i, &in[n++]);
+      if(i % HOSTSIM_TEMP_EVERY == HOSTSIM_TEMP_EVERY - 1)
+      {
+        HostSim_Temperature(sig, i, &in[n++]);
+      }
+    }
+    memset(pages, 0xFF, (size_t) records * BENCH_PAGE_SIZE);
+
+    // Encode, a new page whenever the current one is full
+    t_enc = Now();
+    page_count = 0;
+    n = 0;
+    while(n < records)
+    {
+      uint16_t offset = (page_count % 16 == 0) ? BENCH_HEADER_SIZE : 0;
+
+      page_start[page_count] = n;
+      LogCodec_Begin(&c, pages + (size_t) page_count * BENCH_PAGE_SIZE + offset, BENCH_PAGE_SIZE - offset);
+      while(n < records && LogCodec_Put(&c, &in[n]))
+      {
+        n++;
+      }
+      LogCodec_Check(&c);
+      page_count++;
+    }
+    t_enc = Now() - t_enc;
+
+    // Decode and compare
+    t_dec = Now();
+    bad = 0;
+    n = 0;
+    for(uint32_t p = 0; p < page_count; p++)
+    {
+      uint16_t offset = (p % 16 == 0) ? BENCH_HEADER_SIZE : 0;
+
+      LogCodec_Begin(&c, pages + (size_t) p * BENCH_PAGE_SIZE + offset, BENCH_PAGE_SIZE - offset);
+      good = LogCodec_Verify(&c);
+      while(good-- > 0 && LogCodec_Get(&c, &out))
+      {
+        bad += !SameRecord(&out, &in[n]);
+        n++;
+      }
+    }
+    t_dec = Now() - t_dec;
+
+    if(bad || n != records)
+    {
+      printf("%-10s round trip failed, %u of %u records wrong, %u decoded\n", HostSim_SignalName(sig), bad, records,
+             n);
+      return 1;
+    }
+
+    // Whole pages, the space left at the end of each one counts against the codec
+    bytes = (uint64_t) page_count * BENCH_PAGE_SIZE;
+    printf("%-10s %8.2f %6.2fx %10.0f %7.2fx %12.1f %12.1f\n", HostSim_SignalName(sig), (double) bytes / samples,
+           BENCH_RAW_SIZE * (double) samples / bytes, (double) samples / page_count * BENCH_PAGES,
+           (double) samples / page_count * BENCH_PAGES / BENCH_RAW_ENTRIES, t_enc * 1e9 / samples,
+           t_dec * 1e9 / samples);
+  }
+
+  free(in);
+  free(pages);
+  free(page_start);
+
+  return 0;
+}
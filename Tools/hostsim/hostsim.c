@@ -0,0 +1,370 @@
+/*
+ * hostsim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Simulated clock and host stand-ins for the modules the logger calls
+ * besides the flash, and the MPU6050 FIFO the recorder reads. USART1
+ * output goes into a TX ring that drains at 10 bit times per character,
+ * senders only wait when it is full. The LCD is not timed.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "hostsim.h"
+#include "uart.h"
+#include "lcd.h"
+#include "timer2.h"
+#include "ds18b20.h"
+#include "mpu6050.h"
+#include "i2c1.h"
+
+HostSim_Timing_t hostsim_timing;
+HostSim_Stats_t hostsim_stats;
+uint64_t hostsim_now = 0;
+
+static FILE *uart_out = 0;
+static uint64_t uart_idle_at = 0;  // ns, when the TX ring runs empty
+
+// Sensor readings the logger samples
+volatile DS18B20_Data_t ds18b20_data = { 23.5f, 1 };
+volatile MPU6050_RawData_t mpu6050_raw = { 164, -328, 16384, 0, 66, -66, 13 };
+volatile MPU6050_ScaledData_t mpu6050_scaled = { 0.01f, -0.02f, 1.0f, 27.25f, 0.5f, -0.5f, 0.1f };
+
+// Signal generator state
+static uint32_t rng = 1;
+static uint16_t signal_rate = 100;
+
+// MPU6050 FIFO, filled from the signal at the sample rate in simulated time
+static HostSim_Signal_t fifo_signal = HOSTSIM_SIGNAL_REST_44HZ;
+static uint8_t fifo_running = 0;
+static uint64_t fifo_start = 0;    // ns
+static uint64_t fifo_period = 0;   // ns
+static int32_t fifo_skew = 0;      // ppm, positive runs fast
+static uint32_t fifo_read = 0;     // Samples taken out, or skipped by a reset
+static uint8_t i2c_fast = 0;
+
+static const char *signal_names[HOSTSIM_SIGNAL_COUNT] = { "rest-5hz", "rest-44hz", "motion", "noise" };
+
+// Noise in LSB rms from the MPU6050 noise densities, 400 ug/sqrt(Hz) and
+// 0.005 deg/s/sqrt(Hz), over the DLPF bandwidth
+static const float accel_noise[HOSTSIM_SIGNAL_COUNT] = { 18.0f, 55.0f, 55.0f, 0.0f };
+static const float gyro_noise[HOSTSIM_SIGNAL_COUNT] = { 1.5f, 5.0f, 5.0f, 0.0f };
+
+uint64_t HostSim_Now(void)
+{
+  return hostsim_now;
+}
+
+void HostSim_Advance(uint64_t ns)
+{
+  hostsim_now += ns;
+}
+
+void HostSim_ResetStats(void)
+{
+  memset(&hostsim_stats, 0, sizeof(hostsim_stats));
+}
+
+void HostSim_SetUartOutput(FILE *out)
+{
+  uart_out = out;
+}
+
+static uint32_t Random(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// Normal distribution, Box-Muller
+static float Gauss(float sigma)
+{
+  float u1 = (Random() + 1.0f) / 4294967297.0f;
+  float u2 = Random() / 4294967296.0f;
+
+  return sigma * sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+static int16_t Clamp(float v)
+{
+  return (int16_t) fmaxf(-32768.0f, fminf(32767.0f, roundf(v)));
+}
+
+const char *HostSim_SignalName(HostSim_Signal_t signal)
+{
+  return (signal < HOSTSIM_SIGNAL_COUNT) ? signal_names[signal] : "?";
+}
+
+// Both sensors warm up slowly over an hour
+static float WarmUp(float t)
+{
+  return 300.0f * (1.0f - expf(-t / 3600.0f));
+}
+
+void HostSim_SetSignalRate(uint16_t hz)
+{
+  signal_rate = hz;
+}
+
+void HostSim_SetFifoSignal(HostSim_Signal_t signal)
+{
+  fifo_signal = signal;
+}
+
+void HostSim_SetFifoSkew(int32_t ppm)
+{
+  fifo_skew = ppm;
+}
+
+void HostSim_Signal(HostSim_Signal_t signal, uint32_t n, LogRecord_t *rec)
+{
+  float t = (float) n / signal_rate;
+  float swing = 0.0f;
+
+  if(n == 0)
+  {
+    rng = 1;
+  }
+
+  // Main loop period with the odd late sample
+  rec->type = LOG_RECORD_IMU;
+  rec->sequence = n;
+  rec->timestamp = (uint32_t) ((uint64_t) n * 1000 / signal_rate) + (Random() % 8 == 0);
+
+  if(signal == HOSTSIM_SIGNAL_NOISE)
+  {
+    rec->imu.mpu_temp = (int16_t) Random();
+    rec->imu.accel_x = (int16_t) Random();
+    rec->imu.accel_y = (int16_t) Random();
+    rec->imu.accel_z = (int16_t) Random();
+    rec->imu.gyro_x = (int16_t) Random();
+    rec->imu.gyro_y = (int16_t) Random();
+    rec->imu.gyro_z = (int16_t) Random();
+    return;
+  }
+
+  if(signal == HOSTSIM_SIGNAL_MOTION)
+  {
+    swing = sinf(6.2831853f * 1.5f * t);
+  }
+
+  rec->imu.mpu_temp = Clamp(2725 + WarmUp(t) + Gauss(5.0f));
+
+  rec->imu.accel_x = Clamp(164 + 4900.0f * swing + Gauss(accel_noise[signal]));
+  rec->imu.accel_y = Clamp(-328 + Gauss(accel_noise[signal]));
+  rec->imu.accel_z = Clamp(16384 - 700.0f * swing * swing + Gauss(accel_noise[signal]));
+  rec->imu.gyro_x = Clamp(66 + Gauss(gyro_noise[signal]));
+  rec->imu.gyro_y = Clamp(-66 + 7800.0f * cosf(6.2831853f * 1.5f * t) * (signal == HOSTSIM_SIGNAL_MOTION)
+                          + Gauss(gyro_noise[signal]));
+  rec->imu.gyro_z = Clamp(13 + Gauss(gyro_noise[signal]));
+}
+
+void HostSim_Temperature(HostSim_Signal_t signal, uint32_t n, LogRecord_t *rec)
+{
+  rec->type = LOG_RECORD_DS18B20;
+  rec->sequence = n;
+  rec->timestamp = n * 10 + 5;
+
+  // Hashed instead of drawn so the MPU6050 samples stay the same
+  if(signal == HOSTSIM_SIGNAL_NOISE)
+  {
+    rec->ds18b20_temp = (int16_t) ((n * 2654435761u) >> 16);
+    return;
+  }
+
+  // Steps of 1/16 deg
+  rec->ds18b20_temp = (int16_t) (2350 + (int32_t) (WarmUp(n / 100.0f) / 6.25f) * 6.25f);
+}
+
+void HostSim_SetSensors(const LogRecord_t *rec)
+{
+  if(rec->type == LOG_RECORD_DS18B20)
+  {
+    ds18b20_data.temperature = rec->ds18b20_temp / 100.0f;
+    ds18b20_data.valid = 1;
+    return;
+  }
+
+  mpu6050_scaled.temp = rec->imu.mpu_temp / 100.0f;
+  mpu6050_raw.accel_x = rec->imu.accel_x;
+  mpu6050_raw.accel_y = rec->imu.accel_y;
+  mpu6050_raw.accel_z = rec->imu.accel_z;
+  mpu6050_raw.gyro_x = rec->imu.gyro_x;
+  mpu6050_raw.gyro_y = rec->imu.gyro_y;
+  mpu6050_raw.gyro_z = rec->imu.gyro_z;
+}
+
+uint32_t TIMER2_GetMillis(void)
+{
+  return (uint32_t) (hostsim_now / 1000000);
+}
+
+// Start, 8 data and stop bit
+static uint64_t UART_ByteNs(void)
+{
+  return 10ULL * 1000000000ULL / hostsim_timing.uart_baud;
+}
+
+// Bytes in the TX ring not sent yet
+static uint32_t UART_Pending(void)
+{
+  uint64_t byte_ns = UART_ByteNs();
+
+  return (uart_idle_at > hostsim_now) ? (uint32_t) ((uart_idle_at - hostsim_now + byte_ns - 1) / byte_ns) : 0;
+}
+
+uint16_t USART1_TxFree(void)
+{
+  return HOSTSIM_UART_TX_SIZE - UART_Pending();
+}
+
+void USART1_SendChar(char c)
+{
+  uint64_t byte_ns = UART_ByteNs();
+  uint64_t room_at;
+
+  // Full ring, wait for the DMA to send a byte
+  if(UART_Pending() >= HOSTSIM_UART_TX_SIZE)
+  {
+    room_at = uart_idle_at - (HOSTSIM_UART_TX_SIZE - 1) * byte_ns;
+    hostsim_stats.uart_wait_ns += room_at - hostsim_now;
+    hostsim_now = room_at;
+  }
+
+  uart_idle_at = ((uart_idle_at > hostsim_now) ? uart_idle_at : hostsim_now) + byte_ns;
+  hostsim_stats.uart_bytes++;
+
+  if(uart_out)
+  {
+    fputc(c, uart_out);
+  }
+}
+
+void USART1_SendString(char *str)
+{
+  while(*str)
+  {
+    USART1_SendChar(*str++);
+  }
+}
+
+void USART1_SendNumber(uint32_t num)
+{
+  char buffer[16];
+  int i = 0;
+
+  do
+  {
+    buffer[i++] = '0' + (num % 10);
+    num /= 10;
+  } while(num > 0);
+
+  while(i > 0)
+  {
+    USART1_SendChar(buffer[--i]);
+  }
+}
+
+void LCD_Clear(void)
+{
+}
+
+void LCD_SetCursor(uint8_t row, uint8_t col)
+{
+  (void) row;
+  (void) col;
+}
+
+void LCD_SendString(char *str)
+{
+  (void) str;
+}
+
+// 9 bit times per byte on the bus
+static void I2C_Charge(uint32_t bytes)
+{
+  hostsim_now += bytes * 9ULL * 1000000000ULL / (i2c_fast ? 400000 : 100000);
+}
+
+void I2C1_SetFastMode(uint8_t fast)
+{
+  i2c_fast = fast;
+}
+
+static uint32_t FIFO_Produced(void)
+{
+  return fifo_running ? (uint32_t) ((hostsim_now - fifo_start) / fifo_period) : fifo_read;
+}
+
+uint8_t MPU6050_FIFO_Start(uint8_t div, uint8_t dlpf)
+{
+  (void) dlpf;
+
+  I2C_Charge(4 * 3);
+  fifo_period = (div + 1) * 1000000ULL * 1000000 / (1000000 + fifo_skew);
+  fifo_start = hostsim_now;
+  fifo_read = 0;
+  fifo_running = 1;
+  HostSim_SetSignalRate(1000 / (div + 1));
+
+  return I2C_OK;
+}
+
+uint8_t MPU6050_FIFO_Stop(void)
+{
+  I2C_Charge(3 * 3);
+  fifo_running = 0;
+  HostSim_SetSignalRate(100);
+
+  return I2C_OK;
+}
+
+uint8_t MPU6050_FIFO_Reset(void)
+{
+  I2C_Charge(2 * 3);
+  fifo_read = FIFO_Produced();
+
+  return I2C_OK;
+}
+
+uint8_t MPU6050_FIFO_Count(uint16_t *count)
+{
+  uint32_t bytes;
+
+  I2C_Charge(3 + 2);
+  bytes = (FIFO_Produced() - fifo_read) * MPU6050_FIFO_SAMPLE_SIZE;
+  *count = (bytes > MPU6050_FIFO_SIZE) ? MPU6050_FIFO_SIZE : bytes;
+
+  return I2C_OK;
+}
+
+uint8_t MPU6050_FIFO_Read(MPU6050_RawData_t *samples, uint8_t n)
+{
+  LogRecord_t rec;
+
+  I2C_Charge(3 + n * MPU6050_FIFO_SAMPLE_SIZE);
+
+  for(uint8_t i = 0; i < n; i++)
+  {
+    HostSim_Signal(fifo_signal, fifo_read++, &rec);
+    samples[i].accel_x = rec.imu.accel_x;
+    samples[i].accel_y = rec.imu.accel_y;
+    samples[i].accel_z = rec.imu.accel_z;
+    samples[i].temp = (int16_t) (((int32_t) rec.imu.mpu_temp - 3653) * 340 / 100);
+    samples[i].gyro_x = rec.imu.gyro_x;
+    samples[i].gyro_y = rec.imu.gyro_y;
+    samples[i].gyro_z = rec.imu.gyro_z;
+  }
+
+  return I2C_OK;
+}
+
+void MPU6050_ScaleAll(void)
+{
+  mpu6050_scaled.temp = mpu6050_raw.temp / 340.0f + 36.53f;
+}
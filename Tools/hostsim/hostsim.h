@@ -0,0 +1,131 @@
+/*
+ * hostsim.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Host build of the logger. w25q64_sim.c implements the W25Q64_* API from
+ * Inc/w25q64.h on top of a memory-mapped image file, the other modules
+ * the logger and the recorder use are stubbed in hostsim.c. Everything runs on a
+ * simulated clock that SPI transfers, flash busy time and waits for room in
+ * the UART TX ring advance, so timings are those of the target, not of the
+ * host.
+ */
+
+#ifndef HOSTSIM_H_
+#define HOSTSIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "logger.h"
+
+// Flash and bus timing
+typedef struct
+{
+  uint32_t spi_hz;            // SPI1 clock
+  uint32_t uart_baud;         // USART1, 10 bits per character
+  uint32_t page_program_us;   // tPP
+  uint32_t sector_erase_us;   // tSE
+  uint32_t block32_erase_us;  // tBE1
+  uint32_t block64_erase_us;  // tBE2
+  uint32_t chip_erase_us;     // tCE
+  uint32_t suspend_us;        // tSUS, erase suspend to ready
+} HostSim_Timing_t;
+
+// W25Q64FV datasheet, typical and maximum
+extern const HostSim_Timing_t HOSTSIM_TIMING_TYPICAL;
+extern const HostSim_Timing_t HOSTSIM_TIMING_MAX;
+
+typedef struct
+{
+  uint64_t reads;             // Read commands
+  uint64_t read_bytes;
+  uint64_t programs;          // Page programs
+  uint64_t program_bytes;
+  uint64_t erases;            // Sector, block and chip erases
+  uint64_t status_polls;
+  uint64_t busy_wait_ns;      // Time spent blocked in W25Q64_WaitBusy
+  uint64_t suspends;          // Erases suspended
+  uint64_t uart_bytes;
+  uint64_t uart_wait_ns;      // Time spent blocked on a full TX ring
+
+  // NOR rule violations, all of these are bugs in the caller
+  uint32_t busy_violations;   // Read issued while a program or erase was running
+  uint32_t page_wraps;        // Program ran past the end of its page and wrapped
+  uint32_t stuck_bits;        // Bytes programmed that needed a 0 -> 1 transition
+  uint32_t suspend_violations;// Access to a suspended erase's range, or an erase sent during it
+  uint32_t max_sector_erases; // Wear of the most erased sector
+
+  // Operations a power loss cut short
+  uint32_t torn_programs;
+  uint32_t torn_erases;
+} HostSim_Stats_t;
+
+// Shared by the simulated modules
+extern HostSim_Timing_t hostsim_timing;
+extern HostSim_Stats_t hostsim_stats;
+extern uint64_t hostsim_now;  // ns
+
+// Map the image file, fresh = 1 starts from an erased chip
+int HostSim_Open(const char *path, uint8_t fresh, const HostSim_Timing_t *timing);
+void HostSim_Close(void);
+
+// Simulated time in ns
+uint64_t HostSim_Now(void);
+void HostSim_Advance(uint64_t ns);
+
+const HostSim_Stats_t *HostSim_GetStats(void);
+void HostSim_ResetStats(void);
+
+// Power loss during the n-th program or erase from now, 0 disarms. The
+// chip takes no program or erase after it until HostSim_PowerOn, which
+// leaves it idle like after a reset.
+void HostSim_ArmPowerLoss(uint32_t n);
+uint8_t HostSim_PowerLost(void);
+void HostSim_PowerOn(void);
+
+// USART1 TX ring as in Src/uart.c, DMA empties it at the baud rate
+#define HOSTSIM_UART_TX_SIZE  512
+
+// Where USART1 output goes, NULL discards it (time is still charged)
+void HostSim_SetUartOutput(FILE *out);
+
+// Synthetic sensor signals, raw MPU6050 LSBs at +-2 g and +-250 deg/s
+// sampled at 100 Hz unless set, temperatures in 0.01 deg C like the log
+// records
+typedef enum
+{
+  HOSTSIM_SIGNAL_REST_5HZ = 0,  // Board lying still, DLPF at 5 Hz
+  HOSTSIM_SIGNAL_REST_44HZ,     // Board lying still, DLPF at 44 Hz
+  HOSTSIM_SIGNAL_MOTION,        // Swinging at 1.5 Hz, DLPF at 44 Hz
+  HOSTSIM_SIGNAL_NOISE,         // Uniform random words, the worst case
+  HOSTSIM_SIGNAL_COUNT
+} HostSim_Signal_t;
+
+const char *HostSim_SignalName(HostSim_Signal_t signal);
+
+// The DS18B20 converts once a second, after every 100th MPU6050 sample
+#define HOSTSIM_TEMP_EVERY  100
+
+// MPU6050 sample n of a signal as an IMU record, n = 0 restarts it
+void HostSim_Signal(HostSim_Signal_t signal, uint32_t n, LogRecord_t *rec);
+
+// Sample rate of the signals, MPU6050_FIFO_Start sets it for the recorder
+void HostSim_SetSignalRate(uint16_t hz);
+
+// Signal behind the simulated MPU6050 FIFO, which fills at its sample rate
+// in simulated time. I2C transfers advance the clock at 100 or 400 kHz.
+void HostSim_SetFifoSignal(HostSim_Signal_t signal);
+
+// MPU6050 sample clock off from the simulated one by ppm, positive runs
+// fast. Takes effect at the next MPU6050_FIFO_Start.
+void HostSim_SetFifoSkew(int32_t ppm);
+
+// DS18B20 reading taken after MPU6050 sample n
+void HostSim_Temperature(HostSim_Signal_t signal, uint32_t n, LogRecord_t *rec);
+
+// Put a record in the sensor globals the logger reads
+void HostSim_SetSensors(const LogRecord_t *rec);
+
+#endif /* HOSTSIM_H_ */
@@ -0,0 +1,122 @@
+/*
+ * stm32f103xb.h
+ *
+ * Host build stand-in for the CMSIS device header. The modules logbench
+ * builds don't touch registers, they only get types and barriers through
+ * this one. Src/uart.c does, uartbench.c defines its registers as plain
+ * structs and plays the DMA and the interrupts on them.
+ */
+
+#ifndef STM32F103XB_H_
+#define STM32F103XB_H_
+
+#include <stdint.h>
+
+// CMSIS intrinsics used outside of register code
+#define __DMB()  __sync_synchronize()
+
+// Registers Src/uart.c uses
+typedef struct
+{
+  volatile uint32_t CCR;
+  volatile uint32_t CNDTR;
+  volatile uint32_t CPAR;
+  volatile uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+  volatile uint32_t ISR;
+  volatile uint32_t IFCR;
+} DMA_TypeDef;
+
+typedef struct
+{
+  volatile uint32_t SR;
+  volatile uint32_t DR;
+  volatile uint32_t BRR;
+  volatile uint32_t CR1;
+  volatile uint32_t CR2;
+  volatile uint32_t CR3;
+  volatile uint32_t GTPR;
+} USART_TypeDef;
+
+typedef struct
+{
+  volatile uint32_t APB2ENR;
+  volatile uint32_t AHBENR;
+} RCC_TypeDef;
+
+typedef struct
+{
+  volatile uint32_t CRL;
+  volatile uint32_t CRH;
+} GPIO_TypeDef;
+
+extern DMA_Channel_TypeDef hostsim_dma1_ch4;
+extern DMA_Channel_TypeDef hostsim_dma1_ch5;
+extern DMA_TypeDef hostsim_dma1;
+extern USART_TypeDef hostsim_usart1;
+extern RCC_TypeDef hostsim_rcc;
+extern GPIO_TypeDef hostsim_gpioa;
+
+#define DMA1_Channel4  (&hostsim_dma1_ch4)
+#define DMA1_Channel5  (&hostsim_dma1_ch5)
+#define DMA1           (&hostsim_dma1)
+#define USART1         (&hostsim_usart1)
+#define RCC            (&hostsim_rcc)
+#define GPIOA          (&hostsim_gpioa)
+
+#define DMA_CCR_EN             0x0001
+#define DMA_CCR_TCIE           0x0002
+#define DMA_CCR_HTIE           0x0004
+#define DMA_CCR_DIR            0x0010
+#define DMA_CCR_CIRC           0x0020
+#define DMA_CCR_MINC           0x0080
+#define DMA_ISR_TCIF4          0x00002000
+#define DMA_IFCR_CGIF4         0x00001000
+#define DMA_ISR_TCIF5          0x00020000
+#define DMA_ISR_HTIF5          0x00040000
+#define DMA_IFCR_CGIF5         0x00010000
+
+#define RCC_APB2ENR_AFIOEN     0x0001
+#define RCC_APB2ENR_IOPAEN     0x0004
+#define RCC_APB2ENR_USART1EN   0x4000
+#define RCC_AHBENR_DMA1EN      0x0001
+
+#define GPIO_CRH_MODE9         0x00000030
+#define GPIO_CRH_CNF9          0x000000C0
+#define GPIO_CRH_CNF9_1        0x00000080
+#define GPIO_CRH_MODE10        0x00000300
+#define GPIO_CRH_CNF10         0x00000C00
+#define GPIO_CRH_CNF10_0       0x00000400
+
+#define USART_SR_IDLE          0x0010
+#define USART_SR_TC            0x0040
+#define USART_CR1_RE           0x0004
+#define USART_CR1_TE           0x0008
+#define USART_CR1_IDLEIE       0x0010
+#define USART_CR1_UE           0x2000
+#define USART_CR3_DMAR         0x0040
+#define USART_CR3_DMAT         0x0080
+
+typedef enum
+{
+  USART1_IRQn = 37,
+  DMA1_Channel4_IRQn = 14,
+  DMA1_Channel5_IRQn = 15
+} IRQn_Type;
+
+// Interrupts are the SIGALRM handler of uartbench, always enabled
+static inline void NVIC_EnableIRQ(IRQn_Type irq)
+{
+  (void) irq;
+}
+
+static inline void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+  (void) irq;
+  (void) priority;
+}
+
+#endif /* STM32F103XB_H_ */
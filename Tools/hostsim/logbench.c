@@ -0,0 +1,897 @@
+/*
+ * logbench.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Runs Src/logger.c against the simulated W25Q64 and reports, in
+ * simulated target time, sample throughput, boot-scan time and dump
+ * speed. Every sample is an IMU record, with a DS18B20 record after every
+ * 100th like the firmware does. By default the ring is filled past the end
+ * of the chip so every figure is taken under full-chip conditions.
+ *
+ * With -r the samples come from Src/recorder.c reading the simulated
+ * MPU6050 FIFO instead, in 10 ms main loop passes like the firmware.
+ * Dumps and queries also run from Logger_Task in main loop passes, until
+ * the UART has sent their last byte.
+ *
+ * Usage:
+ *   logbench [-i image] [-n samples] [-s signal] [-p period_us] [-r rate_hz] [-t typ|max] [-k] [-q]
+ *            [-d csv|bin] [-c ppm] [-x samples]
+ *     -i  flash image file, default w25q64.img
+ *     -n  samples to log, default until the ring wraps plus 10%
+ *     -s  sensor signal, rest-5hz, rest-44hz (default), motion or noise
+ *     -p  simulated time between samples, default 0 = back to back, as
+ *         fast as the logger drains its sample queue
+ *     -r  continuous recording at this MPU6050 sample rate
+ *     -t  flash timing from the datasheet, typical or maximum
+ *     -k  keep the image contents instead of starting erased
+ *     -q  skip the dumps and range queries
+ *     -d  with -r, start a dump 10 s into the recording and keep recording
+ *         until it is done
+ *     -c  with -r, the MPU6050 sample clock is off by this many ppm,
+ *         positive runs fast. A time query still has to return every
+ *         record of its range.
+ *     -x  power loss on average every this many samples: a program or erase
+ *         is cut short and the logger boots again. After every boot a CSV
+ *         dump of the whole log has to match the entry count and the zone
+ *         maps, with no gaps in the sequence numbers. Config saves with
+ *         power losses follow the log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hostsim.h"
+#include "config.h"
+#include "logger.h"
+#include "logqueue.h"
+#include "recorder.h"
+#include "rollup.h"
+#include "timer2.h"
+#include "uart.h"
+
+// Log area, sectors 1..1758 as in Src/logger.c, the rollup tiers follow
+#define BENCH_LOG_BYTES  (1758.0 * 4096)
+
+// Main loop period of the firmware
+#define BENCH_LOOP_NS  10000000ULL
+
+// Main loop passes into a recording before -d starts its dump
+#define BENCH_DUMP_PASS  1000
+
+// Config saves -x makes, about 23 bank switches
+#define BENCH_CONFIG_SAVES  3000
+
+// NOR rule violations over all phases
+static uint32_t violations = 0;
+
+// Power losses, -x
+static uint32_t power_every = 0;  // Samples, 0 = none
+static uint32_t bench_rng = 12345;
+static uint32_t power_losses = 0;
+static uint32_t lost_max = 0;     // Most records a power loss took
+static uint64_t lost_total = 0;
+static uint64_t power_ns = 0;     // Reboots and their checks, left out of the timing
+static uint64_t power_uart = 0;
+
+static void CountViolations(void)
+{
+  const HostSim_Stats_t *st = HostSim_GetStats();
+
+  if(st->busy_violations || st->page_wraps || st->stuck_bits || st->suspend_violations)
+  {
+    printf("  NOR violations: %u reads while busy, %u page wraps, %u stuck bytes, %u during a suspend\n",
+           st->busy_violations, st->page_wraps, st->stuck_bits, st->suspend_violations);
+    violations += st->busy_violations + st->page_wraps + st->stuck_bits + st->suspend_violations;
+  }
+}
+
+static uint32_t BenchRandom(void)
+{
+  bench_rng ^= bench_rng << 13;
+  bench_rng ^= bench_rng >> 17;
+  bench_rng ^= bench_rng << 5;
+  return bench_rng;
+}
+
+static double Ms(uint64_t ns)
+{
+  return ns / 1e6;
+}
+
+static double WallSeconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Boot(const char *label)
+{
+  uint64_t t0;
+
+  HostSim_ResetStats();
+  t0 = HostSim_Now();
+
+  printf("%s:\n  ", label);
+  fflush(stdout);
+  HostSim_SetUartOutput(stdout);
+  Logger_Init(LOGGER_MODE_RING);
+  HostSim_SetUartOutput(NULL);
+
+  printf("  Logger_Init %.1f ms, %llu reads, %llu bytes read\n", Ms(HostSim_Now() - t0),
+         (unsigned long long) HostSim_GetStats()->reads, (unsigned long long) HostSim_GetStats()->read_bytes);
+  CountViolations();
+}
+
+// Logger_Task once per main loop pass until the dump is done and the UART
+// has sent all of it
+static void RunDump(void)
+{
+  uint64_t t;
+
+  while(Logger_IsDumping() || USART1_TxFree() < HOSTSIM_UART_TX_SIZE)
+  {
+    t = HostSim_Now();
+    Logger_Task();
+    if(HostSim_Now() - t < BENCH_LOOP_NS)
+    {
+      HostSim_Advance(BENCH_LOOP_NS - (HostSim_Now() - t));
+    }
+  }
+}
+
+static void Dump(const char *label, void (*dump)(void))
+{
+  const HostSim_Stats_t *st;
+  uint64_t t0;
+  double secs;
+
+  HostSim_ResetStats();
+  t0 = HostSim_Now();
+  dump();
+  RunDump();
+  st = HostSim_GetStats();
+  secs = (HostSim_Now() - t0) / 1e9;
+
+  printf("%s: %.1f s, %llu UART bytes (%.0f%% of the line), %llu flash bytes read, %u records/s\n", label, secs,
+         (unsigned long long) st->uart_bytes,
+         100.0 * st->uart_bytes * 10 / hostsim_timing.uart_baud / (secs > 0 ? secs : 1),
+         (unsigned long long) st->read_bytes, (unsigned) (Logger_GetEntryCount() / (secs > 0 ? secs : 1)));
+  CountViolations();
+}
+
+static uint32_t query_from;
+static uint32_t query_to;
+
+static void QueryNewest(void)
+{
+  Logger_DumpRange(LOGGER_RANGE_SEQUENCE, query_from, 0xFFFFFFFF);
+}
+
+static void QueryLastMinute(void)
+{
+  Logger_DumpRange(LOGGER_RANGE_TIME, query_from, 0xFFFFFFFF);
+}
+
+static void QueryTimeWindow(void)
+{
+  Logger_DumpRange(LOGGER_RANGE_TIME, query_from, query_to);
+}
+
+static void QueryPeaks(void)
+{
+  Logger_DumpPeaks(LOGGER_CHANNEL_GYRO_X, 86);
+}
+
+static void SummaryAll(void)
+{
+  Logger_Summary(LOGGER_RANGE_SEQUENCE, 0, 0xFFFFFFFF);
+}
+
+static void SummaryLastMinute(void)
+{
+  Logger_Summary(LOGGER_RANGE_TIME, query_from, 0xFFFFFFFF);
+}
+
+static void RollupMinutes(void)
+{
+  Logger_DumpRollup(1);
+}
+
+static uint8_t rollup_tier;
+
+static void RollupTier(void)
+{
+  Logger_DumpRollup(rollup_tier);
+}
+
+// Output of a dump or query in a temporary file, rewound
+static FILE *Capture(void (*query)(void))
+{
+  FILE *out = tmpfile();
+
+  HostSim_SetUartOutput(out);
+  query();
+  RunDump();
+  HostSim_SetUartOutput(NULL);
+  rewind(out);
+
+  return out;
+}
+
+// Query or summary on the UART, counts the record lines and shows the
+// totals the firmware prints
+static uint32_t Query(const char *label, void (*query)(void))
+{
+  const HostSim_Stats_t *st;
+  FILE *out;
+  uint32_t records = 0;
+  uint64_t t0;
+  char line[256];
+
+  HostSim_ResetStats();
+  t0 = HostSim_Now();
+  out = Capture(query);
+  st = HostSim_GetStats();
+
+  printf("%s: %.1f ms, %llu flash bytes read\n", label, Ms(HostSim_Now() - t0), (unsigned long long) st->read_bytes);
+
+  while(fgets(line, sizeof(line), out))
+  {
+    if(line[0] >= '0' && line[0] <= '9')
+    {
+      records++;
+    }
+    else if(!strncmp(line, "Total", 5) || !strncmp(line, "Sectors", 7) || !strncmp(line, "GYRO_X", 6))
+    {
+      printf("  %s", line);
+    }
+  }
+  fclose(out);
+
+  if(records)
+  {
+    printf("  %u record lines\n", records);
+  }
+  CountViolations();
+
+  return records;
+}
+
+// Rollup dumps of every tier, windows have to come oldest first
+static void RollupOrder(void)
+{
+  FILE *out;
+  uint32_t seq;
+  uint32_t prev = 0;
+  uint32_t windows;
+  uint32_t wrong;
+  char line[256];
+
+  for(rollup_tier = 0; rollup_tier < ROLLUP_TIERS; rollup_tier++)
+  {
+    out = Capture(RollupTier);
+    windows = 0;
+    wrong = 0;
+
+    while(fgets(line, sizeof(line), out))
+    {
+      if(line[0] < '0' || line[0] > '9')
+      {
+        continue;
+      }
+
+      seq = strtoul(line, 0, 10);
+      if(windows > 0 && seq <= prev)
+      {
+        wrong++;
+      }
+      prev = seq;
+      windows++;
+    }
+    fclose(out);
+
+    if(wrong)
+    {
+      printf("  Rollup tier %u: %u of %u windows out of order\n", rollup_tier, wrong, windows);
+      violations++;
+    }
+  }
+}
+
+// Records the zone maps count, an IMU record has MPU_TEMP, a DS18B20 one
+// its own channel
+static uint32_t SummaryCount(void)
+{
+  FILE *out = Capture(SummaryAll);
+  uint32_t count = 0;
+  char line[256];
+
+  while(fgets(line, sizeof(line), out))
+  {
+    if(!strncmp(line, "MPU_TEMP,", 9) || !strncmp(line, "DS18B20,", 8))
+    {
+      count += strtoul(strchr(line, ',') + 1, 0, 10);
+    }
+  }
+  fclose(out);
+
+  return count;
+}
+
+// Whole log as CSV, counts the records, the IMU and DS18B20 ones the zone
+// maps sum up, and the breaks in the sequence numbers
+static void CountLog(uint32_t *records, uint32_t *sensors, uint32_t *gaps)
+{
+  FILE *out = Capture(Logger_DumpAll);
+  uint32_t seq;
+  uint32_t prev = 0;
+  char line[256];
+
+  *records = 0;
+  *sensors = 0;
+  *gaps = 0;
+
+  while(fgets(line, sizeof(line), out))
+  {
+    if(line[0] < '0' || line[0] > '9')
+    {
+      continue;
+    }
+
+    seq = strtoul(line, 0, 10);
+    if(*records > 0 && seq != prev + 1)
+    {
+      (*gaps)++;
+    }
+    prev = seq;
+    (*records)++;
+
+    if(strstr(line, ",IMU,") || strstr(line, ",DS18B20,"))
+    {
+      (*sensors)++;
+    }
+  }
+  fclose(out);
+}
+
+// Whole log as CSV, the records of this boot from query_from to query_to
+// and the times that went backwards since the boot record
+static void CountTimes(uint32_t *in_range, uint32_t *backwards)
+{
+  FILE *out = Capture(Logger_DumpAll);
+  uint32_t ts;
+  uint32_t prev = 0;
+  char boot[16];
+  char line[256];
+  char *p;
+
+  snprintf(boot, sizeof(boot), "EVENT,%u,", LOGGER_EVENT_BOOT);
+  *in_range = 0;
+  *backwards = 0;
+
+  while(fgets(line, sizeof(line), out))
+  {
+    if(line[0] < '0' || line[0] > '9')
+    {
+      continue;
+    }
+
+    p = strchr(line, ',') + 1;
+    ts = strtoul(p, &p, 10);
+
+    // Earlier boots have their own time base
+    if(!strncmp(p + 1, boot, strlen(boot)))
+    {
+      *in_range = 0;
+      *backwards = 0;
+      prev = 0;
+    }
+
+    if(ts < prev)
+    {
+      (*backwards)++;
+    }
+    prev = ts;
+
+    if(ts >= query_from && ts <= query_to)
+    {
+      (*in_range)++;
+    }
+  }
+  fclose(out);
+}
+
+// Boot after a power loss. Records still in RAM are gone, the ones in flash
+// have to be found the same by the boot scan, the dump and the zone maps.
+static void PowerCycle(void)
+{
+  uint32_t before = Logger_GetEntryCount();
+  uint32_t after;
+  uint32_t records;
+  uint32_t sensors;
+  uint32_t gaps;
+  uint32_t zoned;
+
+  HostSim_PowerOn();
+  Logger_Init(LOGGER_MODE_RING);
+  power_losses++;
+
+  after = Logger_GetEntryCount();
+  if(after < before)
+  {
+    lost_total += before - after;
+    if(before - after > lost_max)
+    {
+      lost_max = before - after;
+    }
+  }
+
+  // The dump programs the boot records first
+  CountLog(&records, &sensors, &gaps);
+  zoned = SummaryCount();
+  if(records != Logger_GetEntryCount() || zoned != sensors || gaps)
+  {
+    printf("  Power loss %u: boot scan found %u records, dump %u with %u gaps, zone maps %u of %u\n", power_losses,
+           after, records, gaps, zoned, sensors);
+    violations++;
+  }
+}
+
+// Log after the last power loss, sequence numbers go up by one from the
+// oldest record on
+static void VerifyLog(void)
+{
+  uint32_t records;
+  uint32_t sensors;
+  uint32_t gaps;
+
+  CountLog(&records, &sensors, &gaps);
+
+  printf("Power losses: %u, %u torn programs, %u torn erases, at most %u records lost, %.1f on average\n",
+         power_losses, HostSim_GetStats()->torn_programs, HostSim_GetStats()->torn_erases, lost_max,
+         power_losses ? (double) lost_total / power_losses : 0.0);
+  printf("  Log after them: %u records in the dump, %u counted at boot, %u gaps in the sequence\n", records,
+         Logger_GetEntryCount(), gaps);
+
+  if(gaps || records != Logger_GetEntryCount())
+  {
+    violations++;
+  }
+}
+
+// Config saves, about every third one loses the power in its program or in
+// the erase of a bank switch. The settings loaded after it have to be the
+// ones of that save or of the last one that verified, never older ones.
+static void ConfigSaves(void)
+{
+  uint32_t good;
+  uint32_t value;
+  uint32_t got;
+  uint32_t cut = 0;
+  uint32_t wrong = 0;
+  uint32_t erases = HostSim_GetStats()->torn_erases;
+  uint8_t saved;
+  uint8_t lost;
+
+  Config_Load();
+  good = Config_Get()->lcd_ticks;
+
+  for(uint32_t i = 1; i <= BENCH_CONFIG_SAVES; i++)
+  {
+    value = i % CONFIG_TICKS_MAX;
+    Config_Set(CONFIG_KEY_LCD_TICKS, value);
+
+    // First or second flash operation, the erase if the bank is full
+    if(BenchRandom() % 3 == 0)
+    {
+      HostSim_ArmPowerLoss(1 + BenchRandom() % 2);
+    }
+    saved = Config_Save();
+    HostSim_ArmPowerLoss(0);
+
+    lost = HostSim_PowerLost();
+    if(lost)
+    {
+      HostSim_PowerOn();
+      cut++;
+    }
+
+    Config_Load();
+    got = Config_Get()->lcd_ticks;
+
+    // Without a power loss every save has to verify
+    if(got == value && (saved || lost))
+    {
+      good = value;
+    }
+    else if(saved || !lost || got != good)
+    {
+      wrong++;
+    }
+  }
+
+  printf("Config saves: %u, %u cut by a power loss, %u of them in an erase, %u loaded wrong\n", BENCH_CONFIG_SAVES,
+         cut, HostSim_GetStats()->torn_erases - erases, wrong);
+  violations += wrong;
+}
+
+// The newest 1000 records, the last minute and the whole log, before the
+// reboot starts a new time base
+static void Queries(void)
+{
+  uint32_t newest = LogQueue_GetStats()->pushed;
+  uint32_t now = TIMER2_GetMillis();
+  uint32_t records;
+  uint32_t expected;
+  uint32_t backwards;
+
+  query_from = newest > 1000 ? newest - 1000 : 0;
+  Query("Sequence query, newest 1000", QueryNewest);
+
+  query_from = now > 60000 ? now - 60000 : 0;
+  Query("Time query, last 60 s", QueryLastMinute);
+
+  // Ends before the newest record, so the query has to find where to stop
+  query_to = now > 30000 ? now - 30000 : 0;
+  records = Query("Time query, 60 to 30 s ago", QueryTimeWindow);
+  CountTimes(&expected, &backwards);
+  if(records != expected || backwards)
+  {
+    printf("  Log has %u records of this boot in the range, %u times went backwards\n", expected, backwards);
+    violations++;
+  }
+
+  Query("Summary, last 60 s", SummaryLastMinute);
+  Query("Summary, whole log", SummaryAll);
+  Query("Peak query, gyro_x beyond 86", QueryPeaks);
+  Query("Rollup dump, 1 min tier", RollupMinutes);
+  RollupOrder();
+}
+
+// Windows the rollup tiers programmed during a run
+static void RollupReport(void)
+{
+  Rollup_Stats_t rs;
+
+  Rollup_GetStats(&rs);
+  printf("  Rollup windows written: %u 1 s, %u 1 min, %u 1 h, %u dropped\n", rs.written[0], rs.written[1],
+         rs.written[2], rs.dropped);
+}
+
+static void DumpBinaryAll(void)
+{
+  Logger_DumpBinary(0);
+}
+
+// Recorder and logger tasks once per main loop pass, the DS18B20 once a
+// second, until the given number of samples or the ring wraps plus 10%.
+// A dump started on the way is finished before the recording stops.
+static void Record(HostSim_Signal_t signal, uint16_t rate, uint32_t entries, void (*dump)(void))
+{
+  const HostSim_Stats_t *st;
+  Recorder_Stats_t rs;
+  LogRecord_t temp;
+  uint32_t wrap = 0;
+  uint32_t count = 0;
+  uint32_t pass = 0;
+  uint32_t dump_passes = 0;
+  uint64_t t, lat, max_lat = 0;
+  uint64_t dump_start = 0, dump_end = 0, dump_max_lat = 0;
+  uint64_t dump_uart = 0;
+
+  HostSim_ResetStats();
+  HostSim_SetFifoSignal(signal);
+  if(!Recorder_Start(rate))
+  {
+    printf("Recorder_Start failed\n");
+    violations++;
+    return;
+  }
+
+  for(;;)
+  {
+    t = HostSim_Now();
+    if(dump && pass == BENCH_DUMP_PASS)
+    {
+      dump_start = t;
+      dump_uart = HostSim_GetStats()->uart_bytes;
+      dump();
+    }
+
+    Recorder_Task();
+    if(++pass % 100 == 0)
+    {
+      HostSim_Temperature(signal, pass, &temp);
+      HostSim_SetSensors(&temp);
+      Logger_SaveTemperature();
+    }
+    Logger_Task();
+
+    if(Logger_GetEntryCount() < count && wrap == 0)
+    {
+      Recorder_GetStats(&rs);
+      wrap = rs.samples;
+      if(entries == 0)
+      {
+        entries = wrap + wrap / 10;
+      }
+    }
+    count = Logger_GetEntryCount();
+
+    lat = HostSim_Now() - t;
+    if(lat > max_lat)
+    {
+      max_lat = lat;
+    }
+    if(dump_start && !dump_end)
+    {
+      dump_passes++;
+      if(lat > dump_max_lat)
+      {
+        dump_max_lat = lat;
+      }
+      if(!Logger_IsDumping())
+      {
+        dump_end = HostSim_Now();
+        dump_uart = HostSim_GetStats()->uart_bytes - dump_uart;
+      }
+    }
+    if(lat < BENCH_LOOP_NS)
+    {
+      HostSim_Advance(BENCH_LOOP_NS - lat);
+    }
+
+    Recorder_GetStats(&rs);
+    if(entries && rs.samples >= entries && (!dump || dump_end))
+    {
+      break;
+    }
+  }
+
+  Recorder_Stop();
+  Logger_Flush();
+  Recorder_GetStats(&rs);
+  st = HostSim_GetStats();
+
+  printf("Recorded %u samples at %u Hz in %.1f s: %.0f samples/s, %.0f flash bytes/s, %u dropped\n", rs.samples, rs.rate,
+         rs.elapsed_ms / 1e3, rs.samples / (rs.elapsed_ms / 1e3), rs.flash_bytes / (rs.elapsed_ms / 1e3), rs.dropped);
+  printf("  %s signal, longest main loop pass %.2f ms, %.1f s blocked on BUSY\n", HostSim_SignalName(signal), Ms(max_lat),
+         st->busy_wait_ns / 1e9);
+  if(wrap)
+  {
+    printf("  Ring wrapped after %u samples, %.2f flash bytes per sample\n", wrap, (double) (BENCH_LOG_BYTES) / wrap);
+  }
+  printf("  %llu page programs, %llu erases, %llu erase suspends, sample queue high water %u of %u\n",
+         (unsigned long long) st->programs, (unsigned long long) st->erases, (unsigned long long) st->suspends,
+         LogQueue_GetStats()->high_water, LOGQUEUE_SIZE);
+  if(dump_end)
+  {
+    printf("  Dump during the recording: %.1f s, %llu UART bytes, %u main loop passes, longest %.2f ms\n",
+           (dump_end - dump_start) / 1e9, (unsigned long long) dump_uart, dump_passes, Ms(dump_max_lat));
+  }
+  RollupReport();
+  CountViolations();
+}
+
+int main(int argc, char **argv)
+{
+  const char *image = "w25q64.img";
+  const HostSim_Timing_t *timing = &HOSTSIM_TIMING_TYPICAL;
+  uint32_t entries = 0;
+  uint32_t wrap = 0;  // Samples logged when the oldest sector was first erased
+  uint32_t count = 0;
+  HostSim_Signal_t signal = HOSTSIM_SIGNAL_REST_44HZ;
+  LogRecord_t sample;
+  uint64_t period_ns = 0;
+  uint16_t rate = 0;
+  int32_t skew = 0;
+  uint8_t fresh = 1;
+  uint8_t dumps = 1;
+  void (*record_dump)(void) = 0;
+  const HostSim_Stats_t *st;
+  uint64_t t0, t, lat, bytes, max_lat = 0;
+  double wall;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "-i") && i + 1 < argc)
+    {
+      image = argv[++i];
+    }
+    else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      entries = strtoul(argv[++i], 0, 0);
+    }
+    else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+    {
+      i++;
+      for(signal = 0; signal < HOSTSIM_SIGNAL_COUNT && strcmp(argv[i], HostSim_SignalName(signal)); signal++);
+      if(signal == HOSTSIM_SIGNAL_COUNT)
+      {
+        fprintf(stderr, "Unknown signal %s\n", argv[i]);
+        return 2;
+      }
+    }
+    else if(!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      period_ns = strtoull(argv[++i], 0, 0) * 1000;
+    }
+    else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+    {
+      rate = strtoul(argv[++i], 0, 0);
+    }
+    else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+    {
+      i++;
+      timing = !strcmp(argv[i], "max") ? &HOSTSIM_TIMING_MAX : &HOSTSIM_TIMING_TYPICAL;
+    }
+    else if(!strcmp(argv[i], "-k"))
+    {
+      fresh = 0;
+    }
+    else if(!strcmp(argv[i], "-q"))
+    {
+      dumps = 0;
+    }
+    else if(!strcmp(argv[i], "-d") && i + 1 < argc)
+    {
+      i++;
+      record_dump = !strcmp(argv[i], "bin") ? DumpBinaryAll : Logger_DumpAll;
+    }
+    else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+    {
+      skew = strtol(argv[++i], 0, 0);
+    }
+    else if(!strcmp(argv[i], "-x") && i + 1 < argc)
+    {
+      power_every = strtoul(argv[++i], 0, 0);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: logbench [-i image] [-n samples] [-s signal] [-p period_us] [-r rate_hz] [-t typ|max] [-k] [-q]"
+              " [-d csv|bin] [-c ppm] [-x samples]\n");
+      return 2;
+    }
+  }
+
+  if(HostSim_Open(image, fresh, timing) < 0)
+  {
+    perror(image);
+    return 1;
+  }
+
+  Boot("Boot");
+
+  if(rate)
+  {
+    HostSim_SetFifoSkew(skew);
+    Record(signal, rate, entries, record_dump);
+    if(dumps)
+    {
+      Queries();
+    }
+    Boot("Reboot");
+    if(dumps)
+    {
+      Dump("CSV dump", Logger_DumpAll);
+    }
+    HostSim_Close();
+    return violations ? 1 : 0;
+  }
+
+  // Sample throughput, the sensor tasks and one Logger_Task per main loop pass
+  HostSim_ResetStats();
+  t0 = HostSim_Now();
+  wall = WallSeconds();
+
+  for(uint32_t n = 0; entries == 0 || n < entries; n++)
+  {
+    HostSim_Signal(signal, n, &sample);
+    HostSim_SetSensors(&sample);
+
+    // Back to back runs as fast as the flash takes the records
+    while(period_ns == 0 && LogQueue_Count() >= LOGQUEUE_SIZE - 1)
+    {
+      Logger_Task();
+    }
+
+    t = HostSim_Now();
+    Logger_SaveIMU();
+    if(n % HOSTSIM_TEMP_EVERY == HOSTSIM_TEMP_EVERY - 1)
+    {
+      HostSim_Temperature(signal, n, &sample);
+      HostSim_SetSensors(&sample);
+      Logger_SaveTemperature();
+    }
+    Logger_Task();
+
+    if(power_every && BenchRandom() % power_every == 0)
+    {
+      // Cut the next flash operation short
+      HostSim_ArmPowerLoss(1);
+    }
+    if(HostSim_PowerLost())
+    {
+      lat = HostSim_Now();
+      bytes = HostSim_GetStats()->uart_bytes;
+      PowerCycle();
+      lat = HostSim_Now() - lat;
+      t += lat;
+      power_ns += lat;
+      power_uart += HostSim_GetStats()->uart_bytes - bytes;
+      count = Logger_GetEntryCount();
+    }
+
+    // Erase ahead dropped the oldest sector, the chip is full
+    if(Logger_GetEntryCount() < count && wrap == 0)
+    {
+      wrap = n;
+      if(entries == 0)
+      {
+        entries = n + n / 10;
+      }
+    }
+    count = Logger_GetEntryCount();
+
+    lat = HostSim_Now() - t;
+    if(lat > max_lat)
+    {
+      max_lat = lat;
+    }
+
+    if(period_ns > lat)
+    {
+      HostSim_Advance(period_ns - lat);
+    }
+  }
+  Logger_Flush();
+
+  wall = WallSeconds() - wall;
+  st = HostSim_GetStats();
+  t = HostSim_Now() - t0 - power_ns;
+
+  printf("Logged %u samples in %.1f s: %.0f samples/s, worst sample %.2f ms, %.1f s blocked on BUSY\n", entries, t / 1e9,
+         entries / (t / 1e9), Ms(max_lat), st->busy_wait_ns / 1e9);
+  if(wrap)
+  {
+    printf("  %s signal, ring wrapped after %u samples, %.2f flash bytes per sample\n", HostSim_SignalName(signal), wrap,
+           (double) (BENCH_LOG_BYTES) / wrap);
+  }
+  printf("  %llu page programs, %llu erases, most erased sector %u times, %.1f s of UART output, host %.2f s\n",
+         (unsigned long long) st->programs, (unsigned long long) st->erases, st->max_sector_erases,
+         (st->uart_bytes - power_uart) * 10.0 / hostsim_timing.uart_baud, wall);
+  printf("  %llu erase suspends, sample queue high water %u of %u, %u dropped\n",
+         (unsigned long long) st->suspends, LogQueue_GetStats()->high_water, LOGQUEUE_SIZE,
+         LogQueue_GetStats()->dropped);
+  RollupReport();
+
+  if(power_every)
+  {
+    VerifyLog();
+    ConfigSaves();
+  }
+  CountViolations();
+
+  if(dumps)
+  {
+    Queries();
+  }
+
+  Boot("Reboot");
+
+  if(dumps)
+  {
+    Dump("CSV dump", Logger_DumpAll);
+    Dump("Binary dump", DumpBinaryAll);
+  }
+
+  HostSim_Close();
+
+  return violations ? 1 : 0;
+}
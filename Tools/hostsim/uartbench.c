@@ -0,0 +1,409 @@
+/*
+ * uartbench.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Runs Src/uart.c on the host with its registers as plain structs. A
+ * SIGALRM timer plays the hardware: every tick DMA channel 4 sends a few
+ * bytes of its transfer and channel 5 receives a few, raising the
+ * transfer complete, half transfer and IDLE interrupts like the chip. The
+ * main program meanwhile writes lines into the TX ring and reads the RX
+ * ring, so the interrupts land anywhere in the ring code, like on the
+ * target.
+ *
+ * Checked:
+ *   - lines sent with SendChar, SendString, SendNumber and Write come out
+ *     byte for byte and in order, across the end of the ring
+ *   - received bytes are read in order, the ones RX DMA wrote over before
+ *     they were read are counted in rx_lost
+ *   - TrySend drops, holds back or waits for what doesn't fit as its
+ *     policy says
+ *
+ * Usage:
+ *   uartbench [-n lines]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "stm32f103xb.h"
+#include "uart.h"
+
+// Simulated hardware time between interrupts, and the most bytes each DMA
+// channel moves in one
+#define BENCH_TICK_US   50
+#define BENCH_TX_BYTES  64
+#define BENCH_RX_BYTES  3
+
+// Longest line, Write lines cross the end of the 512 byte ring
+#define BENCH_LINE_MAX  300
+
+// Seconds a drain may take before the TX side counts as stuck
+#define BENCH_DRAIN_S   5
+
+DMA_Channel_TypeDef hostsim_dma1_ch4;
+DMA_Channel_TypeDef hostsim_dma1_ch5;
+DMA_TypeDef hostsim_dma1;
+USART_TypeDef hostsim_usart1;
+RCC_TypeDef hostsim_rcc;
+GPIO_TypeDef hostsim_gpioa;
+
+// TX: what the program wrote and what DMA sent
+static uint8_t *expected;
+static uint32_t expected_len = 0;
+static uint8_t *sent;
+static uint32_t sent_size;
+static volatile uint32_t sent_len = 0;
+
+// RX: bytes count up from 0, the reader knows what comes next
+static volatile uint8_t rx_on = 0;
+static volatile uint32_t rx_received = 0;
+static uint32_t rx_read = 0;
+static uint32_t rx_wrong = 0;
+
+static uint32_t failures = 0;
+static uint32_t tick_rng = 0x2545F491;
+
+static uint32_t TickRandom(void)
+{
+  tick_rng ^= tick_rng << 13;
+  tick_rng ^= tick_rng >> 17;
+  tick_rng ^= tick_rng << 5;
+  return tick_rng;
+}
+
+// RX DMA writes one byte, circular over the RX ring
+static void RxByte(void)
+{
+  uint16_t size = usart1_rx_buf.mask + 1;
+  uint8_t *mem = (uint8_t*) (uintptr_t) DMA1_Channel5->CMAR;
+
+  mem[size - DMA1_Channel5->CNDTR] = (uint8_t) rx_received++;
+
+  if(--DMA1_Channel5->CNDTR == 0)
+  {
+    DMA1_Channel5->CNDTR = size;
+    DMA1->ISR |= DMA_ISR_TCIF5;
+  }
+  else if(DMA1_Channel5->CNDTR == size / 2)
+  {
+    DMA1->ISR |= DMA_ISR_HTIF5;
+  }
+
+  if(DMA1->ISR & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5))
+  {
+    DMA1_Channel5_IRQHandler();
+    DMA1->ISR &= ~(DMA_ISR_HTIF5 | DMA_ISR_TCIF5);
+  }
+}
+
+// Line goes quiet after a burst
+static void RxIdle(void)
+{
+  USART1->SR |= USART_SR_IDLE;
+  USART1_IRQHandler();
+  USART1->SR &= ~USART_SR_IDLE;
+}
+
+// TX DMA sends up to n bytes of its transfer. CMAR stands in for the
+// channel's own memory pointer, the driver never reads it back.
+static void TxBytes(uint32_t n)
+{
+  if(!(DMA1_Channel4->CCR & DMA_CCR_EN) || DMA1_Channel4->CNDTR == 0)
+  {
+    return;
+  }
+
+  if(n > DMA1_Channel4->CNDTR)
+  {
+    n = DMA1_Channel4->CNDTR;
+  }
+  // Bytes sent over what was written only count
+  if(sent_len + n <= sent_size)
+  {
+    memcpy(&sent[sent_len], (const uint8_t*) (uintptr_t) DMA1_Channel4->CMAR, n);
+  }
+  sent_len += n;
+  DMA1_Channel4->CMAR += n;
+  DMA1_Channel4->CNDTR -= n;
+
+  if(DMA1_Channel4->CNDTR == 0)
+  {
+    DMA1->ISR |= DMA_ISR_TCIF4;
+    DMA1_Channel4_IRQHandler();
+    DMA1->ISR &= ~DMA_ISR_TCIF4;
+  }
+}
+
+// One tick of hardware, runs as an interrupt would
+static void Tick(int sig)
+{
+  uint32_t n;
+
+  (void) sig;
+
+  TxBytes(TickRandom() % BENCH_TX_BYTES + 1);
+
+  if(rx_on)
+  {
+    n = TickRandom() % (BENCH_RX_BYTES + 1);
+    for(uint32_t i = 0; i < n; i++)
+    {
+      RxByte();
+    }
+    if(n > 0 && TickRandom() % 4 == 0)
+    {
+      RxIdle();
+    }
+  }
+}
+
+static void Hardware(uint8_t on)
+{
+  struct itimerval t;
+
+  memset(&t, 0, sizeof(t));
+  if(on)
+  {
+    t.it_interval.tv_usec = BENCH_TICK_US;
+    t.it_value.tv_usec = BENCH_TICK_US;
+  }
+  setitimer(ITIMER_REAL, &t, 0);
+}
+
+static void Check(const char *what, uint8_t ok)
+{
+  if(!ok)
+  {
+    printf("  FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Wait for the TX ring to be sent, a transfer that is never chained stops it
+static void Drain(void)
+{
+  time_t start = time(0);
+
+  while(usart1_tx_buf.head != usart1_tx_buf.tail)
+  {
+    if(time(0) - start > BENCH_DRAIN_S)
+    {
+      Check("TX ring never drained", 0);
+      return;
+    }
+  }
+}
+
+static void Expect(const void *data, uint32_t len)
+{
+  memcpy(&expected[expected_len], data, len);
+  expected_len += len;
+}
+
+// Read what is in the RX ring, every byte is the one after the last read
+// plus the ones lost since
+static void ReadRx(uint32_t max)
+{
+  USART1_Stats_t st;
+  uint8_t c;
+
+  while(max-- > 0 && USART1_DataAvailable())
+  {
+    c = USART1_GetChar();
+    USART1_GetStats(&st);
+
+    if(c != (uint8_t) (rx_read + st.rx_lost))
+    {
+      rx_wrong++;
+    }
+    rx_read++;
+  }
+}
+
+// Lines of every kind while both DMA channels run
+static void Lines(uint32_t lines)
+{
+  char line[BENCH_LINE_MAX + 1];
+  char number[12];
+  uint32_t len;
+  USART1_Stats_t st;
+
+  rx_on = 1;
+  Hardware(1);
+
+  for(uint32_t i = 0; i < lines; i++)
+  {
+    switch(i % 4)
+    {
+      case 0:
+        len = snprintf(line, sizeof(line), "char %u\r\n", i);
+        for(uint32_t j = 0; j < len; j++)
+        {
+          USART1_SendChar(line[j]);
+        }
+        Expect(line, len);
+        break;
+
+      case 1:
+        len = snprintf(line, sizeof(line), "string %u,%u,%u\r\n", i, i * 7, i * 13);
+        USART1_SendString(line);
+        Expect(line, len);
+        break;
+
+      case 2:
+        USART1_SendString("number ");
+        USART1_SendNumber(i * 2654435761u);
+        USART1_SendString("\r\n");
+        len = snprintf(number, sizeof(number), "%u", i * 2654435761u);
+        Expect("number ", 7);
+        Expect(number, len);
+        Expect("\r\n", 2);
+        break;
+
+      default:
+        len = TickRandom() % (BENCH_LINE_MAX - 2) + 1;
+        for(uint32_t j = 0; j < len; j++)
+        {
+          line[j] = 'a' + (i + j) % 26;
+        }
+        line[len++] = '\r';
+        line[len++] = '\n';
+        USART1_Write((const uint8_t*) line, len);
+        Expect(line, len);
+        break;
+    }
+
+    ReadRx(TickRandom() % 16);
+  }
+
+  Drain();
+  rx_on = 0;
+  Hardware(0);
+
+  RxIdle();
+  ReadRx(UINT32_MAX);
+  USART1_GetStats(&st);
+
+  printf("TX: %u lines, %u bytes sent, %u blocking waits\n", lines, sent_len, st.waits);
+  printf("RX: %u bytes received, %u read, %u lost, %u out of order\n", rx_received, rx_read, st.rx_lost, rx_wrong);
+
+  Check("TX bytes differ from the ones written", sent_len == expected_len && !memcmp(sent, expected, sent_len));
+  Check("RX bytes out of order", rx_wrong == 0);
+  Check("RX bytes missing", rx_read + st.rx_lost == rx_received);
+}
+
+// DMA stopped with the ring almost full: a DROP message that doesn't fit
+// is dropped, one that does still goes out. LATEST ones are held back, the
+// newest replacing the older, one too long to hold is dropped, and the held
+// back one goes out once there is room again. A BLOCK message longer than
+// the ring waits for DMA and comes out whole.
+static void Policies(void)
+{
+  uint8_t fill[4096];
+  USART1_Stats_t before;
+  USART1_Stats_t st;
+  uint32_t start = sent_len;
+  uint16_t free_bytes;
+
+  USART1_GetStats(&before);
+  memset(fill, '.', sizeof(fill));
+
+  // The checks need no more room than this leaves
+  free_bytes = USART1_TxFree();
+  Check("TX ring not empty", free_bytes == usart1_tx_buf.mask + 1 && free_bytes <= sizeof(fill));
+  USART1_Write(fill, free_bytes - 2);
+  Expect(fill, free_bytes - 2);
+
+  Check("DROP message sent without room", USART1_TrySend("0123456789\r\n", USART1_TX_DROP) == 0);
+  Check("LATEST message not held back", USART1_TrySend("T1\r\n", USART1_TX_LATEST) == 1);
+  Check("LATEST message not held back", USART1_TrySend("T2\r\n", USART1_TX_LATEST) == 1);
+  Check("LATEST message held back too long", USART1_TryWrite(fill, 100, USART1_TX_LATEST) == 0);
+  Check("DROP message that fits not sent", USART1_TrySend("\r\n", USART1_TX_DROP) == 1);
+  Expect("\r\n", 2);
+
+  Hardware(1);
+  Drain();
+  USART1_Task();
+  Expect("T2\r\n", 4);
+
+  Check("BLOCK message not sent", USART1_TryWrite(fill, 3 * free_bytes, USART1_TX_BLOCK) == 1);
+  Expect(fill, 3 * free_bytes);
+  Drain();
+  Hardware(0);
+
+  USART1_GetStats(&st);
+  printf("TrySend: %u bytes dropped, %u held back bytes replaced, %u blocking waits\n", st.dropped - before.dropped,
+         st.overwritten - before.overwritten, st.waits - before.waits);
+
+  Check("Dropped bytes not counted", st.dropped - before.dropped == 12 + 100);
+  Check("Replaced bytes not counted", st.overwritten - before.overwritten == 4);
+  Check("BLOCK message didn't wait", st.waits - before.waits == 1);
+  Check("Messages not sent in order",
+        sent_len == expected_len && !memcmp(&sent[start], &expected[start], sent_len - start));
+}
+
+// A burst longer than the RX ring with nobody reading, the oldest bytes
+// are written over and counted
+static void Overrun(void)
+{
+  uint16_t size = usart1_rx_buf.mask + 1;
+  USART1_Stats_t before;
+  USART1_Stats_t st;
+  uint32_t read = rx_read;
+
+  USART1_GetStats(&before);
+
+  for(uint16_t i = 0; i < size + size / 4; i++)
+  {
+    RxByte();
+  }
+  RxIdle();
+  ReadRx(UINT32_MAX);
+
+  USART1_GetStats(&st);
+  printf("Overrun: %u bytes received, %u read, %u lost\n", size + size / 4, rx_read - read,
+         st.rx_lost - before.rx_lost);
+
+  Check("Overrun bytes out of order", rx_wrong == 0);
+  Check("Overrun bytes not counted", st.rx_lost - before.rx_lost == size / 4 && rx_read - read == size);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t lines = 20000;
+
+  if(argc == 3 && !strcmp(argv[1], "-n"))
+  {
+    lines = strtoul(argv[2], 0, 0);
+  }
+  else if(argc != 1)
+  {
+    fprintf(stderr, "Usage: uartbench [-n lines]\n");
+    return 2;
+  }
+
+  sent_size = lines * (BENCH_LINE_MAX + 2) + 4096;
+  expected = malloc(sent_size);
+  sent = malloc(sent_size);
+  if(!expected || !sent)
+  {
+    perror("malloc");
+    return 1;
+  }
+
+  signal(SIGALRM, Tick);
+  USART1_Init();
+
+  Lines(lines);
+  Policies();
+  Overrun();
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,619 @@
+/*
+ * w25q64_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * W25Q64 model behind the driver API. Programs can only clear bits,
+ * erases work on whole 4K/32K/64K units and the chip stays busy for the
+ * configured time after each of them. Reads while busy come back as
+ * 0xFF, the chip ignores them, and are counted as violations.
+ *
+ * A program running past the end of its page wraps to the page start
+ * like on a bare chip. The driver cuts such programs short instead,
+ * either way data is lost, here it shows up in the image and in
+ * page_wraps.
+ *
+ * Transfers the driver does on DMA complete immediately here, their SPI
+ * time is charged when they start.
+ *
+ * An erase can be suspended, what is left of its busy time runs after the
+ * resume. Reads and programs in its range while it is suspended, and erases
+ * sent then, are violations.
+ *
+ * An armed power loss cuts a program short at a random byte, the byte it
+ * stops in only partly programmed. An erase it cuts, or one suspended at
+ * the time, is only done up to a random byte, the bytes after it have some
+ * of their bits set. The chip takes no program or erase after that until
+ * HostSim_PowerOn.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "w25q64.h"
+#include "hostsim.h"
+
+#define SIM_SECTORS  (W25Q64_TOTAL_SIZE / W25Q64_SECTOR_SIZE)
+
+// ReadStatus in the driver waits 10us after CS before the command
+#define SIM_STATUS_DELAY_NS  10000ULL
+
+const HostSim_Timing_t HOSTSIM_TIMING_TYPICAL =
+{
+  .spi_hz = 18000000,
+  .uart_baud = 115200,
+  .page_program_us = 400,
+  .sector_erase_us = 45000,
+  .block32_erase_us = 120000,
+  .block64_erase_us = 150000,
+  .chip_erase_us = 20000000,
+  .suspend_us = 20
+};
+
+const HostSim_Timing_t HOSTSIM_TIMING_MAX =
+{
+  .spi_hz = 18000000,
+  .uart_baud = 115200,
+  .page_program_us = 3000,
+  .sector_erase_us = 400000,
+  .block32_erase_us = 1600000,
+  .block64_erase_us = 2000000,
+  .chip_erase_us = 100000000,
+  .suspend_us = 20
+};
+
+static uint8_t *flash = 0;
+static int flash_fd = -1;
+static uint32_t sector_erases[SIM_SECTORS];
+
+static uint64_t busy_until = 0;  // End of the running program or erase
+static uint8_t wel = 0;          // Write enable latch
+
+// Last erase, for suspend and resume
+static uint32_t erase_addr = 0;
+static uint32_t erase_size = 0;
+static uint64_t erase_until = 0;  // End of its busy time unless suspended
+static uint64_t erase_left = 0;   // Busy time left while suspended
+static uint8_t suspended = 0;
+
+// Open streaming read
+static uint32_t stream_addr = 0;
+static uint8_t stream_ignored = 0;  // Read was sent while busy
+
+// Power loss
+static uint32_t power_armed = 0;  // Programs and erases left until it, 0 = none
+static uint8_t power_lost = 0;
+static uint32_t cut_rng = 0x2545F491;
+static uint8_t erase_old[W25Q64_BLOCK_SIZE_64K];  // Contents before the last erase
+
+int HostSim_Open(const char *path, uint8_t fresh, const HostSim_Timing_t *t)
+{
+  struct stat st;
+
+  flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if(flash_fd < 0 || fstat(flash_fd, &st) < 0)
+  {
+    return -1;
+  }
+
+  // New or short files start erased
+  if(st.st_size != W25Q64_TOTAL_SIZE)
+  {
+    fresh = 1;
+    if(ftruncate(flash_fd, W25Q64_TOTAL_SIZE) < 0)
+    {
+      return -1;
+    }
+  }
+
+  flash = mmap(0, W25Q64_TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, flash_fd, 0);
+  if(flash == MAP_FAILED)
+  {
+    flash = 0;
+    return -1;
+  }
+
+  if(fresh)
+  {
+    memset(flash, 0xFF, W25Q64_TOTAL_SIZE);
+  }
+
+  hostsim_timing = *t;
+  hostsim_now = 0;
+  busy_until = 0;
+  wel = 0;
+  erase_size = 0;
+  erase_until = 0;
+  suspended = 0;
+  memset(sector_erases, 0, sizeof(sector_erases));
+  HostSim_ResetStats();
+
+  return 0;
+}
+
+void HostSim_Close(void)
+{
+  if(flash)
+  {
+    munmap(flash, W25Q64_TOTAL_SIZE);
+    flash = 0;
+  }
+  if(flash_fd >= 0)
+  {
+    close(flash_fd);
+    flash_fd = -1;
+  }
+}
+
+const HostSim_Stats_t* HostSim_GetStats(void)
+{
+  hostsim_stats.max_sector_erases = 0;
+  for(uint32_t i = 0; i < SIM_SECTORS; i++)
+  {
+    if(sector_erases[i] > hostsim_stats.max_sector_erases)
+    {
+      hostsim_stats.max_sector_erases = sector_erases[i];
+    }
+  }
+
+  return &hostsim_stats;
+}
+
+// Time for len bytes on SPI1
+static void SpiBytes(uint32_t len)
+{
+  hostsim_now += (uint64_t) len * 8 * 1000000000ULL / hostsim_timing.spi_hz;
+}
+
+static uint8_t ChipBusy(void)
+{
+  return hostsim_now < busy_until;
+}
+
+// Program and erase commands need WEL and clear it again
+static uint8_t TakeWriteEnable(void)
+{
+  if(!wel || ChipBusy() || power_lost)
+  {
+    return 0;
+  }
+
+  wel = 0;
+  return 1;
+}
+
+static uint32_t CutRandom(void)
+{
+  cut_rng ^= cut_rng << 13;
+  cut_rng ^= cut_rng >> 17;
+  cut_rng ^= cut_rng << 5;
+  return cut_rng;
+}
+
+// 1 if the power goes during the program or erase being started
+static uint8_t PowerLossDue(void)
+{
+  if(power_armed == 0 || --power_armed > 0)
+  {
+    return 0;
+  }
+
+  power_lost = 1;
+  return 1;
+}
+
+// Only the first part of the last erase got done
+static void TearErase(void)
+{
+  uint32_t cut = CutRandom() % erase_size;
+
+  for(uint32_t i = cut; i < erase_size; i++)
+  {
+    flash[erase_addr + i] = erase_old[i] | (uint8_t) CutRandom();
+  }
+  hostsim_stats.torn_erases++;
+}
+
+void HostSim_ArmPowerLoss(uint32_t n)
+{
+  power_armed = n;
+}
+
+uint8_t HostSim_PowerLost(void)
+{
+  return power_lost;
+}
+
+void HostSim_PowerOn(void)
+{
+  // A suspended erase never finishes
+  if(suspended)
+  {
+    TearErase();
+  }
+
+  power_lost = 0;
+  power_armed = 0;
+  busy_until = hostsim_now;
+  erase_size = 0;
+  erase_until = 0;
+  suspended = 0;
+  wel = 0;
+  stream_ignored = 0;
+}
+
+// Access to the range of a suspended erase, its contents are undefined
+static uint8_t InSuspendedErase(uint32_t addr, uint32_t len)
+{
+  return suspended && addr < erase_addr + erase_size && addr + len > erase_addr;
+}
+
+static void Erase(uint32_t addr, uint32_t size, uint32_t busy_us)
+{
+  SpiBytes(4);
+
+  // Not accepted while an erase is suspended
+  if(suspended)
+  {
+    hostsim_stats.suspend_violations++;
+    return;
+  }
+
+  if(!TakeWriteEnable())
+  {
+    return;
+  }
+
+  // The chip ignores the low address bits
+  addr = (addr % W25Q64_TOTAL_SIZE) & ~(size - 1);
+  if(size <= sizeof(erase_old))
+  {
+    memcpy(erase_old, flash + addr, size);
+  }
+  memset(flash + addr, 0xFF, size);
+
+  for(uint32_t s = addr / W25Q64_SECTOR_SIZE; s < (addr + size) / W25Q64_SECTOR_SIZE; s++)
+  {
+    sector_erases[s]++;
+  }
+
+  hostsim_stats.erases++;
+  busy_until = hostsim_now + (uint64_t) busy_us * 1000;
+
+  erase_addr = addr;
+  erase_size = size;
+  erase_until = busy_until;
+
+  if(PowerLossDue())
+  {
+    TearErase();
+  }
+}
+
+uint8_t W25Q64_ReadID(void)
+{
+  SpiBytes(4);
+  return 0xEF;
+}
+
+void W25Q64_Init(void)
+{
+  W25Q64_ReadID();
+}
+
+uint8_t W25Q64_ReadStatus(void)
+{
+  hostsim_now += SIM_STATUS_DELAY_NS;
+  SpiBytes(2);
+  hostsim_stats.status_polls++;
+
+  return (ChipBusy() ? W25Q64_SR_BUSY : 0) | (wel ? W25Q64_SR_WEL : 0);
+}
+
+void W25Q64_WaitBusy(void)
+{
+  uint64_t start = hostsim_now;
+
+  // Jump to the end of the operation instead of polling through it
+  if(ChipBusy())
+  {
+    hostsim_now = busy_until;
+  }
+  W25Q64_ReadStatus();
+
+  hostsim_stats.busy_wait_ns += hostsim_now - start;
+}
+
+uint8_t W25Q64_IsBusy(void)
+{
+  return (W25Q64_ReadStatus() & W25Q64_SR_BUSY) ? 1 : 0;
+}
+
+uint8_t W25Q64_ReadStatus2(void)
+{
+  hostsim_now += SIM_STATUS_DELAY_NS;
+  SpiBytes(2);
+
+  return suspended ? W25Q64_SR2_SUS : 0;
+}
+
+uint8_t W25Q64_SuspendErase(void)
+{
+  if(suspended || !ChipBusy() || busy_until != erase_until)
+  {
+    return 0;  // No erase running
+  }
+
+  SpiBytes(1);
+  hostsim_stats.suspends++;
+
+  // Erase keeps going until the suspend takes effect
+  hostsim_now += (uint64_t) hostsim_timing.suspend_us * 1000;
+  if(hostsim_now >= erase_until)
+  {
+    return 0;
+  }
+
+  erase_left = erase_until - hostsim_now;
+  busy_until = hostsim_now;
+  suspended = 1;
+  W25Q64_ReadStatus2();
+
+  return 1;
+}
+
+void W25Q64_ResumeErase(void)
+{
+  if(!suspended)
+  {
+    return;
+  }
+
+  W25Q64_WaitBusy();
+  SpiBytes(1);
+
+  erase_until = hostsim_now + erase_left;
+  busy_until = erase_until;
+  suspended = 0;
+}
+
+uint8_t W25Q64_IsSuspended(void)
+{
+  return suspended;
+}
+
+void W25Q64_WriteEnable(void)
+{
+  SpiBytes(1);
+
+  // Ignored while busy
+  if(!ChipBusy())
+  {
+    wel = 1;
+  }
+}
+
+void W25Q64_WriteDisable(void)
+{
+  SpiBytes(1);
+  wel = 0;
+}
+
+void W25Q64_ReadBegin(uint32_t addr)
+{
+  SpiBytes(5);  // Command, address, dummy
+
+  stream_addr = addr % W25Q64_TOTAL_SIZE;
+  stream_ignored = ChipBusy();
+  if(stream_ignored)
+  {
+    hostsim_stats.busy_violations++;
+  }
+
+  hostsim_stats.reads++;
+}
+
+void W25Q64_ReadStream(uint8_t *buf, uint32_t len)
+{
+  SpiBytes(len);
+  hostsim_stats.read_bytes += len;
+
+  if(!stream_ignored && InSuspendedErase(stream_addr, len))
+  {
+    hostsim_stats.suspend_violations++;
+  }
+
+  for(uint32_t i = 0; i < len; i++)
+  {
+    buf[i] = stream_ignored ? 0xFF : flash[stream_addr];
+    stream_addr = (stream_addr + 1) % W25Q64_TOTAL_SIZE;  // Reads wrap at the end of the chip
+  }
+}
+
+void W25Q64_StartReadStream(uint8_t *buf, uint32_t len)
+{
+  W25Q64_ReadStream(buf, len);
+}
+
+void W25Q64_ReadEnd(void)
+{
+  stream_ignored = 0;
+}
+
+void W25Q64_Read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  W25Q64_ReadBegin(addr);
+  W25Q64_ReadStream(buf, len);
+  W25Q64_ReadEnd();
+}
+
+void W25Q64_StartRead(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  W25Q64_Read(addr, buf, len);
+}
+
+uint8_t W25Q64_TransferDone(void)
+{
+  return 1;
+}
+
+void W25Q64_StartWritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t base;
+  uint32_t offset;
+  uint32_t cut;
+  uint8_t old;
+  uint8_t data;
+
+  // Same sequence as the driver
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
+
+  SpiBytes(4 + len);
+  if(!TakeWriteEnable())
+  {
+    return;
+  }
+
+  // Only the last 256 bytes sent are kept
+  if(len > W25Q64_PAGE_SIZE)
+  {
+    buf += len - W25Q64_PAGE_SIZE;
+    len = W25Q64_PAGE_SIZE;
+  }
+
+  addr %= W25Q64_TOTAL_SIZE;
+  base = addr & ~(uint32_t) (W25Q64_PAGE_SIZE - 1);
+  offset = addr & (W25Q64_PAGE_SIZE - 1);
+
+  if(offset + len > W25Q64_PAGE_SIZE)
+  {
+    hostsim_stats.page_wraps++;
+  }
+
+  if(InSuspendedErase(base, W25Q64_PAGE_SIZE))
+  {
+    hostsim_stats.suspend_violations++;
+  }
+
+  // Power goes while byte cut is programmed, the ones after it keep their bits
+  cut = len;
+  if(PowerLossDue())
+  {
+    cut = CutRandom() % len;
+    hostsim_stats.torn_programs++;
+  }
+
+  for(uint32_t i = 0; i < len && i <= cut; i++)
+  {
+    uint8_t *cell = &flash[base + ((offset + i) & (W25Q64_PAGE_SIZE - 1))];
+
+    // Programming only clears bits
+    old = *cell;
+    if((old & buf[i]) != buf[i])
+    {
+      hostsim_stats.stuck_bits++;
+    }
+
+    // Byte cut short has only some of its bits cleared
+    data = (i == cut) ? (buf[i] | (uint8_t) CutRandom()) : buf[i];
+    *cell = old & data;
+  }
+
+  hostsim_stats.programs++;
+  hostsim_stats.program_bytes += len;
+  busy_until = hostsim_now + (uint64_t) hostsim_timing.page_program_us * 1000;
+}
+
+void W25Q64_WritePage(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  W25Q64_StartWritePage(addr, buf, len);
+  W25Q64_WaitBusy();
+}
+
+void W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t chunk;
+
+  while(len > 0)
+  {
+    chunk = W25Q64_PAGE_SIZE - (addr & 0xFF);
+    if(chunk > len)
+    {
+      chunk = len;
+    }
+
+    W25Q64_WritePage(addr, buf, chunk);
+
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+}
+
+void W25Q64_StartEraseSector(uint32_t addr)
+{
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
+  Erase(addr, W25Q64_SECTOR_SIZE, hostsim_timing.sector_erase_us);
+}
+
+void W25Q64_StartEraseBlock32K(uint32_t addr)
+{
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
+  Erase(addr, W25Q64_BLOCK_SIZE_32K, hostsim_timing.block32_erase_us);
+}
+
+void W25Q64_StartEraseBlock64K(uint32_t addr)
+{
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
+  Erase(addr, W25Q64_BLOCK_SIZE_64K, hostsim_timing.block64_erase_us);
+}
+
+void W25Q64_EraseSector(uint32_t addr)
+{
+  W25Q64_StartEraseSector(addr);
+  W25Q64_WaitBusy();
+}
+
+void W25Q64_EraseBlock32K(uint32_t addr)
+{
+  W25Q64_StartEraseBlock32K(addr);
+  W25Q64_WaitBusy();
+}
+
+void W25Q64_EraseBlock64K(uint32_t addr)
+{
+  W25Q64_StartEraseBlock64K(addr);
+  W25Q64_WaitBusy();
+}
+
+void W25Q64_EraseChip(void)
+{
+  W25Q64_ResumeErase();
+  W25Q64_WaitBusy();
+  W25Q64_WriteEnable();
+
+  SpiBytes(1);
+  if(TakeWriteEnable())
+  {
+    memset(flash, 0xFF, W25Q64_TOTAL_SIZE);
+    for(uint32_t s = 0; s < SIM_SECTORS; s++)
+    {
+      sector_erases[s]++;
+    }
+    hostsim_stats.erases++;
+    busy_until = hostsim_now + (uint64_t) hostsim_timing.chip_erase_us * 1000;
+  }
+
+  W25Q64_WaitBusy();
+}
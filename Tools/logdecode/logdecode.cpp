@@ -0,0 +1,873 @@
+/*
+ * logdecode.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Rubin Khadka
+ *
+ * Host decoder for the logger flash format. Reads a raw W25Q64 image or a
+ * capture of Logger_DumpBinary(), finds the log sectors by their headers,
+ * puts them in sequence order and writes the records as CSV or as a
+ * columnar binary file with one table per record type. Pages are decompressed with Src/logcodec.c, the
+ * same code the firmware uses. Sectors are decoded in parallel, every
+ * thread owns a contiguous run of sectors.
+ *
+ * Usage:
+ *   logdecode [-f csv|col] [-j threads] [-o output] input
+ *   logdecode --bench [-j threads]
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include "logger.h"
+#include "logcodec.h"
+}
+
+// Flash geometry, see w25q64.h
+static const size_t kSectorSize = 4096;
+static const size_t kPageSize = 256;
+static const size_t kFlashSize = 8 * 1024 * 1024;
+
+static const size_t kHeaderSize = sizeof(LogSectorHeader_t);
+static const size_t kMetaSize = LOGGER_SECTOR_META_SIZE;  // Header and zone map, entries of page 0 follow
+static const size_t kPagesPerSector = kSectorSize / kPageSize;
+
+static_assert(sizeof(LogSectorHeader_t) == 16, "sector header layout changed");
+static_assert(sizeof(LogZoneMap_t) == 74, "zone map layout changed");
+
+// Upper bound, a page of DS18B20 records with all zero deltas, 5 bits each
+static const size_t kMaxEntriesPerPage = kPageSize * 8 / 5;
+static const size_t kMaxEntriesPerSector = kPagesPerSector * kMaxEntriesPerPage;
+
+// Columnar output, header followed by one array per column of every table
+static const char kColumnMagic[8] = { 'S', 'L', 'O', 'G', 'C', 'O', 'L', '2' };
+
+struct ColumnDesc
+{
+  const char *name;
+  uint8_t type;         // 'u' or 'i'
+  uint8_t width;        // Bytes
+};
+
+// Columns of every table after sequence and time_ms
+static const ColumnDesc kImuColumns[] = { { "mpu_temp", 'i', 2 }, { "accel_x", 'i', 2 }, { "accel_y", 'i', 2 },
+                                          { "accel_z", 'i', 2 },  { "gyro_x", 'i', 2 },  { "gyro_y", 'i', 2 },
+                                          { "gyro_z", 'i', 2 } };
+static const ColumnDesc kDs18b20Columns[] = { { "ds18b20_temp", 'i', 2 } };
+static const ColumnDesc kEventColumns[] = { { "id", 'u', 2 }, { "value", 'u', 4 } };
+
+// One table per record type, in LogRecordType_t order
+struct TableDesc
+{
+  const char *name;
+  const ColumnDesc *columns;
+  size_t count;
+};
+
+static const TableDesc kTables[LOG_RECORD_TYPES] = { { "imu", kImuColumns, 7 },
+                                                     { "ds18b20", kDs18b20Columns, 1 },
+                                                     { "event", kEventColumns, 2 },
+                                                     { "config", kEventColumns, 2 } };
+
+enum Format
+{
+  FORMAT_CSV,
+  FORMAT_COLUMNS
+};
+
+// One log sector found in the image
+struct Sector
+{
+  size_t offset;        // Byte offset of the sector in the image
+  uint32_t first_seq;   // Sequence number of its first record
+  uint32_t count;       // Records in the sector
+  uint64_t row;         // Index of its first record in the output
+};
+
+// Decoded records of one type, one array per column
+struct Table
+{
+  std::vector<uint32_t> sequence;
+  std::vector<uint32_t> time;
+  std::vector<std::vector<uint8_t>> value;  // Little endian, kTables widths
+
+  void Resize(const TableDesc &desc, uint64_t rows)
+  {
+    sequence.resize(rows);
+    time.resize(rows);
+    value.resize(desc.count);
+    for(size_t c = 0; c < desc.count; c++)
+    {
+      value[c].resize(rows * desc.columns[c].width);
+    }
+  }
+
+  template <typename T>
+  void Set(size_t column, uint64_t row, T v)
+  {
+    memcpy(&value[column][row * sizeof(T)], &v, sizeof(T));
+  }
+};
+
+struct Columns
+{
+  Table table[LOG_RECORD_TYPES];
+};
+
+// Decode the records of a sector in order, pages end at the first empty one
+// and records without a good checkpoint are skipped like in Logger_DumpAll.
+// Stops after max records, returns the number seen.
+template <typename Fn>
+static uint32_t ForEachRecord(const uint8_t *sector, uint32_t max, Fn fn)
+{
+  std::array<LogRecord_t, kMaxEntriesPerPage> records;
+  LogCodec_t dec;
+  uint32_t n = 0;
+
+  for(size_t p = 0; p < kPagesPerSector && n < max; p++)
+  {
+    size_t offset = (p == 0) ? kMetaSize : 0;
+    uint8_t *page = (uint8_t*) sector + p * kPageSize;  // Only read by the decoder
+    uint16_t count = 0;
+
+    if(page[offset] & 0x80)
+    {
+      break;
+    }
+
+    LogCodec_Begin(&dec, page + offset, kPageSize - offset);
+    if(offset != 0)
+    {
+      LogCodec_Seed(&dec, page + LOGGER_HEADER_SEED_OFFSET, LOGGER_HEADER_SEED_SIZE);
+    }
+
+    // One pass, the records wait here until a checkpoint vouches for them
+    while(count < records.size() && LogCodec_Get(&dec, &records[count]))
+    {
+      count++;
+    }
+
+    for(uint16_t i = 0; i < dec.checked && n < max; i++)
+    {
+      fn(n++, records[i]);
+    }
+  }
+  return n;
+}
+
+// Find all log sectors and order them oldest first
+static std::vector<Sector> FindSectors(const uint8_t *image, size_t size)
+{
+  std::vector<Sector> sectors;
+  LogSectorHeader_t hdr;
+
+  for(size_t offset = 0; offset + kSectorSize <= size; offset += kSectorSize)
+  {
+    memcpy(&hdr, image + offset, kHeaderSize);
+    if(hdr.magic != LOGGER_SECTOR_MAGIC || hdr.version != LOGGER_FORMAT_VERSION)
+    {
+      continue;
+    }
+
+    Sector s;
+    s.offset = offset;
+    s.first_seq = hdr.first_sequence;
+    s.row = 0;
+
+    if(hdr.commit == LOGGER_SECTOR_COMMITTED && hdr.entry_count <= kMaxEntriesPerSector)
+    {
+      s.count = hdr.entry_count;
+    }
+    else
+    {
+      // Still open when the image was taken, count what decodes
+      s.count = ForEachRecord(image + offset, kMaxEntriesPerSector, [](uint32_t, const LogRecord_t &) {});
+    }
+
+    sectors.push_back(s);
+  }
+
+  std::sort(sectors.begin(), sectors.end(), [](const Sector &a, const Sector &b) {
+    return a.first_seq < b.first_seq;
+  });
+
+  uint64_t row = 0;
+  for(auto &s : sectors)
+  {
+    s.row = row;
+    row += s.count;
+  }
+
+  return sectors;
+}
+
+static char *PutUnsigned(char *p, uint32_t v)
+{
+  char tmp[10];
+  int n = 0;
+
+  do
+  {
+    tmp[n++] = '0' + (v % 10);
+    v /= 10;
+  } while(v);
+
+  while(n)
+  {
+    *p++ = tmp[--n];
+  }
+  return p;
+}
+
+static char *PutSigned(char *p, int32_t v)
+{
+  if(v < 0)
+  {
+    *p++ = '-';
+    return PutUnsigned(p, (uint32_t) -v);
+  }
+  return PutUnsigned(p, (uint32_t) v);
+}
+
+static char *PutString(char *p, const char *s)
+{
+  while(*s)
+  {
+    *p++ = *s++;
+  }
+  return p;
+}
+
+// Same lines as Logger_DumpAll, sequence is the full 32 bit number from the header
+static void DecodeCSV(const uint8_t *image, const Sector *first, const Sector *last, std::string *out)
+{
+  char line[96];
+
+  for(const Sector *s = first; s != last; s++)
+  {
+    ForEachRecord(image + s->offset, s->count, [&](uint32_t i, const LogRecord_t &r) {
+      char *c = line;
+      c = PutUnsigned(c, s->first_seq + i);
+      *c++ = ',';
+      c = PutUnsigned(c, r.timestamp);
+      *c++ = ',';
+
+      switch(r.type)
+      {
+        case LOG_RECORD_IMU:
+          c = PutString(c, "IMU,");
+          c = PutSigned(c, r.imu.mpu_temp);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.accel_x);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.accel_y);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.accel_z);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.gyro_x);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.gyro_y);
+          *c++ = ',';
+          c = PutSigned(c, r.imu.gyro_z);
+          break;
+
+        case LOG_RECORD_DS18B20:
+          c = PutString(c, "DS18B20,");
+          c = PutSigned(c, r.ds18b20_temp);
+          break;
+
+        default:
+          c = PutString(c, r.type == LOG_RECORD_EVENT ? "EVENT," : "CONFIG,");
+          c = PutUnsigned(c, r.event.id);
+          *c++ = ',';
+          c = PutUnsigned(c, r.event.value);
+          break;
+      }
+      *c++ = '\n';
+
+      out->append(line, c - line);
+    });
+  }
+}
+
+// Every sector knows its first row in each table, so threads write straight
+// into the shared arrays. rows[n] is that for sector first + n.
+static void DecodeColumns(const uint8_t *image, const Sector *first, const Sector *last,
+                          const std::array<uint64_t, LOG_RECORD_TYPES> *rows, Columns *cols)
+{
+  for(const Sector *s = first; s != last; s++)
+  {
+    std::array<uint64_t, LOG_RECORD_TYPES> next = rows[s - first];
+
+    ForEachRecord(image + s->offset, s->count, [&](uint32_t i, const LogRecord_t &r) {
+      Table &t = cols->table[r.type];
+      uint64_t row = next[r.type]++;
+
+      t.sequence[row] = s->first_seq + i;
+      t.time[row] = r.timestamp;
+
+      switch(r.type)
+      {
+        case LOG_RECORD_IMU:
+          t.Set(0, row, r.imu.mpu_temp);
+          t.Set(1, row, r.imu.accel_x);
+          t.Set(2, row, r.imu.accel_y);
+          t.Set(3, row, r.imu.accel_z);
+          t.Set(4, row, r.imu.gyro_x);
+          t.Set(5, row, r.imu.gyro_y);
+          t.Set(6, row, r.imu.gyro_z);
+          break;
+
+        case LOG_RECORD_DS18B20:
+          t.Set(0, row, r.ds18b20_temp);
+          break;
+
+        default:
+          t.Set(0, row, r.event.id);
+          t.Set(1, row, r.event.value);
+          break;
+      }
+    });
+  }
+}
+
+// Split the sectors in contiguous runs and decode each run on its own thread
+template <typename Fn>
+static void RunParallel(const std::vector<Sector> &sectors, unsigned threads, Fn fn)
+{
+  std::vector<std::thread> pool;
+  size_t per = (sectors.size() + threads - 1) / threads;
+
+  for(unsigned t = 0; t < threads; t++)
+  {
+    size_t begin = std::min(sectors.size(), t * per);
+    size_t end = std::min(sectors.size(), begin + per);
+    pool.emplace_back(fn, t, sectors.data() + begin, sectors.data() + end);
+  }
+
+  for(auto &th : pool)
+  {
+    th.join();
+  }
+}
+
+static void DecodeToCSV(const uint8_t *image, const std::vector<Sector> &sectors, unsigned threads,
+                        std::vector<std::string> *parts)
+{
+  parts->assign(threads, std::string());
+  RunParallel(sectors, threads, [&](unsigned t, const Sector *first, const Sector *last) {
+    size_t rows = 0;
+    for(const Sector *s = first; s != last; s++)
+    {
+      rows += s->count;
+    }
+    (*parts)[t].reserve(rows * 48);
+    DecodeCSV(image, first, last, &(*parts)[t]);
+  });
+}
+
+static uint64_t TotalRows(const std::vector<Sector> &sectors)
+{
+  return sectors.empty() ? 0 : sectors.back().row + sectors.back().count;
+}
+
+// Two passes, the first counts the records of every type in each sector
+// so the second knows where its rows go
+static void DecodeToColumns(const uint8_t *image, const std::vector<Sector> &sectors, unsigned threads,
+                            Columns *cols)
+{
+  std::vector<std::array<uint64_t, LOG_RECORD_TYPES>> rows(sectors.size());
+  std::array<uint64_t, LOG_RECORD_TYPES> total = {};
+
+  RunParallel(sectors, threads, [&](unsigned, const Sector *first, const Sector *last) {
+    for(const Sector *s = first; s != last; s++)
+    {
+      auto &count = rows[s - sectors.data()];
+      count.fill(0);
+      ForEachRecord(image + s->offset, s->count, [&](uint32_t, const LogRecord_t &r) {
+        count[r.type]++;
+      });
+    }
+  });
+
+  // Counts to first rows
+  for(auto &r : rows)
+  {
+    for(size_t t = 0; t < LOG_RECORD_TYPES; t++)
+    {
+      uint64_t n = r[t];
+      r[t] = total[t];
+      total[t] += n;
+    }
+  }
+
+  for(size_t t = 0; t < LOG_RECORD_TYPES; t++)
+  {
+    cols->table[t].Resize(kTables[t], total[t]);
+  }
+
+  RunParallel(sectors, threads, [&](unsigned, const Sector *first, const Sector *last) {
+    DecodeColumns(image, first, last, &rows[first - sectors.data()], cols);
+  });
+}
+
+static bool WriteCSV(FILE *f, const std::vector<std::string> &parts)
+{
+  if(fputs("Seq,TimeMs,Type,Values\n", f) < 0)
+  {
+    return false;
+  }
+
+  for(const auto &p : parts)
+  {
+    if(fwrite(p.data(), 1, p.size(), f) != p.size())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void WriteColumnDesc(FILE *f, const char *column, uint8_t type, uint8_t width)
+{
+  char name[16] = { 0 };
+  uint8_t desc[2] = { type, width };
+
+  strncpy(name, column, sizeof(name) - 1);
+  fwrite(name, 1, sizeof(name), f);
+  fwrite(desc, 1, sizeof(desc), f);
+}
+
+// magic[8] tables(u32), then per table name[16] rows(u64) columns(u32) and per
+// column name[16] type(u8) width(u8). The column arrays follow, table by table
+// in the same order, little endian. Every table starts with sequence and time_ms.
+static bool WriteColumns(FILE *f, const Columns &cols)
+{
+  uint32_t ntables = LOG_RECORD_TYPES;
+
+  fwrite(kColumnMagic, 1, sizeof(kColumnMagic), f);
+  fwrite(&ntables, sizeof(ntables), 1, f);
+
+  for(size_t t = 0; t < LOG_RECORD_TYPES; t++)
+  {
+    char name[16] = { 0 };
+    uint64_t rows = cols.table[t].sequence.size();
+    uint32_t ncols = 2 + kTables[t].count;
+
+    strncpy(name, kTables[t].name, sizeof(name) - 1);
+    fwrite(name, 1, sizeof(name), f);
+    fwrite(&rows, sizeof(rows), 1, f);
+    fwrite(&ncols, sizeof(ncols), 1, f);
+
+    WriteColumnDesc(f, "sequence", 'u', 4);
+    WriteColumnDesc(f, "time_ms", 'u', 4);
+    for(size_t c = 0; c < kTables[t].count; c++)
+    {
+      WriteColumnDesc(f, kTables[t].columns[c].name, kTables[t].columns[c].type, kTables[t].columns[c].width);
+    }
+  }
+
+  for(const auto &table : cols.table)
+  {
+    fwrite(table.sequence.data(), sizeof(uint32_t), table.sequence.size(), f);
+    fwrite(table.time.data(), sizeof(uint32_t), table.time.size(), f);
+    for(const auto &v : table.value)
+    {
+      fwrite(v.data(), 1, v.size(), f);
+    }
+  }
+
+  return !ferror(f);
+}
+
+// Rebuild a flash image from a Logger_DumpBinary capture, see Tools/logdump.py
+static bool CobsDecode(const uint8_t *in, size_t len, std::vector<uint8_t> *out)
+{
+  size_t i = 0;
+
+  out->clear();
+  while(i < len)
+  {
+    uint8_t code = in[i];
+    if(code == 0 || i + code > len)
+    {
+      return false;
+    }
+
+    out->insert(out->end(), in + i + 1, in + i + code);
+    i += code;
+
+    if(code < 0xFF && i < len)
+    {
+      out->push_back(0);
+    }
+  }
+  return true;
+}
+
+static uint32_t Crc32(const uint8_t *p, size_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+  while(len--)
+  {
+    crc ^= *p++;
+    for(int k = 0; k < 8; k++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static bool ImageFromDump(const uint8_t *data, size_t size, std::vector<uint8_t> *image, size_t *pages)
+{
+  std::vector<uint8_t> frame;
+  bool started = false;
+  size_t start = 0;
+
+  image->assign(kFlashSize, 0xFF);
+  *pages = 0;
+
+  for(size_t i = 0; i < size; i++)
+  {
+    if(data[i] != 0)
+    {
+      continue;
+    }
+
+    bool ok = i > start && CobsDecode(data + start, i - start, &frame);
+    start = i + 1;
+
+    if(!ok || frame.size() < LOGGER_FRAME_HEADER_SIZE + LOGGER_FRAME_CRC_SIZE)
+    {
+      continue;
+    }
+
+    uint8_t type = frame[0];
+    uint32_t addr;
+    uint16_t len;
+    uint32_t crc;
+
+    memcpy(&addr, &frame[1], 4);
+    memcpy(&len, &frame[5], 2);
+    if((size_t) LOGGER_FRAME_HEADER_SIZE + len + LOGGER_FRAME_CRC_SIZE != frame.size())
+    {
+      continue;
+    }
+
+    memcpy(&crc, &frame[frame.size() - 4], 4);
+    if(Crc32(frame.data(), frame.size() - 4) != crc)
+    {
+      continue;
+    }
+
+    if(type == LOGGER_FRAME_START)
+    {
+      started = true;
+    }
+    else if(type == LOGGER_FRAME_DATA && addr + len <= kFlashSize)
+    {
+      memcpy(image->data() + addr, &frame[LOGGER_FRAME_HEADER_SIZE], len);
+      (*pages)++;
+    }
+    else if(type == LOGGER_FRAME_END)
+    {
+      break;
+    }
+  }
+
+  return started;
+}
+
+// Full 8 MB image with every log sector closed, oldest sector in the middle
+// of the flash so the ring order has to be recovered. A board lying still,
+// sensor noise around 1 g on Z and slowly drifting temperatures. IMU records
+// every 50 ms, a DS18B20 record after every 20th.
+static void MakeSyntheticImage(std::vector<uint8_t> *image)
+{
+  const unsigned first = 1, last = 1758, count = last - first + 1;
+  const unsigned oldest = first + count / 2;
+  uint32_t seq = 1;
+  uint32_t sample = 0;
+  LogCodec_t enc;
+  LogRecord_t r;
+
+  image->assign(kFlashSize, 0xFF);
+  srand(1);
+
+  // Next record, made before it is known which page it goes into
+  auto next = [&]() {
+    bool temp = (seq % 21 == 0);
+
+    r.sequence = seq;
+    if(temp)
+    {
+      r.type = LOG_RECORD_DS18B20;
+      r.timestamp = sample * 50 + 25;
+      r.ds18b20_temp = 2300 + (int16_t) (sample / 5000) % 200;
+    }
+    else
+    {
+      r.type = LOG_RECORD_IMU;
+      r.timestamp = sample * 50 + (rand() % 8 == 0);  // 50 ms, a little jitter
+      r.imu.mpu_temp = 2500 + (int16_t) (sample / 3000) % 300 + rand() % 3;
+      r.imu.accel_x = rand() % 64 - 32;
+      r.imu.accel_y = rand() % 64 - 32;
+      r.imu.accel_z = 16384 + rand() % 64 - 32;
+      r.imu.gyro_x = rand() % 16 - 8;
+      r.imu.gyro_y = rand() % 16 - 8;
+      r.imu.gyro_z = rand() % 16 - 8;
+    }
+    sample += !temp;
+  };
+
+  next();
+
+  for(unsigned n = 0; n < count; n++)
+  {
+    unsigned sector = first + (oldest - first + n) % count;
+    uint8_t *p = image->data() + sector * kSectorSize;
+    LogSectorHeader_t hdr;
+
+    hdr.magic = LOGGER_SECTOR_MAGIC;
+    hdr.version = LOGGER_FORMAT_VERSION;
+    hdr.commit = LOGGER_SECTOR_COMMITTED;
+    hdr.first_sequence = seq;
+    hdr.first_timestamp = r.timestamp;
+    memcpy(p, &hdr, kHeaderSize);
+
+    for(size_t page = 0; page < kPagesPerSector; page++)
+    {
+      size_t offset = (page == 0) ? kMetaSize : 0;
+      LogCodec_Begin(&enc, p + page * kPageSize + offset, kPageSize - offset);
+      if(offset != 0)
+      {
+        LogCodec_Seed(&enc, p + LOGGER_HEADER_SEED_OFFSET, LOGGER_HEADER_SEED_SIZE);
+      }
+
+      while(LogCodec_Put(&enc, &r))
+      {
+        seq++;
+        next();
+      }
+      LogCodec_Check(&enc);
+    }
+
+    hdr.entry_count = seq - hdr.first_sequence;
+    memcpy(p, &hdr, kHeaderSize);
+  }
+}
+
+static double Seconds(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static int Bench(unsigned max_threads)
+{
+  std::vector<uint8_t> image;
+  const int rounds = 5;
+
+  MakeSyntheticImage(&image);
+
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<Sector> sectors = FindSectors(image.data(), image.size());
+  double scan = Seconds(t0);
+  uint64_t rows = TotalRows(sectors);
+
+  printf("Synthetic image: %zu sectors, %llu records, scan %.2f ms\n", sectors.size(),
+         (unsigned long long) rows, scan * 1e3);
+  printf("%-8s %-8s %10s %12s %12s\n", "format", "threads", "ms", "MB/s in", "Mrecords/s");
+
+  // Powers of two up to the requested thread count
+  std::vector<unsigned> counts;
+  for(unsigned t = 1; t < max_threads; t *= 2)
+  {
+    counts.push_back(t);
+  }
+  counts.push_back(max_threads);
+
+  for(unsigned threads : counts)
+  {
+    for(int fmt = 0; fmt < 2; fmt++)
+    {
+      double best = 1e9;
+
+      for(int r = 0; r < rounds; r++)
+      {
+        auto t = std::chrono::steady_clock::now();
+        if(fmt == FORMAT_CSV)
+        {
+          std::vector<std::string> parts;
+          DecodeToCSV(image.data(), sectors, threads, &parts);
+        }
+        else
+        {
+          Columns cols;
+          DecodeToColumns(image.data(), sectors, threads, &cols);
+        }
+        best = std::min(best, Seconds(t));
+      }
+
+      printf("%-8s %-8u %10.2f %12.1f %12.2f\n", fmt == FORMAT_CSV ? "csv" : "col", threads, best * 1e3,
+             image.size() / best / 1e6, rows / best / 1e6);
+    }
+  }
+
+  return 0;
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "Usage: logdecode [-f csv|col] [-j threads] [-o output] input\n"
+                  "       logdecode --bench [-j threads]\n"
+                  "input is a raw flash image or a Logger_DumpBinary capture\n");
+}
+
+int main(int argc, char **argv)
+{
+  Format format = FORMAT_CSV;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *input = nullptr;
+  const char *output = nullptr;
+  bool bench = false;
+
+  for(int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+
+    if(arg == "--bench")
+    {
+      bench = true;
+    }
+    else if(arg == "-f" && i + 1 < argc)
+    {
+      std::string f = argv[++i];
+      if(f == "csv")
+      {
+        format = FORMAT_CSV;
+      }
+      else if(f == "col")
+      {
+        format = FORMAT_COLUMNS;
+      }
+      else
+      {
+        Usage();
+        return 2;
+      }
+    }
+    else if(arg == "-j" && i + 1 < argc)
+    {
+      threads = std::max(1, atoi(argv[++i]));
+    }
+    else if(arg == "-o" && i + 1 < argc)
+    {
+      output = argv[++i];
+    }
+    else if(arg[0] != '-' && !input)
+    {
+      input = argv[i];
+    }
+    else
+    {
+      Usage();
+      return 2;
+    }
+  }
+
+  if(bench)
+  {
+    return Bench(threads);
+  }
+
+  if(!input)
+  {
+    Usage();
+    return 2;
+  }
+
+  int fd = open(input, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+  {
+    perror(input);
+    return 1;
+  }
+
+  const uint8_t *data = (const uint8_t*) mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(data == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+
+  // A raw image is exactly the flash size, anything else has to be a dump capture
+  const uint8_t *image = data;
+  size_t image_size = st.st_size;
+  std::vector<uint8_t> rebuilt;
+
+  if((size_t) st.st_size != kFlashSize)
+  {
+    size_t pages;
+    if(!ImageFromDump(data, st.st_size, &rebuilt, &pages))
+    {
+      fprintf(stderr, "%s: neither a flash image nor a dump capture\n", input);
+      return 1;
+    }
+    fprintf(stderr, "Dump capture: %zu pages\n", pages);
+    image = rebuilt.data();
+    image_size = rebuilt.size();
+  }
+
+  std::vector<Sector> sectors = FindSectors(image, image_size);
+  threads = std::min<unsigned>(threads, std::max<size_t>(1, sectors.size()));
+
+  FILE *f = output ? fopen(output, "wb") : stdout;
+  if(!f)
+  {
+    perror(output);
+    return 1;
+  }
+
+  bool ok;
+  if(format == FORMAT_CSV)
+  {
+    std::vector<std::string> parts;
+    DecodeToCSV(image, sectors, threads, &parts);
+    ok = WriteCSV(f, parts);
+  }
+  else
+  {
+    Columns cols;
+    DecodeToColumns(image, sectors, threads, &cols);
+    ok = WriteColumns(f, cols);
+  }
+
+  if(output)
+  {
+    ok = (fclose(f) == 0) && ok;
+  }
+
+  fprintf(stderr, "%zu sectors, %llu records\n", sectors.size(), (unsigned long long) TotalRows(sectors));
+
+  munmap((void*) data, st.st_size);
+  close(fd);
+
+  return ok ? 0 : 1;
+}
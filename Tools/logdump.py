@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+#
+# logdump.py
+#
+#  Created on: Oct 17, 2026
+#      Author: Rubin Khadka
+#
+# Host side of Logger_DumpBinary(). Reads COBS framed dump frames from a
+# serial port or a capture file, checks each frame's CRC32 and writes the
+# flash contents into an 8 MB image at their original addresses. Running
+# it again on the same image merges a resumed dump into it. On a serial
+# port it asks for the dump itself with the console's "bdump" command.
+#
+# Usage:
+#   logdump.py --port /dev/ttyUSB0 --image flash.bin
+#   logdump.py --port /dev/ttyUSB0 --image flash.bin --start 0x1A2000
+#   logdump.py --input capture.bin --image flash.bin
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+FRAME_START = 0x01
+FRAME_DATA = 0x02
+FRAME_END = 0x03
+
+FRAME_HEADER = struct.Struct("<BIH")
+DUMP_INFO = struct.Struct("<BBHHHHHII")
+
+FLASH_SIZE = 8 * 1024 * 1024
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        # Blocks shorter than 254 bytes stand for a zero, except at the end
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def parse_frame(raw):
+    frame = cobs_decode(raw)
+    if frame is None or len(frame) < FRAME_HEADER.size + 4:
+        return None
+
+    ftype, addr, length = FRAME_HEADER.unpack_from(frame)
+    if FRAME_HEADER.size + length + 4 != len(frame):
+        return None
+
+    body = frame[:-4]
+    (crc,) = struct.unpack_from("<I", frame, len(frame) - 4)
+    if zlib.crc32(body) & 0xFFFFFFFF != crc:
+        return None
+
+    return ftype, addr, body[FRAME_HEADER.size:]
+
+
+def read_frames(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            break
+        buf += chunk
+        while True:
+            end = buf.find(b"\x00")
+            if end < 0:
+                break
+            raw = bytes(buf[:end])
+            del buf[:end + 1]
+            if raw:
+                yield raw
+
+
+def open_image(path):
+    if not os.path.exists(path):
+        with open(path, "wb") as f:
+            f.write(b"\xFF" * FLASH_SIZE)
+    return open(path, "r+b")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Decode a binary logger dump into a flash image")
+    src = ap.add_mutually_exclusive_group(required=True)
+    src.add_argument("--port", help="serial port the logger is connected to")
+    src.add_argument("--input", help="file holding captured dump bytes")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--image", required=True, help="flash image to write, created if missing")
+    ap.add_argument("--start", type=lambda s: int(s, 0), default=0,
+                    help="flash address to resume a dump at, with --port")
+    args = ap.parse_args()
+
+    if args.port:
+        import serial  # pyserial, only needed for live capture
+        stream = serial.Serial(args.port, args.baud, timeout=5)
+        stream.reset_input_buffer()
+        stream.write(b"bdump 0x%06X\r\n" % args.start)
+    else:
+        stream = open(args.input, "rb")
+
+    image = open_image(args.image)
+    info = None
+    frames = 0
+    bad = 0
+    expected = None
+    last_good = None
+    resume = None
+
+    for raw in read_frames(stream):
+        parsed = parse_frame(raw)
+        if parsed is None:
+            # Text before the dump is ignored, a damaged frame inside it
+            # means resuming after the last page that arrived before it
+            if info is not None:
+                bad += 1
+                if resume is None:
+                    resume = last_good if last_good is not None else 0
+            continue
+
+        ftype, addr, data = parsed
+        if ftype == FRAME_START and len(data) == DUMP_INFO.size:
+            info = DUMP_INFO.unpack(data)
+            print("Log v%d, mode %d, sectors %d..%d, oldest %d, newest %d, %d entries, from 0x%06X"
+                  % (info[0], info[1], info[2], info[3], info[4], info[5], info[7], info[8]))
+        elif ftype == FRAME_DATA and addr + len(data) <= FLASH_SIZE:
+            image.seek(addr)
+            image.write(data)
+            frames += 1
+            last_good = addr
+        elif ftype == FRAME_END and len(data) == 4:
+            (expected,) = struct.unpack("<I", data)
+            break
+
+    image.close()
+
+    print("%d pages written, %d bad frames" % (frames, bad))
+    if resume is None:
+        resume = last_good if last_good is not None else 0
+    if expected is None or bad or expected != frames:
+        # 0 asks the logger for the whole log again
+        print("Dump incomplete, resume from 0x%06X" % resume)
+        return 1
+
+    print("Dump complete")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())